@@ -43,7 +43,18 @@ struct BD {
 	 * that this behavior is only actually necessary at the terminal BD,
 	 * because this is where it really hurts to do unnecessary reads. */
 	DECLARE(BD_t, bdesc_t *, synthetic_read_block, uint32_t number, uint16_t count, page_t * page);
+	/* This function is a hint that 'nbdescs' consecutive blocks of 'count'
+	 * blocks each, starting at 'number', will be read soon. A BD may start
+	 * reading them (even asynchronously) or ignore the hint. It returns the
+	 * number of blocks it started reading. */
+	DECLARE(BD_t, int, read_ahead, uint32_t number, uint16_t count, uint16_t nbdescs);
 	DECLARE(BD_t, int, write_block, bdesc_t * block, uint32_t number);
+	/* Writes a run of blocks: blocks[0] goes at number, and each block
+	 * after it immediately follows the one before. Returns the number of
+	 * leading blocks written, or a negative error if none were. The blocks
+	 * within one run may reach the disk in any order, so no patch in a run
+	 * may depend on an unwritten patch on another block of the same run. */
+	DECLARE(BD_t, int, write_blocks, bdesc_t ** blocks, uint16_t count, uint32_t number);
 	DECLARE(BD_t, int, flush, uint32_t block, patch_t * patch);
 	DECLARE(BD_t, patch_t **, get_write_head);
 	/* This function returns the number of dirtyable cache blocks in the
@@ -58,7 +69,9 @@ struct BD {
 	(bd)->blocksize = 0; (bd)->atomicsize = 0; (bd)->numblocks = 0;	\
 	ASSIGN(bd, module, read_block); \
 	ASSIGN(bd, module, synthetic_read_block); \
+	ASSIGN(bd, module, read_ahead); \
 	ASSIGN(bd, module, write_block); \
+	ASSIGN(bd, module, write_blocks); \
 	ASSIGN(bd, module, flush); \
 	ASSIGN(bd, module, get_write_head); \
 	ASSIGN(bd, module, get_block_space); \
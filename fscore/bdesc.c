@@ -104,6 +104,7 @@ bdesc_t * bdesc_alloc(uint32_t number, uint32_t blocksize, uint32_t count, page_
 	bdesc->ar_next = NULL;
 	bdesc->synthetic = 0;
 	bdesc->in_flight = 0;
+	bdesc->read_ahead = 0;
 	bdesc->flags = 0;
 	bdesc->all_patches = NULL;
 	bdesc->all_patches_tail = &bdesc->all_patches;
@@ -123,8 +124,9 @@ bdesc_t * bdesc_alloc(uint32_t number, uint32_t blocksize, uint32_t count, page_
 #if PATCH_NRB
 	WEAK_INIT(bdesc->nrb);
 #endif
-	for (i = 0; i < NOVERLAP1 + 1; i++)
+	for (i = 0; i < 2 * NOVERLAP1; i++)
 		bdesc->overlap1[i] = NULL;
+	bdesc->overlap1_used = 0;
 	bdesc->bit_patches = NULL;
 	bdesc->disk_hash.pprev = NULL;
 	bdesc->length = blocksize * count;
@@ -139,8 +141,7 @@ void __bdesc_release(bdesc_t *bdesc)
 	FSTITCH_DEBUG_SEND(FDB_MODULE_BDESC, FDB_BDESC_DESTROY, bdesc, bdesc);
 	FSTITCH_DEBUG_SEND(FDB_MODULE_BDESC, FDB_BDESC_FREE_DDESC, bdesc, bdesc);
 	assert(!bdesc->all_patches);
-	assert(!bdesc->overlap1[0]);
-	/* XXX don't bother checking other overlap1[] */
+	assert(!bdesc->overlap1_used);
 #if BDESC_EXTERN_AFTER_COUNT
 	assert(!bdesc->extern_after_count);
 #endif
@@ -235,6 +236,19 @@ unsigned int bdesc_autorelease_pool_depth(void)
 	return autorelease_depth;
 }
 
+int bdesc_write_blocks_each(BD_t * bd, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	uint16_t i;
+	for(i = 0; i < count; i++)
+	{
+		int r = CALL(bd, write_block, blocks[i], number);
+		if(r < 0)
+			return i ? i : r;
+		number += blocks[i]->length / bd->blocksize;
+	}
+	return count;
+}
+
 int bdesc_init(void)
 {
 	return fstitchd_register_shutdown_module(bdesc_pools_free_all, NULL, SHUTDOWN_POSTMODULES);
@@ -34,9 +34,6 @@
 #include <fscore/debug.h>
 #include <fscore/bd.h>
 
-/* reorder the queue to try and find a better flush order */
-#define DIRTY_QUEUE_REORDERING 0
-
 struct bdesc {
 #ifdef __KERNEL__
 	page_t * page;
@@ -47,7 +44,9 @@ struct bdesc {
 
 	unsigned in_flight : 1;
 	unsigned synthetic : 1;
-	unsigned flags : 30;
+	unsigned cache_in : 1; /* in the cache's first-use queue */
+	unsigned read_ahead : 1; /* data is still being read ahead */
+	unsigned flags : 28;
 	
 	// PATCH INFORMATION
 	patch_t * all_patches;
@@ -70,19 +69,19 @@ struct bdesc {
 
 #define OVERLAP1SHIFT	5
 #define NOVERLAP1	32
-	patch_t * overlap1[1 + NOVERLAP1];
+	/* Byte patches, each in the smallest aligned power-of-two run of the
+	 * block's NOVERLAP1 slices that contains it: overlap1[1] is the whole
+	 * block, overlap1[2..3] its halves, down to one slice each in
+	 * overlap1[NOVERLAP1..2*NOVERLAP1-1]. overlap1[0] is unused. */
+	patch_t * overlap1[2 * NOVERLAP1];
+	/* bit i is set iff overlap1[i] is not empty */
+	uint64_t overlap1_used;
 	
 	hash_map_t * bit_patches;
 	
 	// WB CACHE INFORMATION
 	uint32_t cache_number;
-#if DIRTY_QUEUE_REORDERING
-	uint32_t pass;
-	/* if we've put a block after this one already during this pass through
-	 * the dirty blocks, put further blocks after that one instead */
-	uint32_t block_after_number;
-	uint32_t block_after_pass;
-#endif
+	int dirty_time; /* jiffy_time() when the block became dirty */
 	struct {
 		struct bdesc ** pprev;
 		struct bdesc * next;
@@ -139,6 +138,10 @@ void bdesc_autorelease_pool_pop(void);
 /* get the number of autorelease pools on the stack */
 unsigned int bdesc_autorelease_pool_depth(void);
 
+/* write_blocks() for BDs without a vectored path: calls write_block() on
+ * each block of the run in turn, stopping at the first error */
+int bdesc_write_blocks_each(BD_t * bd, bdesc_t ** blocks, uint16_t count, uint32_t number);
+
 #ifdef __KERNEL__
 # include <linux/page-flags.h>
 # include <linux/mm.h>
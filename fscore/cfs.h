@@ -12,6 +12,16 @@
 #include <fscore/inode.h>
 #include <fscore/fdesc.h>
 
+/* A range of file data held in a cache block, as returned by read_extents.
+ * The block is retained for the caller, who must release it once done with
+ * the data. The data is only valid until the next file system operation. */
+struct cfs_extent {
+	bdesc_t * block;
+	uint32_t offset;
+	uint32_t length;
+};
+typedef struct cfs_extent cfs_extent_t;
+
 struct CFS {
 	OBJECT(CFS_t);
 	DECLARE(CFS_t, int, get_root, inode_t * inode);
@@ -21,6 +31,10 @@ struct CFS {
 	DECLARE(CFS_t, int, close, fdesc_t * fdesc);
 	DECLARE(CFS_t, int, read, fdesc_t * fdesc, page_t * page, void * data, uint32_t offset, uint32_t size);
 	DECLARE(CFS_t, int, write, fdesc_t * fdesc, page_t * page, const void * data, uint32_t offset, uint32_t size);
+	/* Like read, but rather than copying the data, fill in at most
+	 * *nextents extents describing it and set *nextents to the number
+	 * used. Returns the number of bytes described. */
+	DECLARE(CFS_t, int, read_extents, fdesc_t * fdesc, uint32_t offset, uint32_t size, cfs_extent_t * extents, uint32_t * nextents);
 	DECLARE(CFS_t, int, get_dirent, fdesc_t * file, struct dirent * entry, uint16_t size, uint32_t * basep);
 	DECLARE(CFS_t, int, truncate, fdesc_t * fdesc, uint32_t size);
 	DECLARE(CFS_t, int, unlink, inode_t parent, const char * name);
@@ -32,6 +46,10 @@ struct CFS {
 	DECLARE(CFS_t, const bool *, get_feature_array);
 	DECLARE(CFS_t, int, get_metadata, inode_t inode, uint32_t id, size_t size, void * data);
 	DECLARE(CFS_t, int, set_metadata2, inode_t inode, const fsmetadata_t *fsm, size_t nfsm);
+	/* Write the changes made so far to inode, including to the directory
+	 * entries naming it, and everything they depend on. Returns -ENOSYS
+	 * if only a global sync is supported. */
+	DECLARE(CFS_t, int, sync_inode, inode_t inode);
 };
 
 #define CFS_INIT(cfs, module) { \
@@ -43,6 +61,7 @@ struct CFS {
 	ASSIGN(cfs, module, close); \
 	ASSIGN(cfs, module, read); \
 	ASSIGN(cfs, module, write); \
+	ASSIGN(cfs, module, read_extents); \
 	ASSIGN(cfs, module, get_dirent); \
 	ASSIGN(cfs, module, truncate); \
 	ASSIGN(cfs, module, unlink); \
@@ -54,6 +73,7 @@ struct CFS {
 	ASSIGN(cfs, module, get_feature_array); \
 	ASSIGN(cfs, module, get_metadata); \
 	ASSIGN(cfs, module, set_metadata2); \
+	ASSIGN(cfs, module, sync_inode); \
 }
 
 #endif /* __FSTITCH_FSCORE_CFS_H */
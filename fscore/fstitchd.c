@@ -257,6 +257,10 @@ MODULE_PARM_DESC(linux_device, "Alias for device");
 #if ALLOW_JOURNAL
 module_param(use_journal, int, 0);
 MODULE_PARM_DESC(use_journal, "Use journal device when .journal exists");
+
+char * linux_journal_device = NULL;
+module_param_named(journal_device, linux_journal_device, charp, 0);
+MODULE_PARM_DESC(journal_device, "A separate device to hold the journal instead of .journal");
 #endif
 
 #if ALLOW_UNLINK
@@ -358,6 +362,9 @@ static void fstitchd_main(int nwbblocks)
 }
 
 char * unix_file = NULL;
+#if ALLOW_JOURNAL
+char * unix_journal_file = NULL;
+#endif
 int fstitchd_argc = 0;
 char ** fstitchd_argv = NULL;
 
@@ -378,6 +385,9 @@ int main(int argc, char * argv[])
 		{
 			printf("nwbblocks=<The number of write-back blocks to use>\n");
 			printf("unix_file=<The device to attach unix_file_bd to>\n");
+#if ALLOW_JOURNAL
+			printf("journal_file=<A separate device to hold the journal instead of .journal>\n");
+#endif
 			printf("use -h for help on fuse options\n");
 			return 0;
 		}
@@ -390,7 +400,16 @@ int main(int argc, char * argv[])
 		{
 			unix_file = &argv[i][10];
 			remove_arg(&argc, argv, i--);
-		} else if (strlen(argv[i]) > 4 && strcmp(argv[i] + strlen(argv[i]) - 4, ".img") == 0) {
+		}
+#if ALLOW_JOURNAL
+		/* before the .img check below, which would take this file */
+		else if(!strncmp(argv[i], "journal_file=", 13))
+		{
+			unix_journal_file = &argv[i][13];
+			remove_arg(&argc, argv, i--);
+		}
+#endif
+		else if (strlen(argv[i]) > 4 && strcmp(argv[i] + strlen(argv[i]) - 4, ".img") == 0) {
 			unix_file = argv[i];
 			remove_arg(&argc, argv, i--);
 		}
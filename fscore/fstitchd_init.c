@@ -340,6 +340,61 @@ int fstitchd_init(int nwbblocks)
 	return 0;
 }
 
+#if ALLOW_JOURNAL
+// Open the separate journal device into *journalbd, or set it to NULL if none
+// was given. It gets its own cache, so committing a transaction flushes only
+// it, and the home device is checkpointed lazily by its cache. The device
+// holds one journal, so only one partition may use it.
+static int construct_journal_device(uint32_t cache_nblks, uint16_t blocksize, BD_t ** journalbd)
+{
+	static bool journal_device_used = 0;
+	const char * name;
+	BD_t * bd = NULL;
+	BD_t * cache;
+
+	*journalbd = NULL;
+#ifdef __KERNEL__
+	extern char * linux_journal_device;
+	if (! (name = linux_journal_device) )
+		return 0;
+#elif defined(UNIXUSER)
+	extern char * unix_journal_file;
+	if (! (name = unix_journal_file) )
+		return 0;
+#else
+	return 0;
+#endif
+	if (journal_device_used)
+	{
+		fprintf(stderr, "Journal device %s already holds the journal of another partition\n", name);
+		return -EBUSY;
+	}
+
+#ifdef __KERNEL__
+	extern int use_unsafe_disk_cache;
+	printf("Using journal device %s\n", name);
+	if (! (bd = linux_bd(name, use_unsafe_disk_cache)) )
+		fprintf(stderr, "linux_bd(\"%s\") failed\n", name);
+#elif defined(UNIXUSER)
+	printf("Using journal file '%s'\n", name);
+	if (! (bd = unix_file_bd(name, blocksize)) )
+		fprintf(stderr, "unix_file_bd(\"%s\") failed\n", name);
+#endif
+	if (!bd)
+		return -ENODEV;
+
+	/* the journal is written sequentially, so a smaller cache will do */
+	if (! (cache = construct_cacheing(bd, cache_nblks / 4, blocksize)) )
+	{
+		(void) DESTROY(bd);
+		return -ENOMEM;
+	}
+	journal_device_used = 1;
+	*journalbd = cache;
+	return 0;
+}
+#endif
+
 static LFS_t * construct_lfs(fstitchd_partition_t * part, uint32_t cache_nblks, LFS_t * (*fs)(BD_t *), const char * name, uint16_t blocksize)
 {
 	LFS_t * plain_lfs;
@@ -378,24 +433,37 @@ static LFS_t * construct_lfs(fstitchd_partition_t * part, uint32_t cache_nblks,
 			inode_t root_ino, journal_ino;
 			int r;
 
-			r = CALL(plain_lfs, get_root, &root_ino);
+			r = construct_journal_device(cache_nblks, blocksize, &journalbd);
 			if (r < 0)
 			{
-				fprintf(stderr, "get_root: %i\n", r);
+				/* do not quietly journal elsewhere or not at all */
+				fprintf(stderr, "Not using %s on %s without its journal device\n", name, part->description);
+				(void) DESTROY(plain_lfs);
+				(void) DESTROY(journal);
+				(void) DESTROY(cache);
 				return NULL;
 			}
-			r = CALL(plain_lfs, lookup_name, root_ino, ".journal", &journal_ino);
-			if (r < 0)
-			{
-				fprintf(stderr, "No journal file; restarting modules\n");
-				goto disable_journal;
-			}
-
-			journalbd = loop_bd(plain_lfs, journal_ino);
 			if (!journalbd)
 			{
-				fprintf(stderr, "loop_bd failed\n");
-				goto disable_journal;
+				r = CALL(plain_lfs, get_root, &root_ino);
+				if (r < 0)
+				{
+					fprintf(stderr, "get_root: %i\n", r);
+					return NULL;
+				}
+				r = CALL(plain_lfs, lookup_name, root_ino, ".journal", &journal_ino);
+				if (r < 0)
+				{
+					fprintf(stderr, "No journal file; restarting modules\n");
+					goto disable_journal;
+				}
+
+				journalbd = loop_bd(plain_lfs, journal_ino);
+				if (!journalbd)
+				{
+					fprintf(stderr, "loop_bd failed\n");
+					goto disable_journal;
+				}
 			}
 			r = journal_bd_set_journal(journal, journalbd);
 			if (r < 0)
@@ -13,6 +13,7 @@
 #include <time.h>
 
 #include <fscore/cfs.h>
+#include <fscore/bdesc.h>
 #include <fscore/feature.h>
 #include <fscore/fstitchd.h>
 #include <fscore/sync.h>
@@ -33,7 +34,9 @@
 // - Add support for the other fuse_lowlevel_ops that make sense
 // - Switch off kernel buffer cache for ourself? (direct_io)
 // - Be safer; eg call open() only when we should
-// - Support delayed event response or multiple threads
+// - Support delayed event response or multiple threads (even reads are not
+//   reentrant below the CFS: bdesc autorelease pools, cache LRU updates,
+//   misses that evict, and per-fdesc lookup caches would all need locking)
 
 #define fuse_reply_assert(r) /* nothing */
 
@@ -894,10 +897,13 @@ static void serve_link(fuse_req_t req, fuse_ino_t fuse_ino,
 static void ssync(fuse_req_t req, fuse_ino_t fuse_ino, int datasync,
                   struct fuse_file_info * fi)
 {
+	CFS_t * cfs = reqcfs(req);
 	int r;
 
 	// ignore datasync
-	r = fstitch_sync();
+	r = CALL(cfs, sync_inode, fusecfsino(req, fuse_ino));
+	if (r == -ENOSYS)
+		r = fstitch_sync();
 	if (r < 0)
 	{
 		r = fuse_reply_err(req, -r);
@@ -1083,12 +1089,47 @@ static void serve_release(fuse_req_t req, fuse_ino_t fuse_ino, struct fuse_file_
 	fuse_reply_assert(!r);
 }
 
+// FUSE reads are at most 128kB; allow for 512 byte blocks and unaligned ends
+#define READ_MAX_EXTENTS (128 * 1024 / 512 + 2)
+
+static void release_extents(cfs_extent_t * extents, uint32_t nextents)
+{
+	uint32_t i;
+	for (i = 0; i < nextents; i++)
+		bdesc_release(&extents[i].block);
+}
+
+static void serve_read_copy(fuse_req_t req, fdesc_t * fdesc, size_t size, uint32_t offset)
+{
+	char * buf;
+	int r;
+
+	buf = malloc(size);
+	assert(buf);
+
+	r = CALL(reqcfs(req), read, fdesc, NULL, buf, offset, size);
+	if (r <= 0)
+	{
+		// TODO: handle EOF?
+		free(buf);
+		r = fuse_reply_buf(req, NULL, 0);
+		fuse_reply_assert(!r);
+		return;
+	}
+
+	r = fuse_reply_buf(req, buf, r);
+	free(buf);
+	assert(r >= 0);
+}
+
 static void serve_read(fuse_req_t req, fuse_ino_t fuse_ino, size_t size,
                        off_t off, struct fuse_file_info * fi)
 {
 	fdesc_t * fdesc = fi_get_fdesc(fi);
 	uint32_t offset = off;
-	char * buf;
+	cfs_extent_t extents[READ_MAX_EXTENTS];
+	struct iovec iov[READ_MAX_EXTENTS];
+	uint32_t i, nextents = READ_MAX_EXTENTS;
 	int r;
 	Dprintf("%s(ino = %lu, fdesc = %p, size = %u, off = %lld)\n", __FUNCTION__, fuse_ino, fdesc, size, off);
 
@@ -1100,22 +1141,33 @@ static void serve_read(fuse_req_t req, fuse_ino_t fuse_ino, size_t size,
 		return;
 	}
 
-	buf = malloc(size);
-	assert(buf);
-
-	r = CALL(reqcfs(req), read, fdesc, NULL, buf, off, size);
+	// Reply straight from the cache blocks, which stay retained until the
+	// reply has been sent
+	r = CALL(reqcfs(req), read_extents, fdesc, offset, size, extents, &nextents);
+	if (r == -ENOSYS || (nextents == READ_MAX_EXTENTS && r < size))
+	{
+		// the CFS can not describe this read; copy it instead
+		release_extents(extents, nextents);
+		serve_read_copy(req, fdesc, size, offset);
+		return;
+	}
 	if (r <= 0)
 	{
-		// TODO: handle EOF?
+		// nothing to read here; reply as serve_read_copy() does
+		release_extents(extents, nextents);
 		r = fuse_reply_buf(req, NULL, 0);
 		fuse_reply_assert(!r);
 		return;
 	}
 
-	r = fuse_reply_buf(req, buf, r);
-	free(buf);
+	for (i = 0; i < nextents; i++)
+	{
+		iov[i].iov_base = bdesc_data(extents[i].block) + extents[i].offset;
+		iov[i].iov_len = extents[i].length;
+	}
+	r = fuse_reply_iov(req, iov, nextents);
+	release_extents(extents, nextents);
 	assert(r >= 0);
-	return;
 }
 
 static void serve_write(fuse_req_t req, fuse_ino_t fuse_ino, const char * buf,
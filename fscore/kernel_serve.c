@@ -1067,10 +1067,14 @@ static int serve_dir_readdir(struct file * filp, void * k_dirent, filldir_t fill
 static int serve_fsync(struct file * filp, struct dentry * dentry, int datasync)
 {
 	Dprintf("%s(\"%s\")\n", __FUNCTION__, dentry->d_name.name);
+	CFS_t * cfs;
 	int r;
 
 	fstitchd_enter();
-	r = fstitch_sync();
+	cfs = dentry2cfs(dentry);
+	r = CALL(cfs, sync_inode, dentry->d_inode->i_ino);
+	if (r == -ENOSYS)
+		r = fstitch_sync();
 	fstitchd_leave(1);
 	return r;
 }
@@ -60,12 +60,17 @@ struct LFS {
 	DECLARE(LFS_t, void, free_fdesc, fdesc_t * fdesc);
 	DECLARE(LFS_t, uint32_t, get_file_numblocks, fdesc_t * file);
 	DECLARE(LFS_t, uint32_t, get_file_block, fdesc_t * file, uint32_t offset);
+	/* like get_file_block, but also sets *nblocks to the number of blocks
+	 * starting there that are contiguous on disk (0 if none) */
+	DECLARE(LFS_t, uint32_t, get_file_extent, fdesc_t * file, uint32_t offset, uint32_t * nblocks);
 	DECLARE(LFS_t, int, get_dirent, fdesc_t * file, struct dirent * entry, uint16_t size, uint32_t * basep);
 	DECLARE(LFS_t, int, append_file_block, fdesc_t * file, uint32_t block, patch_t ** head);
 	DECLARE(LFS_t, fdesc_t *, allocate_name, inode_t parent, const char * name, uint8_t type, fdesc_t * link, const metadata_set_t * initial_metadata, inode_t * newinode, patch_t ** head);
 	DECLARE(LFS_t, int, rename, inode_t oldparent, const char * oldname, inode_t newparent, const char * newname, patch_t ** head);
 	DECLARE(LFS_t, uint32_t, truncate_file_block, fdesc_t * file, patch_t ** head);
 	DECLARE(LFS_t, int, free_block, fdesc_t * file, uint32_t block, patch_t ** head);
+	/* free 'count' blocks at once; *head ends up depending on freeing all of them */
+	DECLARE(LFS_t, int, free_blocks, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head);
 	DECLARE(LFS_t, int, remove_name, inode_t parent, const char * name, patch_t ** head);
 	DECLARE(LFS_t, int, write_block, bdesc_t * block, uint32_t number, patch_t ** head);
 	DECLARE(LFS_t, patch_t **, get_write_head);
@@ -98,12 +103,14 @@ struct LFS {
 	ASSIGN(lfs, module, free_fdesc); \
 	ASSIGN(lfs, module, get_file_numblocks); \
 	ASSIGN(lfs, module, get_file_block); \
+	ASSIGN(lfs, module, get_file_extent); \
 	ASSIGN(lfs, module, get_dirent); \
 	ASSIGN(lfs, module, append_file_block); \
 	ASSIGN(lfs, module, allocate_name); \
 	ASSIGN(lfs, module, rename); \
 	ASSIGN(lfs, module, truncate_file_block); \
 	ASSIGN(lfs, module, free_block); \
+	ASSIGN(lfs, module, free_blocks); \
 	ASSIGN(lfs, module, remove_name); \
 	ASSIGN(lfs, module, write_block); \
 	ASSIGN(lfs, module, get_write_head); \
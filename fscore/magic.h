@@ -17,6 +17,8 @@
 
 /* "SAFEDATA" */
 #define JOURNAL_MAGIC 0x5AFEDA7A
+/* "SAFEC5C5": journal records carrying a checksum */
+#define JOURNAL_CSUM_MAGIC 0x5AFEC5C5
 
 /* "FILEHIDE" */
 #define FILE_HIDING_MAGIC 0xF11E41DE
@@ -30,6 +32,9 @@
 /* "DATADELA" */
 #define WB_CACHE_MAGIC 0xDA7ADE1A
 
+/* "DATADEL2" */
+#define WB2_CACHE_MAGIC 0xDA7ADE12
+
 /* "WOLEDISC" */
 #define WHOLEDISK_MAGIC 0x301ED15C
 
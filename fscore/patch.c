@@ -52,6 +52,16 @@
 /* Set to enable patch accounting */
 #define PATCH_ACCOUNT 0
 
+/* Set to allocate byte patch data from per-size-class slabs */
+#define PATCH_DATA_SLABS (!SWAP_FULLBLOCK_DATA)
+/* number of completely free slabs to keep per pool when reclaiming */
+#define PATCH_SLAB_RESERVE 4
+
+/* Set to print sizeof(patch_t) as a compiler warning */
+#define PATCH_SIZE_REPORT 0
+/* the fields before patch_t.overlap_next should fit in this many bytes */
+#define PATCH_HOT_BYTES 64
+
 /* Allow malloc in recursion-on-the-heap support */
 #define HEAP_RECURSION_ALLOW_MALLOC 0
 
@@ -232,13 +242,109 @@ static int account_init_all(void)
 # define account_init_all() 0
 #endif
 
-DECLARE_POOL(patch, patch_t);
-DECLARE_POOL(patchdep, patchdep_t);
+DECLARE_SLAB_POOL(patch, patch_t);
+DECLARE_SLAB_POOL(patchdep, patchdep_t);
+
+/* bytes of byte patch data allocated outside of the patches themselves */
+static uint32_t patch_data_bytes;
+
+#if PATCH_DATA_SLABS
+/* size classes for byte patch data; longer data comes from malloc() */
+typedef struct { uint8_t data[8]; } patch_data8_t;
+typedef struct { uint8_t data[16]; } patch_data16_t;
+typedef struct { uint8_t data[32]; } patch_data32_t;
+typedef struct { uint8_t data[64]; } patch_data64_t;
+typedef struct { uint8_t data[128]; } patch_data128_t;
+typedef struct { uint8_t data[256]; } patch_data256_t;
+typedef struct { uint8_t data[512]; } patch_data512_t;
+DECLARE_SLAB_POOL(patch_data8, patch_data8_t);
+DECLARE_SLAB_POOL(patch_data16, patch_data16_t);
+DECLARE_SLAB_POOL(patch_data32, patch_data32_t);
+DECLARE_SLAB_POOL(patch_data64, patch_data64_t);
+DECLARE_SLAB_POOL(patch_data128, patch_data128_t);
+DECLARE_SLAB_POOL(patch_data256, patch_data256_t);
+DECLARE_SLAB_POOL(patch_data512, patch_data512_t);
+
+#define PATCH_DATA_CLASSES(f) \
+	f(8) f(16) f(32) f(64) f(128) f(256) f(512)
+
+static void * patch_data_alloc(uint16_t length)
+{
+	void * data;
+#define ALLOC_CLASS(size) \
+	if(length <= size) \
+		data = patch_data##size##_alloc(); \
+	else
+	PATCH_DATA_CLASSES(ALLOC_CLASS)
+		data = malloc(length);
+#undef ALLOC_CLASS
+	if(data)
+		patch_data_bytes += length;
+	return data;
+}
+
+static void patch_data_free(void * data, uint16_t length)
+{
+#define FREE_CLASS(size) \
+	if(length <= size) \
+		patch_data##size##_free(data); \
+	else
+	PATCH_DATA_CLASSES(FREE_CLASS)
+		free(data);
+#undef FREE_CLASS
+	patch_data_bytes -= length;
+}
+#else
+static void * patch_data_alloc(uint16_t length)
+{
+	void * data = malloc(length);
+	if(data)
+		patch_data_bytes += length;
+	return data;
+}
+
+static void patch_data_free(void * data, uint16_t length)
+{
+	free(data);
+	patch_data_bytes -= length;
+}
+#endif
 
 static void patchpools_free_all(void * ignore)
 {
 	patch_free_all();
 	patchdep_free_all();
+#if PATCH_DATA_SLABS
+#define FREE_ALL_CLASS(size) patch_data##size##_free_all();
+	PATCH_DATA_CLASSES(FREE_ALL_CLASS)
+#undef FREE_ALL_CLASS
+#endif
+}
+
+/* give completely free slabs back, except for a few to absorb bursts */
+static void patchpools_reclaim(void)
+{
+	patch_reclaim(PATCH_SLAB_RESERVE);
+	patchdep_reclaim(PATCH_SLAB_RESERVE);
+#if PATCH_DATA_SLABS
+#define RECLAIM_CLASS(size) patch_data##size##_reclaim(PATCH_SLAB_RESERVE);
+	PATCH_DATA_CLASSES(RECLAIM_CLASS)
+#undef RECLAIM_CLASS
+#endif
+}
+
+void patch_get_stats(patch_stats_t * stats)
+{
+	stats->patches = patch_nlive;
+	stats->deps = patchdep_nlive;
+	stats->data_bytes = patch_data_bytes;
+	stats->slabs = patch_nslabs + patchdep_nslabs;
+#if PATCH_DATA_SLABS
+#define SLABS_CLASS(size) stats->slabs += patch_data##size##_nslabs;
+	PATCH_DATA_CLASSES(SLABS_CLASS)
+#undef SLABS_CLASS
+#endif
+	stats->bytes = stats->patches * sizeof(patch_t) + stats->deps * sizeof(patchdep_t) + stats->data_bytes;
 }
 
 
@@ -256,7 +362,10 @@ static void dump_counts(void)
 	{
 		while(jiffies - last_count_dump >= HZ)
 			last_count_dump += HZ;
+		patch_stats_t stats;
+		patch_get_stats(&stats);
 		printf("Bit: %4d, Byte: %4d, Empty: %4d\n", patch_counts[BIT], patch_counts[BYTE], patch_counts[EMPTY]);
+		printf("Patches: %u, Deps: %u, Data: %u, Slabs: %u, Bytes: %u\n", stats.patches, stats.deps, stats.data_bytes, stats.slabs, stats.bytes);
 	}
 }
 #endif
@@ -268,7 +377,7 @@ static __inline void patch_free_byte_data(patch_t *patch)
 	assert(patch->type == BYTE);
 	if(patch->length > PATCH_LOCALDATA && patch->byte.data)
 	{
-		free(patch->byte.data);
+		patch_data_free(patch->byte.data, patch->length);
 		account_update(&act_data, -patch->length);
 	}
 }
@@ -278,7 +387,11 @@ static patch_t * free_head = NULL;
 
 static void patch_free_push(patch_t * patch)
 {
-	assert(free_head != patch && !patch->free_prev);
+	assert(!(patch->flags & PATCH_FREELIST));
+	/* the free list links share space with the all_patches links */
+	assert(!patch->ddesc_pprev);
+	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FREE_PREV, patch, NULL);
+	patch->free_prev = NULL;
 	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FREE_NEXT, patch, free_head);
 	patch->free_next = free_head;
 	if(free_head)
@@ -288,11 +401,13 @@ static void patch_free_push(patch_t * patch)
 	}
 	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FREE_HEAD, patch);
 	free_head = patch;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FLAGS, patch, PATCH_FREELIST);
+	patch->flags |= PATCH_FREELIST;
 }
 
 static void patch_free_remove(patch_t * patch)
 {
-	assert(patch->free_prev || free_head == patch);
+	assert(patch->flags & PATCH_FREELIST);
 	if(patch->free_prev)
 	{
 		FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FREE_NEXT, patch->free_prev, patch->free_next);
@@ -312,16 +427,47 @@ static void patch_free_remove(patch_t * patch)
 	patch->free_prev = NULL;
 	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FREE_NEXT, patch, NULL);
 	patch->free_next = NULL;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_CLEAR_FLAGS, patch, PATCH_FREELIST);
+	patch->flags &= ~PATCH_FREELIST;
 }
 
+/* Return the overlap1[] bucket for c: the smallest one containing both
+ * its first and its last slice */
 static inline int patch_overlap_list(const patch_t *c)
 {
 	int sz = c->block->length >> OVERLAP1SHIFT;
+	int first, last;
 	if (c->length == 0)
 		return -1;
-	if ((c->offset ^ (c->offset + c->length - 1)) & ~(sz - 1))
-		return 0;
-	return c->offset / sz + 1;
+	first = NOVERLAP1 + c->offset / sz;
+	last = NOVERLAP1 + (c->offset + c->length - 1) / sz;
+	while (first != last) {
+		first >>= 1;
+		last >>= 1;
+	}
+	return first;
+}
+
+/* Return the set of non-empty overlap1[] buckets that may hold patches
+ * overlapping [offset, offset + length): at each level, the buckets
+ * between those holding the first and the last slice of the range */
+static inline uint64_t patch_overlap_buckets(const bdesc_t * block, uint32_t offset, uint32_t length)
+{
+	int sz = block->length >> OVERLAP1SHIFT;
+	uint32_t first = NOVERLAP1 + offset / sz;
+	uint32_t last = NOVERLAP1 + (offset + length - 1) / sz;
+	uint64_t buckets = 0;
+	for (; first; first >>= 1, last >>= 1)
+		buckets |= (2ULL << last) - (1ULL << first);
+	return buckets & block->overlap1_used;
+}
+
+/* remove and return the lowest bucket in *buckets */
+static inline int patch_overlap_next_bucket(uint64_t * buckets)
+{
+	int list = __builtin_ctzll(*buckets);
+	*buckets &= *buckets - 1;
+	return list;
 }
 
 static inline void patch_link_overlap(patch_t *patch)
@@ -335,13 +481,25 @@ static inline void patch_link_overlap(patch_t *patch)
 	*patch->overlap_pprev = patch;
 	if(patch->overlap_next)
 		patch->overlap_next->overlap_pprev = &patch->overlap_next;
+	patch->block->overlap1_used |= 1ULL << list;
 }
 
 static inline void patch_unlink_overlap(patch_t *patch)
 {
 	assert((!patch->overlap_pprev && !patch->overlap_next) || patch->block);
 	if(patch->overlap_pprev)
+	{
 		*patch->overlap_pprev = patch->overlap_next;
+		if(!patch->overlap_next)
+		{
+			/* the offset may have changed since linking, so find the
+			 * bucket from overlap_pprev in case it is now empty */
+			bdesc_t * block = patch->block;
+			uintptr_t list = ((uintptr_t) patch->overlap_pprev - (uintptr_t) block->overlap1) / sizeof(*block->overlap1);
+			if(list < 2 * NOVERLAP1 && !block->overlap1[list])
+				block->overlap1_used &= ~(1ULL << list);
+		}
+	}
 	if(patch->overlap_next)
 		patch->overlap_next->overlap_pprev = patch->overlap_pprev;
 	patch->overlap_next = NULL;
@@ -954,7 +1112,7 @@ int patch_add_depend_no_cycles(patch_t * after, patch_t * before)
 	before->afters_tail = &dep->after.next;
 	
 	/* virgin EMPTY patch getting its first before */
-	if(free_head == after || after->free_prev)
+	if(after->flags & PATCH_FREELIST)
 	{
 		assert(after->type == EMPTY);
 		assert(!(after->flags & PATCH_WRITTEN));
@@ -1105,24 +1263,15 @@ static int patch_overlap_multiattach(patch_t * patch, bdesc_t * block)
 		}
 	}
 
-	// get range of buckets touched by this patch
-	int list1 = patch_overlap_list(patch), list2;
-	assert(list1 >= 0);
-	if (list1 == 0) {
-		assert(patch->type == BYTE);
-		int sz = block->length >> OVERLAP1SHIFT;
-		list1 = patch->offset / sz + 1;
-		list2 = (patch->offset + patch->length - 1) / sz + 1;
-	} else
-		list2 = list1;
-
-	int r;
+	assert(patch_overlap_list(patch) >= 0);
+	uint64_t buckets = patch_overlap_buckets(block, patch->offset, patch->length);
 	patch_t * middle = NULL;
-	for (; list1 <= list2; list1++)
-		if ((r = _patch_overlap_multiattach_x(patch, &middle, &block->overlap1[list1])) < 0)
+	int r;
+	while (buckets)
+		if ((r = _patch_overlap_multiattach_x(patch, &middle, &block->overlap1[patch_overlap_next_bucket(&buckets)])) < 0)
 			return r;
 
-	return _patch_overlap_multiattach_x(patch, &middle, &block->overlap1[0]);
+	return 0;
 }
 
 
@@ -1156,14 +1305,9 @@ static patch_t *patch_find_overlaps(bdesc_t * block, uint32_t offset, uint32_t l
 		}
 	}
 
-	// get range of buckets touched by this patch
-	int sz = block->length >> OVERLAP1SHIFT;
-	int list1 = offset / sz + 1;
-	int list2 = (offset + length - 1) / sz + 1;
-
- buckets_again:
-	for (; list1 <= list2; list1++)
-		for (c = block->overlap1[list1]; c; c = c->overlap_next)
+	uint64_t buckets = patch_overlap_buckets(block, offset, length);
+	while (buckets)
+		for (c = block->overlap1[patch_overlap_next_bucket(&buckets)]; c; c = c->overlap_next)
 			if (!(c->offset >= offset + length
 			      || offset >= c->offset + c->length)) {
 				if (oprev && quick_depends_on(oprev, c))
@@ -1177,11 +1321,6 @@ static patch_t *patch_find_overlaps(bdesc_t * block, uint32_t offset, uint32_t l
 				opprev = &c->tmp_next;
 			}
 
-	if (list2) {
-		list1 = list2 = 0;
-		goto buckets_again;
-	}
-
 	*opprev = NULL;
 	return olist;
 }
@@ -1295,8 +1434,6 @@ int patch_create_empty_set(BD_t * owner, patch_t ** tail, patch_pass_set_t * bef
 	patch->afters_tail = &patch->afters;
 	patch->weak_refs = NULL;
 	memset(patch->nbefores, 0, sizeof(patch->nbefores));
-	patch->free_prev = NULL;
-	patch->free_next = NULL;
 	patch->ddesc_next = NULL;
 	patch->ddesc_pprev = NULL;
 	patch->ddesc_ready_next = NULL;
@@ -2111,7 +2248,7 @@ static int patch_create_byte_merge_overlap(patch_t ** tail, patch_t ** new, patc
 			merge_data = &overlap->byte.ldata[0];
 		else
 		{
-			if(!(merge_data = malloc(merge_length)))
+			if(!(merge_data = patch_data_alloc(merge_length)))
 			{
 				if((*new)->flags & PATCH_OVERLAP)
 					patch_unlink_overlap(overlap); /* XXX? */
@@ -2314,7 +2451,7 @@ static int patch_create_byte_merge_overlap2(patch_t ** tail, BD_t *owner, patch_
 			merge_data = &overlap->byte.ldata[0];
 		else
 		{
-			if(!(merge_data = malloc(merge_length)))
+			if(!(merge_data = patch_data_alloc(merge_length)))
 				return -ENOMEM;
 			account_update_realloc(&act_data, overlap->length, merge_length);
 		}
@@ -2431,8 +2568,6 @@ int patch_create_byte_basic(bdesc_t * block, BD_t * owner, uint16_t offset, uint
 	patch->afters_tail = &patch->afters;
 	patch->weak_refs = NULL;
 	memset(patch->nbefores, 0, sizeof(patch->nbefores));
-	patch->free_prev = NULL;
-	patch->free_next = NULL;
 	patch->ddesc_next = NULL;
 	patch->ddesc_pprev = NULL;
 	patch->ddesc_ready_next = NULL;
@@ -2520,7 +2655,7 @@ int patch_create_byte_basic(bdesc_t * block, BD_t * owner, uint16_t offset, uint
 			patch->byte.data = &patch->byte.ldata[0];
 		else
 		{
-			if(!(patch->byte.data = malloc(length)))
+			if(!(patch->byte.data = patch_data_alloc(length)))
 			{
 				patch_destroy(&patch);
 				return -ENOMEM;
@@ -2673,27 +2808,24 @@ static int patch_create_bit_merge_overlap(BD_t * owner, uint32_t xor, patch_t *
 		return 0;
 	
 	{
-		int list = 0;
+		uint64_t buckets = patch_overlap_buckets(overlap->block, overlap->offset, overlap->length);
 		patch_t *before;
 
-	    retry:
-		for (before = overlap->block->overlap1[list]; before; before = before->overlap_next) {
+		while (buckets)
+			for (before = overlap->block->overlap1[patch_overlap_next_bucket(&buckets)]; before; before = before->overlap_next) {
 #if PATCH_RB_NRB_READY
-			/* NOTE: this wouldn't need PATCH_RB_NRB_READY if an NRB
-			 * PATCH_OVERLAPed the underlying bits */
-			/* nrb is guaranteed to not depend on overlap */
-			if(before == WEAK(overlap->block->nrb))
-				continue;
+				/* NOTE: this wouldn't need PATCH_RB_NRB_READY if an NRB
+				 * PATCH_OVERLAPed the underlying bits */
+				/* nrb is guaranteed to not depend on overlap */
+				if(before == WEAK(overlap->block->nrb))
+					continue;
 #endif
-			if(before->flags & (PATCH_WRITTEN | PATCH_INFLIGHT))
-				continue;
-			if(patch_overlap_check(overlap, before))
-				/* uncommon. 'before' may need a rollback update. */
-				return 0;
-		}
-
-		if (list == 0 && (list = patch_overlap_list(overlap)))
-			goto retry;
+				if(before->flags & (PATCH_WRITTEN | PATCH_INFLIGHT))
+					continue;
+				if(patch_overlap_check(overlap, before))
+					/* uncommon. 'before' may need a rollback update. */
+					return 0;
+			}
 	}
 	
 	if(*head && overlap != *head)
@@ -2823,8 +2955,6 @@ int patch_create_bit(bdesc_t * block, BD_t * owner, uint16_t offset, uint32_t xo
 	patch->afters_tail = &patch->afters;
 	patch->weak_refs = NULL;
 	memset(patch->nbefores, 0, sizeof(patch->nbefores));
-	patch->free_prev = NULL;
-	patch->free_next = NULL;
 	patch->ddesc_next = NULL;
 	patch->ddesc_pprev = NULL;
 	patch->ddesc_ready_next = NULL;
@@ -3211,12 +3341,6 @@ int patch_satisfy(patch_t ** patch)
 			}
 		}
 		
-		/* make sure we're not already destroying this patch */
-		if(!((*patch)->flags & PATCH_FREEING))
-		{
-			assert(!(*patch)->free_prev && !(*patch)->free_next);
-			patch_free_push(*patch);
-		}
 	}
 	
 	patch_unlink_overlap(*patch);
@@ -3224,6 +3348,11 @@ int patch_satisfy(patch_t ** patch)
 	patch_unlink_ready_patches(*patch);
 	patch_unlink_all_patches(*patch);
 	
+	/* make sure we're not already destroying this patch; the free list
+	 * reuses the all_patches links, so this must follow the unlink */
+	if(((*patch)->flags & (PATCH_WRITTEN | PATCH_FREEING | PATCH_FREELIST)) == PATCH_WRITTEN)
+		patch_free_push(*patch);
+	
 	patch_weak_collect(*patch);
 	
 	if((*patch)->flags & PATCH_BIT_EMPTY)
@@ -3283,7 +3412,7 @@ void patch_destroy(patch_t ** patch)
 	if((*patch)->flags & PATCH_WRITTEN)
 	{
 		assert(!(*patch)->afters && !(*patch)->befores);
-		if(free_head == *patch || (*patch)->free_prev)
+		if((*patch)->flags & PATCH_FREELIST)
 			patch_free_remove(*patch);
 		account_npatches((*patch)->type, -1);
 	}
@@ -3297,7 +3426,7 @@ void patch_destroy(patch_t ** patch)
 				printf("%s(): (%s:%d): destroying completely overlapping unwritten patch: %p!\n", __FUNCTION__, __FILE__, __LINE__, *patch);
 			}
 		}
-		else if(free_head == *patch || (*patch)->free_prev)
+		else if((*patch)->flags & PATCH_FREELIST)
 		{
 			assert(!(*patch)->befores);
 			patch_free_remove(*patch);
@@ -3371,7 +3500,7 @@ void patch_claim_empty(patch_t * patch)
 {
 	assert(patch->type == EMPTY && !patch->befores);
 	assert(patch_before_level(patch) == BDLEVEL_NONE);
-	if(patch->free_prev || free_head == patch)
+	if(patch->flags & PATCH_FREELIST)
 		patch_free_remove(patch);
 }
 
@@ -3381,7 +3510,7 @@ void patch_autorelease_empty(patch_t * patch)
 	assert(patch_before_level(patch) == BDLEVEL_NONE);
 	while(patch->afters)
 		patch_dep_remove(patch->afters);
-	if(!patch->free_prev && free_head != patch)
+	if(!(patch->flags & PATCH_FREELIST))
 		patch_free_push(patch);
 }
 
@@ -3390,7 +3519,7 @@ void patch_set_empty_declare(patch_t * patch)
 	assert(patch->type == EMPTY && !patch->afters && !(patch->flags & PATCH_WRITTEN));
 	patch->flags |= PATCH_SET_EMPTY;
 	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FLAGS, patch, PATCH_SET_EMPTY);
-	if(!patch->free_prev && free_head != patch)
+	if(!(patch->flags & PATCH_FREELIST))
 		patch_free_push(patch);
 }
 
@@ -3409,10 +3538,18 @@ void patch_reclaim_written(void)
 		}
 		patch_destroy(&first);
 	}
+	patchpools_reclaim();
 }
 
+#if PATCH_SIZE_REPORT
+/* the "pointer from integer" warning includes the size in the type */
+static char (*patch_size_report)[sizeof(patch_t)] = 1;
+#endif
+
 int patch_init(void)
 {
+	static_assert(offsetof(patch_t, overlap_next) <= PATCH_HOT_BYTES);
+	static_assert(2 * NOVERLAP1 <= 8 * sizeof(((bdesc_t *) NULL)->overlap1_used));
 	int r = fstitchd_register_shutdown_module(patchpools_free_all, NULL, SHUTDOWN_POSTMODULES);
 	if (r < 0)
 		return r;
@@ -17,6 +17,8 @@
 #define PATCH_INFLIGHT        0x200 /* patch is being written to disk */
 #define PATCH_NO_PATCHGROUP   0x400 /* patch is exempt from patchgroup tops */
 #define PATCH_FULLOVERLAP     0x800 /* overlapped by current patch completely */
+#define PATCH_FREELIST        0x1000 /* patch is on the free list */
+#define PATCH_JOURNALED       0x2000 /* patch's block is copied into a journal transaction */
 
 #define PATCH_CYCLE_CHECK 0
 #define PATCH_BYTE_SUM 0
@@ -28,13 +30,16 @@
 
 #define PATCH_LOCALDATA 4
 
+enum {BIT, BYTE, EMPTY};
+
+/* Fields used when creating, merging, and rolling back patches come first so
+ * that they share a cache line; the rest are used less often. */
 struct patch {
 	BD_t * owner;
 	bdesc_t * block;
 	
-	enum {BIT, BYTE, EMPTY} type;
-	
-	uint32_t flags;
+	uint16_t flags;
+	uint8_t type; /* BIT, BYTE, or EMPTY */
 	
 	uint16_t offset;	/* measured in bytes */
 	uint16_t length;	/* 4 for bit patches, 0 for emptys */
@@ -61,44 +66,53 @@ struct patch {
 		} empty;
 	};
 	patchdep_t * befores;
-	patchdep_t ** befores_tail;
-
 	patchdep_t * afters;
-	patchdep_t ** afters_tail;
-
-	patchweakref_t * weak_refs;
 
 	/* nbefores[i] is the number of direct dependencies at level i */
 	uint32_t nbefores[NBDLEVEL];
 
-	/* entry in the free list */
-	/* TODO: can a patch be an entry in the free list and all_patches at
-	 * the same time? If not, we can unionize these. */
-	patch_t * free_prev;
-	patch_t * free_next;
-
-	/* entry in the datadesc_t.all_patches list */
-	/* TODO: change all_patches to be not_ready_patches so that a patch
-	 * is in only one of these lists; reduces these 4 fields to 2. */
-	patch_t * ddesc_next;
-	patch_t ** ddesc_pprev;
+	/* entry in the bdesc's overlap1 lists */
+	patch_t * overlap_next;
+	patch_t ** overlap_pprev;
 
-	/* entry in the datadesc_t.ready_patches list */
+	/* entry in the bdesc_t.ready_patches list */
 	patch_t * ddesc_ready_next;
 	patch_t ** ddesc_ready_pprev;
 
-	/* entry in the datadesc_t.index_patches list */
+	/* entry in the bdesc_t.index_patches list */
 	patch_t * ddesc_index_next;
 	patch_t ** ddesc_index_pprev;
 	
+	/* colder fields */
+	patchdep_t ** befores_tail;
+	patchdep_t ** afters_tail;
+
+	patchweakref_t * weak_refs;
+
+	/* Only EMPTYs (which have no block) and written patches (which have
+	 * been unlinked from their block) are on the free list, so the free
+	 * list and all_patches links can share space. PATCH_FREELIST tells
+	 * which one is in use. */
+	/* TODO: change all_patches to be not_ready_patches so that a patch
+	 * is in only one of these lists; reduces these 4 fields to 2. */
+	union {
+		/* entry in the bdesc_t.all_patches list */
+		struct {
+			patch_t * ddesc_next;
+			patch_t ** ddesc_pprev;
+		};
+		/* entry in the free list */
+		struct {
+			patch_t * free_prev;
+			patch_t * free_next;
+		};
+	};
+	
 	/* entry in a temporary list */
 	/* TODO: are these two and the ddesc_ready/free fields used concurrently ?
 	 *       or, is tmp_pprev needed? */
 	patch_t * tmp_next;
 	patch_t ** tmp_pprev;
-
-	patch_t * overlap_next;
-	patch_t ** overlap_pprev;
 };
 
 struct patchdep {
@@ -209,9 +223,21 @@ void patch_autorelease_empty(patch_t * patch);
 /* mark a EMPTY patch as a set EMPTY: would-be afters get its befores instead */
 void patch_set_empty_declare(patch_t * patch);
 
-/* reclaim written patches, by patch_destroy() on them */
+/* reclaim written patches, by patch_destroy() on them, and give
+ * completely free patch memory back to the system */
 void patch_reclaim_written(void);
 
+/* current patch memory usage */
+struct patch_stats {
+	uint32_t patches; /* live patch_ts */
+	uint32_t deps; /* live patchdep_ts */
+	uint32_t data_bytes; /* byte patch data not stored in the patch itself */
+	uint32_t slabs; /* pages held by the patch slab pools */
+	uint32_t bytes; /* total of the above, in bytes, excluding free slab space */
+};
+typedef struct patch_stats patch_stats_t;
+void patch_get_stats(patch_stats_t * stats);
+
 /* link patch into its ddesc's all_patches list */
 static inline void patch_link_all_patches(patch_t * patch);
 /* unlink patch from its ddesc's all_patches list */
@@ -324,6 +350,9 @@ static inline void patch_link_all_patches(patch_t * patch)
 
 static inline void patch_unlink_all_patches(patch_t * patch)
 {
+	/* the free list reuses the all_patches links */
+	if(patch->flags & PATCH_FREELIST)
+		return;
 	if(patch->ddesc_pprev)
 	{
 		bdesc_t * bdesc = patch->block;
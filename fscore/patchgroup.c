@@ -212,6 +212,11 @@ void patchgroup_scope_set_current(patchgroup_scope_t * scope)
 	current_scope = scope;
 }
 
+patchgroup_scope_t * patchgroup_scope_get_current(void)
+{
+	return current_scope;
+}
+
 patchgroup_t * patchgroup_create(int flags)
 {
 	patchgroup_t * op;
@@ -294,8 +299,20 @@ error_op:
 
 int patchgroup_sync(patchgroup_t * patchgroup)
 {
-	// TODO: sync just the needed patchgroups
-	return fstitch_sync();
+	int r;
+	if(!patchgroup)
+		return -EINVAL;
+	/* while engaged, new patches hang off the scope top rather than head */
+	if(patchgroup->engaged_count && current_scope && current_scope->top)
+	{
+		r = fstitch_sync_patch(current_scope->top);
+		if(r < 0)
+			return r;
+	}
+	/* no head means everything the patchgroup depends on is written */
+	if(!WEAK(patchgroup->head))
+		return 0;
+	return fstitch_sync_patch(WEAK(patchgroup->head));
 }
 
 int patchgroup_add_depend(patchgroup_t * after, patchgroup_t * before)
@@ -65,6 +65,7 @@ size_t patchgroup_scope_size(patchgroup_scope_t * scope);
 void patchgroup_scope_destroy(patchgroup_scope_t * scope);
 
 void patchgroup_scope_set_current(patchgroup_scope_t * scope);
+patchgroup_scope_t * patchgroup_scope_get_current(void);
 
 /* normal patchgroup operations are relative to the current scope */
 
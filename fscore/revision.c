@@ -133,18 +133,14 @@ static int _revision_tail_prepare(bdesc_t * block, uint8_t * buffer, enum decide
 	patch_t ** patches;
 	int i = 0, count = 0;
 	
-#if !REVISION_TAIL_INPLACE
-	memcpy(buffer, bdesc_data(block), block->length);
-#endif
-	
-	if(!block->all_patches)
-		return 0;
-	
 	/* find out how many patches are to be rolled back */
 	/* TODO: look into using ready_patches here? */
 	for(scan = block->all_patches; scan; scan = scan->ddesc_next)
 		if(!decide(decider, scan, data))
 			count++;
+#if !REVISION_TAIL_INPLACE
+	memcpy(buffer, bdesc_data(block), block->length);
+#endif
 	if(!count)
 		return 0;
 	
@@ -217,8 +213,87 @@ int revision_tail_prepare(bdesc_t * block, BD_t * bd, uint8_t * buffer)
 	assert(!block->in_flight);
 	return _revision_tail_prepare(block, buffer, OWNER, bd);
 }
+
+int revision_tail_prepare_direct(bdesc_t * block, BD_t * bd, uint8_t ** data)
+{
+	patch_t * scan;
+	int r;
+	assert(!block->in_flight);
+	
+	/* the common case: everything on the block can go to disk as is */
+	for(scan = block->all_patches; scan; scan = scan->ddesc_next)
+		if(!decide(OWNER, scan, bd))
+			break;
+	if(!scan)
+	{
+		*data = bdesc_data(block);
+		return 0;
+	}
+	
+	*data = revision_buffer_get(block->length);
+	if(!*data)
+		return -ENOMEM;
+	r = _revision_tail_prepare(block, *data, OWNER, bd);
+	if(r < 0)
+	{
+		revision_buffer_put(*data, block->length);
+		*data = NULL;
+	}
+	return r;
+}
+
+void revision_tail_release_direct(bdesc_t * block, uint8_t * data)
+{
+	if(data && data != bdesc_data(block))
+		revision_buffer_put(data, block->length);
+}
 #endif
 
+/* Rolled back copies of blocks are built in page aligned buffers kept on a
+ * free list, so each write in progress (or in flight) can have its own. */
+#define REVISION_BUFFER_SIZE 4096
+#define REVISION_BUFFER_POOL 64
+
+static uint8_t * revision_buffer_pool[REVISION_BUFFER_POOL];
+static int revision_buffer_pool_count = 0;
+
+#ifdef __KERNEL__
+#define revision_buffer_alloc(length) ((uint8_t *) kmalloc(length, GFP_KERNEL))
+#define revision_buffer_free(buffer) kfree(buffer)
+#else
+static uint8_t * revision_buffer_alloc(uint16_t length)
+{
+	void * buffer;
+	if(posix_memalign(&buffer, REVISION_BUFFER_SIZE, length))
+		return NULL;
+	return buffer;
+}
+#define revision_buffer_free(buffer) free(buffer)
+#endif
+
+static void revision_buffer_pool_free(void * ignore)
+{
+	while(revision_buffer_pool_count)
+		revision_buffer_free(revision_buffer_pool[--revision_buffer_pool_count]);
+}
+
+uint8_t * revision_buffer_get(uint16_t length)
+{
+	if(length > REVISION_BUFFER_SIZE)
+		return revision_buffer_alloc(length);
+	if(revision_buffer_pool_count)
+		return revision_buffer_pool[--revision_buffer_pool_count];
+	return revision_buffer_alloc(REVISION_BUFFER_SIZE);
+}
+
+void revision_buffer_put(uint8_t * buffer, uint16_t length)
+{
+	if(length > REVISION_BUFFER_SIZE || revision_buffer_pool_count == REVISION_BUFFER_POOL)
+		revision_buffer_free(buffer);
+	else
+		revision_buffer_pool[revision_buffer_pool_count++] = buffer;
+}
+
 static int _revision_tail_revert(bdesc_t * block, enum decider decider, void * data)
 {
 	patch_t * scan;
@@ -368,18 +443,35 @@ int revision_tail_acknowledge(bdesc_t * block, BD_t * bd)
 	return revision_tail_revert(block, bd);
 }
 
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 #include <lib/pool.h>
+#ifdef __KERNEL__
 #include <linux/sched.h>
+#endif
 
 struct flight {
 	bdesc_t * block;
 	struct flight * next;
 };
-static spinlock_t flight_plan = SPIN_LOCK_UNLOCKED;
 static struct flight * scheduled_flights = NULL;
 static struct flight * holding_pattern = NULL;
+#ifdef __KERNEL__
+static spinlock_t flight_plan = SPIN_LOCK_UNLOCKED;
 static DECLARE_WAIT_QUEUE_HEAD(control_tower);
+#define flight_plan_lock(flags) spin_lock_irqsave(&flight_plan, flags)
+#define flight_plan_unlock(flags) spin_unlock_irqrestore(&flight_plan, flags)
+#else
+/* in userspace, landings are only requested by the landing sources below,
+ * which are polled from the main thread, so no locking is needed */
+#define flight_plan_lock(flags) ((void) (flags))
+#define flight_plan_unlock(flags) ((void) (flags))
+
+#define NLANDING_SOURCES 4
+static struct landing_source {
+	landing_reap_t reap;
+	void * arg;
+} landing_sources[NLANDING_SOURCES];
+#endif
 
 DECLARE_POOL(flight, struct flight);
 
@@ -390,35 +482,35 @@ void flight_pool_free_all(void * ignore)
 
 int revision_tail_schedule_flight(void)
 {
-	unsigned long flags;
+	unsigned long flags = 0;
 	struct flight * slot = flight_alloc();
 	if(!slot)
 		return -ENOMEM;
-	spin_lock_irqsave(&flight_plan, flags);
+	flight_plan_lock(flags);
 	slot->next = scheduled_flights;
 	scheduled_flights = slot;
-	spin_unlock_irqrestore(&flight_plan, flags);
+	flight_plan_unlock(flags);
 	return 0;
 }
 
 void revision_tail_cancel_flight(void)
 {
-	unsigned long flags;
+	unsigned long flags = 0;
 	struct flight * slot;
-	spin_lock_irqsave(&flight_plan, flags);
+	flight_plan_lock(flags);
 	slot = scheduled_flights;
 	scheduled_flights = slot->next;
-	spin_unlock_irqrestore(&flight_plan, flags);
+	flight_plan_unlock(flags);
 	flight_free(slot);
 }
 
 int revision_tail_flights_exist(void)
 {
-	unsigned long flags;
+	unsigned long flags = 0;
 	int exist;
-	spin_lock_irqsave(&flight_plan, flags);
+	flight_plan_lock(flags);
 	exist = scheduled_flights || holding_pattern;
-	spin_unlock_irqrestore(&flight_plan, flags);
+	flight_plan_unlock(flags);
 	return exist;
 }
 
@@ -456,36 +548,81 @@ static int revision_tail_ack_landed(bdesc_t * block)
 
 void revision_tail_request_landing(bdesc_t * block)
 {
-	unsigned long flags;
+	unsigned long flags = 0;
 	struct flight * slot;
-	spin_lock_irqsave(&flight_plan, flags);
+	flight_plan_lock(flags);
 	slot = scheduled_flights;
 	scheduled_flights = slot->next;
 	slot->block = block;
 	slot->next = holding_pattern;
 	holding_pattern = slot;
+#ifdef __KERNEL__
 	wake_up_all(&control_tower);
-	spin_unlock_irqrestore(&flight_plan, flags);
+#endif
+	flight_plan_unlock(flags);
 }
 
+#ifndef __KERNEL__
+int revision_tail_add_landing_source(landing_reap_t reap, void * arg)
+{
+	int i;
+	for(i = 0; i < NLANDING_SOURCES; i++)
+		if(!landing_sources[i].reap)
+		{
+			landing_sources[i].reap = reap;
+			landing_sources[i].arg = arg;
+			return 0;
+		}
+	return -ENOSPC;
+}
+
+void revision_tail_remove_landing_source(landing_reap_t reap, void * arg)
+{
+	int i;
+	for(i = 0; i < NLANDING_SOURCES; i++)
+		if(landing_sources[i].reap == reap && landing_sources[i].arg == arg)
+		{
+			landing_sources[i].reap = NULL;
+			landing_sources[i].arg = NULL;
+		}
+}
+
+/* poll every landing source without blocking, and return
+ * the first one that still has writes outstanding (if any) */
+static struct landing_source * revision_tail_poll_landing_sources(void)
+{
+	struct landing_source * busy = NULL;
+	int i;
+	for(i = 0; i < NLANDING_SOURCES; i++)
+		if(landing_sources[i].reap)
+			if(landing_sources[i].reap(landing_sources[i].arg, 0) > 0 && !busy)
+				busy = &landing_sources[i];
+	return busy;
+}
+#endif
+
 void revision_tail_process_landing_requests(void)
 {
-	unsigned long flags;
-	spin_lock_irqsave(&flight_plan, flags);
+	unsigned long flags = 0;
+#ifndef __KERNEL__
+	revision_tail_poll_landing_sources();
+#endif
+	flight_plan_lock(flags);
 	while(holding_pattern)
 	{
 		struct flight * slot = holding_pattern;
 		holding_pattern = slot->next;
-		spin_unlock_irqrestore(&flight_plan, flags);
+		flight_plan_unlock(flags);
 		revision_tail_ack_landed(slot->block);
 		flight_free(slot);
-		spin_lock_irqsave(&flight_plan, flags);
+		flight_plan_lock(flags);
 	}
-	spin_unlock_irqrestore(&flight_plan, flags);
+	flight_plan_unlock(flags);
 }
 
 void revision_tail_wait_for_landing_requests(void)
 {
+#ifdef __KERNEL__
 	unsigned long flags;
 	DEFINE_WAIT(wait);
 	spin_lock_irqsave(&flight_plan, flags);
@@ -498,8 +635,20 @@ void revision_tail_wait_for_landing_requests(void)
 	}
 	finish_wait(&control_tower, &wait);
 	spin_unlock_irqrestore(&flight_plan, flags);
+#else
+	while(!holding_pattern)
+	{
+		struct landing_source * busy = revision_tail_poll_landing_sources();
+		if(holding_pattern)
+			break;
+		/* nothing is outstanding, so nothing will ever land */
+		if(!busy)
+			break;
+		busy->reap(busy->arg, 1);
+	}
+#endif
 }
-#endif /* __KERNEL__ */
+#endif /* REVISION_TAIL_FLIGHTS */
 
 
 /* ---- Revision slices ---- */
@@ -708,10 +857,14 @@ void revision_slice_destroy(revision_slice_t * slice)
 
 int revision_init(void)
 {
-#ifdef __KERNEL__
-	int r = fstitchd_register_shutdown_module(flight_pool_free_all, NULL, SHUTDOWN_POSTMODULES);
+	int r;
+#if REVISION_TAIL_FLIGHTS
+	r = fstitchd_register_shutdown_module(flight_pool_free_all, NULL, SHUTDOWN_POSTMODULES);
 	if(r < 0)
 		return r;
 #endif
+	r = fstitchd_register_shutdown_module(revision_buffer_pool_free, NULL, SHUTDOWN_POSTMODULES);
+	if(r < 0)
+		return r;
 	return 0;
 }
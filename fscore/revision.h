@@ -12,6 +12,18 @@
  * be more efficient when there are many rollbacks. */
 #define REVISION_TAIL_INPLACE 0
 
+/* In-flight blocks let terminal BDs acknowledge writes asynchronously: the
+ * patches on a written block are marked in flight, and are satisfied once a
+ * landing is requested for the block. The kernel always supports them. In
+ * userspace, BDs that write asynchronously register a landing source that
+ * is polled for completions from the main loop. */
+#define REVISION_TAIL_USER_FLIGHTS 1
+#if defined(__KERNEL__) || REVISION_TAIL_USER_FLIGHTS
+#define REVISION_TAIL_FLIGHTS 1
+#else
+#define REVISION_TAIL_FLIGHTS 0
+#endif
+
 #include <fscore/bdesc.h>
 #include <fscore/bd.h>
 
@@ -25,8 +37,18 @@ int revision_tail_prepare(bdesc_t * block, BD_t * bd);
 /* roll back patches on the passed block which are not yet ready to
  * go to disk, constructing the previous version of the block in the buffer */
 int revision_tail_prepare(bdesc_t * block, BD_t * bd, uint8_t * buffer);
+
+/* like revision_tail_prepare(), but sets '*data' to the block's own data when
+ * nothing needs to be rolled back, and to a buffer from the pool below
+ * otherwise; hand '*data' to revision_tail_release_direct() when done */
+int revision_tail_prepare_direct(bdesc_t * block, BD_t * bd, uint8_t ** data);
+void revision_tail_release_direct(bdesc_t * block, uint8_t * data);
 #endif
 
+/* page aligned buffers for copies of blocks being written */
+uint8_t * revision_buffer_get(uint16_t length);
+void revision_buffer_put(uint8_t * buffer, uint16_t length);
+
 /* undo everything done by revision_tail_prepare() above */
 int revision_tail_revert(bdesc_t * block, BD_t * bd);
 
@@ -34,7 +56,7 @@ int revision_tail_revert(bdesc_t * block, BD_t * bd);
  * descriptors on the block, and rolls the others forward again */
 int revision_tail_acknowledge(bdesc_t * block, BD_t * bd);
 
-#if __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 /* this function marks the non-rolled back patches as "in flight" and
  * rolls the others forward again */
 int revision_tail_inflight_ack(bdesc_t * block, BD_t * bd);
@@ -50,15 +72,25 @@ void revision_tail_cancel_flight(void);
 /* this function returns true iff there are any scheduled or holding flights */
 int revision_tail_flights_exist(void);
 
-/* this function should be called at interrupt time to notify the system that a
- * block has been written to the controller or (with NCQ) to the disk */
+/* this function should be called at interrupt time (or by a landing source)
+ * to notify the system that a block has been written to the controller or
+ * (with NCQ) to the disk */
 void revision_tail_request_landing(bdesc_t * block);
 
 /* this function processes pending landing requests */
 void revision_tail_process_landing_requests(void);
 /* this function waits for landing requests to be set up */
 void revision_tail_wait_for_landing_requests(void);
-#endif /* __KERNEL__ */
+
+#ifndef __KERNEL__
+/* A landing source reaps completed writes, calling revision_tail_request_landing()
+ * for each written block. It blocks for at least one completion if 'wait' is set
+ * and returns the number of writes still outstanding. */
+typedef int (*landing_reap_t)(void * arg, bool wait);
+int revision_tail_add_landing_source(landing_reap_t reap, void * arg);
+void revision_tail_remove_landing_source(landing_reap_t reap, void * arg);
+#endif
+#endif /* REVISION_TAIL_FLIGHTS */
 
 /* ---- Revision slices ---- */
 
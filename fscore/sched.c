@@ -141,8 +141,8 @@ void sched_run_cleanup(void)
 {
 	int r;
 
-#ifdef __KERNEL__
-	// In-flight blocks are only supported in the kernel
+#if REVISION_TAIL_FLIGHTS
+	// Satisfy the patches on blocks whose writes have completed
 	revision_tail_process_landing_requests();
 #endif
 
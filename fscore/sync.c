@@ -3,14 +3,59 @@
  * version 2 of the GNU GPL. See the file LICENSE for details. */
 
 #include <lib/platform.h>
+#include <lib/vector.h>
+#include <lib/hash_set.h>
 
 #include <fscore/bd.h>
+#include <fscore/patch.h>
+#include <fscore/debug.h>
 #include <fscore/modman.h>
 #include <fscore/sync.h>
+#include <fscore/revision.h>
 #include <fscore/modman.h>
 
+struct sync_entry {
+	sync_callback_t callback;
+	void * arg;
+};
+
+#define MAX_NR_SYNC_CALLBACKS 16
+static struct sync_entry sync_callbacks[MAX_NR_SYNC_CALLBACKS];
+
+int fstitch_sync_register(sync_callback_t callback, void * arg)
+{
+	int i;
+	for(i = 0; i < MAX_NR_SYNC_CALLBACKS; i++)
+		if(!sync_callbacks[i].callback)
+		{
+			sync_callbacks[i].callback = callback;
+			sync_callbacks[i].arg = arg;
+			return 0;
+		}
+	return -ENOMEM;
+}
+
+int fstitch_sync_unregister(sync_callback_t callback, void * arg)
+{
+	int i;
+	for(i = 0; i < MAX_NR_SYNC_CALLBACKS; i++)
+		if(sync_callbacks[i].callback == callback && sync_callbacks[i].arg == arg)
+		{
+			sync_callbacks[i].callback = NULL;
+			sync_callbacks[i].arg = NULL;
+			return 0;
+		}
+	return -ENOENT;
+}
+
 int fstitch_sync(void)
 {
+	int i;
+	
+	for(i = 0; i < MAX_NR_SYNC_CALLBACKS; i++)
+		if(sync_callbacks[i].callback)
+			sync_callbacks[i].callback(sync_callbacks[i].arg);
+	
 	for(;;)
 	{
 		BD_t * bd;
@@ -27,3 +72,225 @@ int fstitch_sync(void)
 			return -EBUSY;
 	}
 }
+
+/* the befores of 'patch' to sync, or NULL for a journaled patch that has only
+ * journaled befores: such a patch is durable once its transaction commits,
+ * when the journal drops its dependency on the transaction's hold */
+static patchdep_t * sync_befores(patch_t * patch)
+{
+	patchdep_t * dep;
+	if(!(patch->flags & PATCH_JOURNALED))
+		return patch->befores;
+	for(dep = patch->befores; dep; dep = dep->before.next)
+		if(!(dep->before.patch->flags & PATCH_JOURNALED))
+			return patch->befores;
+	return NULL;
+}
+
+/* mark 'patch' and push it and its befores on the walk's stack */
+static int sync_visit(patch_t * patch, vector_t * marked, vector_t * stack)
+{
+	int r = vector_push_back(marked, patch);
+	if(r < 0)
+		return r;
+	patch->flags |= PATCH_MARKED;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FLAGS, patch, PATCH_MARKED);
+	r = vector_push_back(stack, patch);
+	if(r < 0)
+		return r;
+	return vector_push_back(stack, sync_befores(patch));
+}
+
+/* Collect the owned patches in the before closure of 'root' that are not
+ * marked yet into 'patches', befores first, and add the patches it marks to
+ * 'marked'. Before chains can be long, so this walks with 'stack' (pairs of
+ * a patch and its next before to visit) instead of recursing. */
+static int sync_collect_befores(patch_t * root, vector_t * patches, vector_t * marked, vector_t * stack)
+{
+	int r;
+	
+	if(root->flags & PATCH_MARKED)
+		return 0;
+	vector_clear(stack);
+	r = sync_visit(root, marked, stack);
+	while(r >= 0 && !vector_empty(stack))
+	{
+		const size_t top = vector_size(stack) - 1;
+		patchdep_t * dep = (patchdep_t *) vector_elt(stack, top);
+		patch_t * patch;
+		
+		while(dep && (dep->before.patch->flags & PATCH_MARKED))
+			dep = dep->before.next;
+		if(dep)
+		{
+			vector_elt_set(stack, top, dep->before.next);
+			r = sync_visit(dep->before.patch, marked, stack);
+			continue;
+		}
+		
+		patch = (patch_t *) vector_elt(stack, top - 1);
+		vector_pop_back(stack);
+		vector_pop_back(stack);
+		/* in-flight patches will land on their own, and journaled patches
+		 * need only their transaction to commit, not to be written in place */
+		if(patch->owner && !(patch->flags & (PATCH_INFLIGHT | PATCH_JOURNALED)))
+			r = vector_push_back(patches, patch);
+	}
+	return r;
+}
+
+static void sync_unmark(vector_t * marked)
+{
+	size_t i;
+	for(i = 0; i < vector_size(marked); i++)
+	{
+		patch_t * patch = (patch_t *) vector_elt(marked, i);
+		patch->flags &= ~PATCH_MARKED;
+		FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_CLEAR_FLAGS, patch, PATCH_MARKED);
+	}
+	vector_clear(marked);
+}
+
+static int sync_patch(patch_t * patch, bool wait)
+{
+	patchweakref_t weak;
+	vector_t * patches;
+	vector_t * roots;
+	vector_t * marked;
+	vector_t * stack;
+	hash_set_t * flushed;
+	BD_t * bd;
+	modman_it_t it;
+	bool full = 1;
+	int r = -ENOMEM;
+	
+	patches = vector_create();
+	roots = vector_create();
+	marked = vector_create();
+	stack = vector_create();
+	flushed = hash_set_create();
+	if(!patches || !roots || !marked || !stack || !flushed)
+		goto out_vectors;
+	
+	WEAK_INIT(weak);
+	if(patch)
+		patch_weak_retain(patch, &weak, NULL, NULL);
+	for(;;)
+	{
+		vector_t * last = patches;
+		bool progress = 0;
+		size_t i;
+		
+		/* the patch itself may get written along the way */
+		if(!WEAK(weak))
+			break;
+		/* After a pass, walk only from the patches it left unwritten.
+		 * Written patches are not freed until sched cleanup, which does
+		 * not run during a sync, so the last pass's patches stay valid.
+		 * Before finishing, or giving up, confirm with a full walk. */
+		patches = roots;
+		roots = last;
+		vector_clear(patches);
+		hash_set_clear(flushed);
+		r = 0;
+		if(full)
+			r = sync_collect_befores(patch, patches, marked, stack);
+		else
+			for(i = 0; r >= 0 && i < vector_size(roots); i++)
+			{
+				patch_t * root = (patch_t *) vector_elt(roots, i);
+				if(!(root->flags & PATCH_WRITTEN))
+					r = sync_collect_befores(root, patches, marked, stack);
+			}
+		sync_unmark(marked);
+		if(r < 0)
+			goto out_weak;
+		if(vector_empty(patches))
+		{
+			if(full)
+				break;
+			full = 1;
+			continue;
+		}
+		
+		for(i = 0; i < vector_size(patches); i++)
+		{
+			patch_t * before = (patch_t *) vector_elt(patches, i);
+			/* flush each block (or blockless owner, like a journal
+			 * transaction's hold) at most once per pass */
+			void * key = before->block ? (void *) before->block : (void *) before->owner;
+			if(before->flags & PATCH_WRITTEN)
+				continue;
+			if(hash_set_exists(flushed, key))
+				continue;
+			r = hash_set_insert(flushed, key);
+			if(r < 0)
+				goto out_weak;
+			if(before->block)
+				r = CALL(before->owner, flush, before->block->cache_number, before);
+			else
+				r = CALL(before->owner, flush, FLUSH_DEVICE, before);
+			if(r == FLUSH_DONE || r == FLUSH_SOME)
+				progress = 1;
+		}
+		
+		if(!progress)
+		{
+			if(!full)
+			{
+				full = 1;
+				continue;
+			}
+#if REVISION_TAIL_FLIGHTS
+			/* blocks still in flight hold up the rest: let them land */
+			if(revision_tail_flights_exist())
+			{
+				r = 0;
+				if(!wait)
+					goto out_weak;
+				revision_tail_wait_for_landing_requests();
+				revision_tail_process_landing_requests();
+				full = 0;
+				continue;
+			}
+#endif
+			r = -EBUSY;
+			goto out_weak;
+		}
+		full = 0;
+	}
+	
+	/* make it durable: terminal BDs may still be caching the writes */
+	r = 0;
+	if(!wait)
+		goto out_weak;
+	modman_it_init_bd(&it);
+	while((bd = modman_it_next_bd(&it)))
+		if(!bd->graph_index)
+			CALL(bd, flush, FLUSH_DEVICE, NULL);
+	
+out_weak:
+	patch_weak_release(&weak, 0);
+out_vectors:
+	if(flushed)
+		hash_set_destroy(flushed);
+	if(stack)
+		vector_destroy(stack);
+	if(marked)
+		vector_destroy(marked);
+	if(roots)
+		vector_destroy(roots);
+	if(patches)
+		vector_destroy(patches);
+	return r;
+}
+
+int fstitch_sync_patch(patch_t * patch)
+{
+	return sync_patch(patch, 1);
+}
+
+int fstitch_push_patch(patch_t * patch)
+{
+	return sync_patch(patch, 0);
+}
@@ -5,8 +5,24 @@
 #ifndef __FSTITCH_FSCORE_SYNC_H
 #define __FSTITCH_FSCORE_SYNC_H
 
+#include <fscore/types.h>
 #include <fscore/inode.h>
 
 int fstitch_sync(void);
 
+/* Flush only what 'patch' depends on: the blocks holding the patches in its
+ * before closure, befores first. Patches in a journal transaction count as
+ * durable once it commits. Returns -EBUSY if no progress can be made.
+ * With a NULL patch, just make what has already been written durable. */
+int fstitch_sync_patch(patch_t * patch);
+/* Like fstitch_sync_patch(), but only start the writes: do not wait for
+ * blocks in flight to land, and do not flush the terminal BDs. */
+int fstitch_push_patch(patch_t * patch);
+
+/* Modules that hold back changes from the patch layer (like write-behind
+ * buffers) register a callback that fstitch_sync() calls before flushing. */
+typedef void (*sync_callback_t)(void * arg);
+int fstitch_sync_register(sync_callback_t callback, void * arg);
+int fstitch_sync_unregister(sync_callback_t callback, void * arg);
+
 #endif /* __FSTITCH_FSCORE_SYNC_H */
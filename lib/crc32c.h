@@ -0,0 +1,16 @@
+/* This file is part of Featherstitch. Featherstitch is copyright 2005-2007 The
+ * Regents of the University of California. It is distributed under the terms of
+ * version 2 of the GNU GPL. See the file LICENSE for details. */
+
+#ifndef FSTITCH_INC_CRC32C_H
+#define FSTITCH_INC_CRC32C_H
+
+#ifdef __KERNEL__
+#include <linux/crc32c.h>
+#else
+// Update a CRC32C (Castagnoli) checksum with 'length' bytes of 'data'. Like
+// the kernel's crc32c(), it does no pre- or post-inversion of 'crc'.
+uint32_t crc32c(uint32_t crc, const void * data, size_t length);
+#endif
+
+#endif /* FSTITCH_INC_CRC32C_H */
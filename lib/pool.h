@@ -65,6 +65,152 @@
 		} \
 	}
 
+// Slab pools are like pools, but each pool page is a page-aligned slab with
+// its own free list, so that pages whose elements are all free can be given
+// back. Slabs with some elements in use are allocated from first.
+// API: as DECLARE_POOL, plus name_reclaim(keep), which frees all but 'keep'
+// of the completely free slabs, and the name_nlive and name_nslabs counters.
+
+struct pool_slab {
+	struct pool_slab * next;
+	struct pool_slab ** pprev;
+	void * free_list;
+	uint32_t nused;
+};
+
+#define SLABSIZE(type) ((int) ((PAGE_SIZE - sizeof(struct pool_slab)) / sizeof(type)))
+
+#ifdef __KERNEL__
+#define pool_slab_page_alloc() ((void *) __get_free_page((in_atomic() || irqs_disabled()) ? GFP_ATOMIC : GFP_KERNEL))
+#define pool_slab_page_free(p) free_page((unsigned long) (p))
+#else
+#include <sys/mman.h>
+/* map slabs directly: free() keeps pages inside the heap, so they would not
+ * go back to the system */
+static __inline void * pool_slab_page_alloc(void)
+{
+	void * p = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (p == MAP_FAILED) ? NULL : p;
+}
+#define pool_slab_page_free(p) munmap(p, PAGE_SIZE)
+#endif
+
+static __inline void pool_slab_unlink(struct pool_slab * slab)
+{
+	*slab->pprev = slab->next;
+	if(slab->next)
+		slab->next->pprev = slab->pprev;
+}
+
+static __inline void pool_slab_link(struct pool_slab ** list, struct pool_slab * slab)
+{
+	slab->pprev = list;
+	slab->next = *list;
+	if(*list)
+		(*list)->pprev = &slab->next;
+	*list = slab;
+}
+
+static __inline void pool_slab_free_list(struct pool_slab ** list)
+{
+	struct pool_slab * slab;
+	while((slab = *list))
+	{
+		pool_slab_unlink(slab);
+		pool_slab_page_free(slab);
+	}
+}
+
+#define DECLARE_SLAB_POOL(name, type) \
+	struct name##_slab { \
+		struct pool_slab header; \
+		type elts[SLABSIZE(type)]; \
+	}; \
+	/* slabs with some, none, and all of their elements in use */ \
+	static struct pool_slab * name##_partial_slabs; \
+	static struct pool_slab * name##_empty_slabs; \
+	static struct pool_slab * name##_full_slabs; \
+	static uint32_t name##_nlive, name##_nslabs; \
+	\
+	static struct pool_slab * alloc_##name##_slab(void) \
+	{ \
+		struct name##_slab * slab; \
+		int i; \
+		static_assert(sizeof(*slab) <= PAGE_SIZE); \
+		if(!(slab = pool_slab_page_alloc())) \
+			return NULL; \
+		for(i = 1; i < SLABSIZE(type); i++) \
+			* ((type **) &slab->elts[i]) = &slab->elts[i-1]; \
+		* ((type **) &slab->elts[0]) = NULL; \
+		slab->header.free_list = &slab->elts[SLABSIZE(type) - 1]; \
+		slab->header.nused = 0; \
+		pool_slab_link(&name##_empty_slabs, &slab->header); \
+		name##_nslabs++; \
+		return &slab->header; \
+	} \
+	static __inline type * name##_alloc(void) __attribute__((always_inline)); \
+	static __inline type * name##_alloc(void) \
+	{ \
+		struct pool_slab * slab = name##_partial_slabs; \
+		type * p; \
+		if(unlikely(!slab)) \
+		{ \
+			if(!(slab = name##_empty_slabs)) \
+				if(unlikely(!(slab = alloc_##name##_slab()))) \
+					return NULL; \
+			pool_slab_unlink(slab); \
+			pool_slab_link(&name##_partial_slabs, slab); \
+		} \
+		p = slab->free_list; \
+		slab->free_list = * ((type **) p); \
+		if(++slab->nused == SLABSIZE(type)) \
+		{ \
+			pool_slab_unlink(slab); \
+			pool_slab_link(&name##_full_slabs, slab); \
+		} \
+		name##_nlive++; \
+		return p; \
+	} \
+	static __inline void name##_free(type * p) __attribute__((always_inline)); \
+	static __inline void name##_free(type * p) \
+	{ \
+		struct pool_slab * slab = (struct pool_slab *) ((unsigned long) p & ~(unsigned long) (PAGE_SIZE - 1)); \
+		* ((type **) p) = slab->free_list; \
+		slab->free_list = p; \
+		if(slab->nused-- == SLABSIZE(type)) \
+		{ \
+			pool_slab_unlink(slab); \
+			pool_slab_link(&name##_partial_slabs, slab); \
+		} \
+		if(!slab->nused) \
+		{ \
+			pool_slab_unlink(slab); \
+			pool_slab_link(&name##_empty_slabs, slab); \
+		} \
+		name##_nlive--; \
+	} \
+	static void name##_reclaim(unsigned int keep) \
+	{ \
+		struct pool_slab ** list = &name##_empty_slabs; \
+		while(*list && keep--) \
+			list = &(*list)->next; \
+		while(*list) \
+		{ \
+			struct pool_slab * slab = *list; \
+			pool_slab_unlink(slab); \
+			pool_slab_page_free(slab); \
+			name##_nslabs--; \
+		} \
+	} \
+	static void name##_free_all(void) \
+	{ \
+		pool_slab_free_list(&name##_partial_slabs); \
+		pool_slab_free_list(&name##_empty_slabs); \
+		pool_slab_free_list(&name##_full_slabs); \
+		name##_nlive = 0; \
+		name##_nslabs = 0; \
+	}
+
 #else
 
 # define DECLARE_POOL(name, type) \
@@ -72,6 +218,13 @@
 	static void name##_free(type * p) { free(p); } \
 	static void name##_free_all(void) { }
 
+# define DECLARE_SLAB_POOL(name, type) \
+	static uint32_t name##_nlive, name##_nslabs; \
+	static type * name##_alloc(void) { type * p = malloc(sizeof(type)); if(p) name##_nlive++; return p; } \
+	static void name##_free(type * p) { free(p); name##_nlive--; } \
+	static void name##_reclaim(unsigned int keep) { } \
+	static void name##_free_all(void) { }
+
 #endif
 
 #endif
@@ -5,6 +5,10 @@
 #include <lib/platform.h>
 #include <lib/vector.h>
 
+#ifdef __KERNEL__
+#include <linux/sort.h>
+#endif
+
 
 static void ** vector_create_elts(size_t n);
 static void    vector_destroy_elts(vector_t * v);
@@ -121,13 +125,15 @@ void vector_clear(vector_t * v)
 	v->size = 0;
 }
 
-#ifndef __KERNEL__
 void vector_sort(vector_t *v, int (*compar)(const void *a, const void *b))
 {
 	if (v->size < 2) return;
+#ifdef __KERNEL__
+	sort(v->elts, v->size, sizeof(void*), compar, NULL);
+#else
 	qsort(v->elts, v->size, sizeof(void*), compar);
-}
 #endif
+}
 
 
 //
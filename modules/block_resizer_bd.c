@@ -42,6 +42,12 @@ static bdesc_t * block_resizer_bd_synthetic_read_block(BD_t * object, uint32_t n
 	return CALL(info->bd, synthetic_read_block, number * info->merge_count, count * info->merge_count, page);
 }
 
+static int block_resizer_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct resize_info * info = (struct resize_info *) object;
+	return CALL(info->bd, read_ahead, number * info->merge_count, count * info->merge_count, nbdescs);
+}
+
 static int block_resizer_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct resize_info * info = (struct resize_info *) object;
@@ -59,6 +65,11 @@ static int block_resizer_bd_write_block(BD_t * object, bdesc_t * block, uint32_t
 	return CALL(info->bd, write_block, block, number * info->merge_count);
 }
 
+static int block_resizer_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int block_resizer_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
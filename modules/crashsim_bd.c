@@ -74,6 +74,15 @@ static bdesc_t * crashsim_bd_synthetic_read_block(BD_t * object, uint32_t number
 	return CALL(info->bd, synthetic_read_block, number, count, page);
 }
 
+static int crashsim_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct crashsim_info * info = (struct crashsim_info *) object;
+	/* after the crash, reads may be served from our copies */
+	if(info->crashed)
+		return 0;
+	return CALL(info->bd, read_ahead, number, count, nbdescs);
+}
+
 static int crashsim_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct crashsim_info * info = (struct crashsim_info *) object;
@@ -139,6 +148,11 @@ static int crashsim_bd_write_block(BD_t * object, bdesc_t * block, uint32_t numb
 	return CALL(info->bd, write_block, block, number);
 }
 
+static int crashsim_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int crashsim_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
@@ -202,35 +202,85 @@ static int devfs_close(CFS_t * cfs, fdesc_t * fdesc)
 }
 
 /* This function looks a lot like uhfs_read() */
-static int devfs_read(CFS_t * cfs, fdesc_t * fdesc, page_t * page, void * data, uint32_t offset, uint32_t size)
+/* Clip a read to the end of the device and hint that its blocks will be
+ * read. Returns -1 if the read starts past the end of the device. */
+static int devfs_read_prepare(devfs_fdesc_t * devfd, uint32_t offset, uint32_t * size)
 {
-	Dprintf("%s(0x%08x, 0x%x, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, data, offset, size);
-	devfs_fdesc_t * devfd = (devfs_fdesc_t *) fdesc;
-	
 	const uint32_t blocksize = devfd->bd->blocksize;
-	const uint32_t blockoffset = offset - (offset % blocksize);
 	const uint32_t file_size = blocksize * devfd->bd->numblocks;
-	uint32_t size_read = 0, dataoffset = (offset % blocksize);
-	bdesc_t * bdesc;
+	uint32_t first, count;
 
 	if(file_size <= offset)
 		return -1;
-	if(offset + size > file_size)
-		size = file_size - offset;
+	if(offset + *size > file_size)
+		*size = file_size - offset;
+	first = offset / blocksize;
+	count = (offset + *size + blocksize - 1) / blocksize - first;
+	if(count > 1)
+		CALL(devfd->bd, read_ahead, first, 1, MIN(count, (uint16_t) -1));
+	return 0;
+}
+
+/* Read the block holding byte 'size_read' of a read, and set *dataoffset and
+ * *length to the part of it that is read */
+static bdesc_t * devfs_read_next(devfs_fdesc_t * devfd, page_t * page, uint32_t offset, uint32_t size, uint32_t size_read, uint32_t * dataoffset, uint32_t * length)
+{
+	const uint32_t blocksize = devfd->bd->blocksize;
+	const uint32_t read_byte = offset + size_read;
+	bdesc_t * bdesc;
+
+	bdesc = CALL(devfd->bd, read_block, read_byte / blocksize, 1, page);
+	if(!bdesc)
+		return NULL;
+	*dataoffset = read_byte % blocksize;
+	*length = MIN(bdesc->length - *dataoffset, size - size_read);
+	return bdesc;
+}
+
+static int devfs_read(CFS_t * cfs, fdesc_t * fdesc, page_t * page, void * data, uint32_t offset, uint32_t size)
+{
+	Dprintf("%s(0x%08x, 0x%x, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, data, offset, size);
+	devfs_fdesc_t * devfd = (devfs_fdesc_t *) fdesc;
+	uint32_t size_read = 0;
+
+	if(devfs_read_prepare(devfd, offset, &size) < 0)
+		return -1;
 	while(size_read < size)
 	{
-		uint32_t limit;
-		uint32_t read_byte = blockoffset + (offset % blocksize) - dataoffset + size_read;
-
-		bdesc = CALL(devfd->bd, read_block, read_byte / blocksize, 1, page);
+		uint32_t dataoffset, limit;
+		bdesc_t * bdesc = devfs_read_next(devfd, page, offset, size, size_read, &dataoffset, &limit);
 		if(!bdesc)
 			return size_read ? size_read : -1;
 
-		limit = MIN(bdesc->length - dataoffset, size - size_read);
 		memcpy((uint8_t *) data + size_read, bdesc_data(bdesc) + dataoffset, limit);
 		size_read += limit;
-		/* dataoffset only needed for first block */
-		dataoffset = 0;
+	}
+
+	return size_read ? size_read : (size ? -1 : 0);
+}
+
+static int devfs_read_extents(CFS_t * cfs, fdesc_t * fdesc, uint32_t offset, uint32_t size, cfs_extent_t * extents, uint32_t * nextents)
+{
+	Dprintf("%s(0x%08x, 0x%x, 0x%x, %u)\n", __FUNCTION__, fdesc, offset, size, *nextents);
+	devfs_fdesc_t * devfd = (devfs_fdesc_t *) fdesc;
+	const uint32_t max_extents = *nextents;
+	uint32_t size_read = 0;
+
+	*nextents = 0;
+	if(devfs_read_prepare(devfd, offset, &size) < 0)
+		return -1;
+	while(size_read < size && *nextents < max_extents)
+	{
+		uint32_t dataoffset, limit;
+		bdesc_t * bdesc = devfs_read_next(devfd, NULL, offset, size, size_read, &dataoffset, &limit);
+		if(!bdesc)
+			break;
+
+		extents[*nextents].block = bdesc_retain(bdesc);
+		extents[*nextents].offset = dataoffset;
+		extents[*nextents].length = limit;
+		++*nextents;
+		size_read += limit;
 	}
 
 	return size_read ? size_read : (size ? -1 : 0);
@@ -449,6 +499,12 @@ static int devfs_set_metadata2(CFS_t * cfs, inode_t inode, const fsmetadata_t *f
 	return -EPERM;
 }
 
+static int devfs_sync_inode(CFS_t * cfs, inode_t inode)
+{
+	Dprintf("%s(%u)\n", __FUNCTION__, inode);
+	return -ENOSYS;
+}
+
 static void devfs_real_destroy(void * void_devfs_cfs)
 {
 	devfs_state_t * state = (devfs_state_t *) void_devfs_cfs;
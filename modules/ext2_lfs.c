@@ -26,6 +26,16 @@
 
 #define ROUND_ROBIN_ALLOC 1
 
+/* Number of blocks to mark allocated at once when a regular file needs a new
+ * data block; the ones it does not use are freed when it is closed */
+#define PREALLOC_BLOCKS 16
+
+/* Number of blocks an unlink frees with each batch of bitmap patches */
+#define FREE_BATCH_SIZE 64
+
+/* Longest run of contiguous blocks get_file_block() will cache */
+#define EXTENT_CACHE_MAX 1024
+
 #if EXT2_LFS_DEBUG
 #define Dprintf(x...) printf(x)
 #else
@@ -51,6 +61,7 @@ typedef struct ext2_mdir ext2_mdir_t;
 typedef struct ext2_mdir_cache ext2_mdir_cache_t;
 typedef struct ext2_info ext2_info_t;
 typedef struct ext2_fdesc ext2_fdesc_t;
+typedef struct ext2_free_batch ext2_free_batch_t;
 
 /* directory entry cache */
 struct ext2_minode {
@@ -151,6 +162,22 @@ struct ext2_fdesc {
 	uint32_t f_lastblock;
 #endif
 	uint32_t f_age;
+	/* the last run of file blocks mapped to contiguous disk blocks */
+	uint32_t f_extent_file;
+	uint32_t f_extent_disk;
+	uint32_t f_extent_count;
+#if PREALLOC_BLOCKS
+	/* blocks allocated on disk for this file but not yet used */
+	uint32_t f_prealloc_start;
+	uint32_t f_prealloc_count;
+	patchweakref_t f_prealloc_patch;
+#endif
+};
+
+/* blocks to be freed together, in sorted order */
+struct ext2_free_batch {
+	uint32_t count;
+	uint32_t blocks[FREE_BATCH_SIZE];
 };
 
 #define DECL_INODE_MOD(f) \
@@ -189,6 +216,10 @@ struct ext2_fdesc {
 /* some prototypes */
 static int ext2_read_block_bitmap(LFS_t * object, uint32_t blockno);
 static int _ext2_free_block(LFS_t * object, uint32_t block, patch_t ** head);
+static int ext2_free_batch_flush(LFS_t * object, ext2_free_batch_t * batch, patch_t ** head);
+#if PREALLOC_BLOCKS
+static int ext2_discard_prealloc(LFS_t * object, ext2_fdesc_t * f);
+#endif
 static uint32_t get_file_block(LFS_t * object, ext2_fdesc_t * file, uint32_t offset);
 
 static int ext2_super_report(LFS_t * lfs, uint32_t group, int32_t blocks, int32_t inodes, int32_t dirs);
@@ -976,6 +1007,176 @@ static int ext2_write_block_bitmap(LFS_t * object, uint32_t blockno, bool value,
 	return ext2_super_report(object, block_group, (value ? -1 : 1), 0, 0);
 }
 
+/* Set or clear the given bits of word 'word' in the loaded block bitmap, with
+ * one bit patch for those that do not already have that value. Returns the
+ * number of bits changed. */
+static int ext2_write_block_bitmap_word(LFS_t * object, uint32_t word, uint32_t bits, bool value, patch_t ** head)
+{
+	struct ext2_info * info = (struct ext2_info *) object;
+	const uint32_t * bitmap = (const uint32_t *) bdesc_data(info->bitmap_cache);
+	int r;
+	
+	if(value)
+		bits &= ~bitmap[word];
+	else
+		bits &= bitmap[word];
+	if(!bits)
+		return 0;
+	
+#if BLOCK_ALLOC_DEPS
+	if(!value && BLOCK_ALLOC_HEAD_VALID(&object->alloc_deps))
+	{
+		uint32_t bit;
+		for(bit = 0; bit < 32; bit++)
+			if(bits & (1U << bit))
+			{
+				r = block_alloc_set_freed(&object->alloc_deps, info->gnum * info->super->s_blocks_per_group + word * 32 + bit, *head);
+				if(r < 0)
+					return r;
+			}
+	}
+#endif
+	r = patch_create_bit(info->bitmap_cache, info->ubd, word, bits, head);
+	if(r < 0)
+		return r;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, *head, value ? "allocate blocks" : "free blocks");
+	return __builtin_popcount(bits);
+}
+
+/* Write out the loaded block bitmap after ext2_write_block_bitmap_word()
+ * changed 'changed' bits in it, and update the free block counts */
+static int ext2_write_block_bitmap_done(LFS_t * object, int32_t changed, bool value)
+{
+	struct ext2_info * info = (struct ext2_info *) object;
+	int r;
+	
+	if(!changed)
+		return 0;
+	r = CALL(info->ubd, write_block, info->bitmap_cache, info->bitmap_cache_number);
+	if(r < 0)
+		return r;
+	return ext2_super_report(object, info->gnum, (value ? -changed : changed), 0, 0);
+}
+
+#if PREALLOC_BLOCKS
+/* Like ext2_write_block_bitmap, but for 'count' blocks in one block group
+ * starting at 'blockno', with one bit patch per bitmap word */
+static int ext2_write_block_bitmap_run(LFS_t * object, uint32_t blockno, uint32_t count, bool value, patch_t ** head)
+{
+	Dprintf("EXT2DEBUG: write_bitmap_run %u+%u -> %d\n", blockno, count, value);
+	struct ext2_info * info = (struct ext2_info *) object;
+	uint32_t block_group, block_in_group, end;
+	int32_t changed = 0;
+	int r;
+	
+	if(!head)
+		return -1;
+	if(!count)
+		return 0;
+	
+	block_group = blockno / info->super->s_blocks_per_group;
+	if(blockno + count > info->super->s_blocks_count || (blockno + count - 1) / info->super->s_blocks_per_group != block_group)
+	{
+		printf("%s(): requested status of blocks %u+%u past end of block group!\n", __FUNCTION__, blockno, count);
+		return -EINVAL;
+	}
+	/* checks blockno and loads the bitmap for its group */
+	r = ext2_read_block_bitmap(object, blockno);
+	if(r < 0)
+		return r;
+	
+	block_in_group = blockno % info->super->s_blocks_per_group;
+	end = block_in_group + count;
+	while(block_in_group < end)
+	{
+		uint32_t word = block_in_group / 32;
+		uint32_t bits = 0;
+		
+		for(; block_in_group < end && block_in_group / 32 == word; block_in_group++)
+			bits |= 1U << (block_in_group % 32);
+		r = ext2_write_block_bitmap_word(object, word, bits, value, head);
+		if(r < 0)
+			return r;
+		changed += r;
+	}
+	
+	return ext2_write_block_bitmap_done(object, changed, value);
+}
+#endif
+
+/* Add 'block' to a batch of blocks to be freed together, keeping it sorted.
+ * A full batch is freed first, depending on and updating '*head'. */
+static int ext2_free_batch_add(LFS_t * object, ext2_free_batch_t * batch, uint32_t block, patch_t ** head)
+{
+	uint32_t i;
+	
+	if(batch->count == FREE_BATCH_SIZE)
+	{
+		int r = ext2_free_batch_flush(object, batch, head);
+		if(r < 0)
+			return r;
+	}
+	
+	/* blocks are usually freed from the end of the file backwards */
+	for(i = batch->count; i && batch->blocks[i - 1] > block; i--)
+		batch->blocks[i] = batch->blocks[i - 1];
+	batch->blocks[i] = block;
+	batch->count++;
+	return 0;
+}
+
+/* Free the blocks in a batch with one bit patch per bitmap word and one free
+ * block count update per block group, depending on and updating '*head' */
+static int ext2_free_batch_flush(LFS_t * object, ext2_free_batch_t * batch, patch_t ** head)
+{
+	Dprintf("EXT2DEBUG: %s %u\n", __FUNCTION__, batch->count);
+	struct ext2_info * info = (struct ext2_info *) object;
+	const uint32_t per_group = info->super->s_blocks_per_group;
+	uint32_t i = 0;
+	int r = 0;
+	
+	if(!head)
+		return -EINVAL;
+	if(batch->count && batch->blocks[batch->count - 1] >= info->super->s_blocks_count)
+	{
+		printf("%s(): requested status of block %u past end of file system!\n", __FUNCTION__, batch->blocks[batch->count - 1]);
+		r = -EINVAL;
+		goto exit;
+	}
+	
+	while(i < batch->count)
+	{
+		uint32_t group = batch->blocks[i] / per_group;
+		int32_t changed = 0;
+		
+		/* checks the first block and loads the bitmap for its group */
+		r = ext2_read_block_bitmap(object, batch->blocks[i]);
+		if(r < 0)
+			goto exit;
+		
+		while(i < batch->count && batch->blocks[i] / per_group == group)
+		{
+			uint32_t word = (batch->blocks[i] % per_group) / 32;
+			uint32_t bits = 0;
+			
+			for(; i < batch->count && batch->blocks[i] / per_group == group && (batch->blocks[i] % per_group) / 32 == word; i++)
+				bits |= 1U << (batch->blocks[i] % per_group % 32);
+			r = ext2_write_block_bitmap_word(object, word, bits, 0, head);
+			if(r < 0)
+				goto exit;
+			changed += r;
+		}
+		
+		r = ext2_write_block_bitmap_done(object, changed, 0);
+		if(r < 0)
+			goto exit;
+	}
+	
+  exit:
+	batch->count = 0;
+	return r;
+}
+
 static int ext2_write_inode_bitmap(LFS_t * object, inode_t inode_no, bool value, patch_t ** head)
 {
 	Dprintf("EXT2DEBUG: ext2_write_inode_bitmap %u\n", inode_no);
@@ -1048,12 +1249,42 @@ static uint32_t ext2_allocate_block(LFS_t * object, fdesc_t * file, int purpose,
 	uint32_t blockno, lastblock = 0;
 #if !ROUND_ROBIN_ALLOC
 	uint32_t block_group;
+#endif
+#if PREALLOC_BLOCKS
+	bool prealloc, retried = 0;
+	uint32_t count = 1;
 #endif
 	int r;
 	
 	if(!tail || !f)
 		return INVALID_BLOCK;
 	
+#if PREALLOC_BLOCKS
+	prealloc = purpose == PURPOSE_FILEDATA && f->f_type == TYPE_FILE;
+	if(prealloc && f->f_prealloc_count)
+	{
+		/* already allocated on disk: just depend on that */
+		patch_t * window = WEAK(f->f_prealloc_patch);
+		*tail = info->write_head ? *info->write_head : NULL;
+		if(window && !*tail)
+			*tail = window;
+		else if(window && window != *tail)
+			if(patch_create_empty_list(NULL, tail, window, *tail, NULL) < 0)
+				return INVALID_BLOCK;
+		f->f_prealloc_count--;
+		return f->f_prealloc_start++;
+	}
+	
+	/* keep the file contiguous by continuing after its last window */
+	if(prealloc && f->f_prealloc_start && f->f_prealloc_start < info->super->s_blocks_count &&
+	   ext2_read_block_bitmap(object, f->f_prealloc_start) == EXT2_FREE)
+	{
+		blockno = f->f_prealloc_start;
+		goto claim_block;
+	}
+	
+  search:
+#endif
 #if !ROUND_ROBIN_ALLOC
 	if(!f->f_ip->i_size || purpose)
 		goto inode_search;
@@ -1105,10 +1336,43 @@ inode_search:
 		blockno += info->super->s_blocks_per_group;
 	}
 	
+#if PREALLOC_BLOCKS
+	/* other files' windows may be holding the last free blocks */
+	if(!retried)
+	{
+		ext2_fdesc_t * other;
+		for(other = info->filecache; other; other = other->f_cache_next)
+			if(other->f_prealloc_count)
+			{
+				ext2_discard_prealloc(object, other);
+				retried = 1;
+			}
+		if(retried)
+			goto search;
+	}
+#endif
 	return INVALID_BLOCK;
 	
   claim_block:
 	*tail = info->write_head ? *info->write_head : NULL;
+#if PREALLOC_BLOCKS
+	if(prealloc)
+	{
+		/* take the free blocks that follow too, up to the end of the group */
+		while(count < PREALLOC_BLOCKS && blockno + count < info->super->s_blocks_count &&
+		      (blockno + count) % info->super->s_blocks_per_group &&
+		      ext2_read_block_bitmap(object, blockno + count) == EXT2_FREE)
+			count++;
+		if(ext2_write_block_bitmap_run(object, blockno, count, 1, tail) < 0)
+			return INVALID_BLOCK;
+		if(WEAK(f->f_prealloc_patch))
+			patch_weak_release(&f->f_prealloc_patch, 0);
+		patch_weak_retain(*tail, &f->f_prealloc_patch, NULL, NULL);
+		f->f_prealloc_start = blockno + 1;
+		f->f_prealloc_count = count - 1;
+	}
+	else
+#endif
 	if(ext2_write_block_bitmap(object, blockno, 1, tail) < 0)
 	{
 		ext2_write_block_bitmap(object, blockno, 0, tail);
@@ -1117,8 +1381,12 @@ inode_search:
 #if !ROUND_ROBIN_ALLOC
 	if(purpose == PURPOSE_FILEDATA || purpose == PURPOSE_DIRDATA)
 		f->f_lastblock = blockno;
+#else
+#if PREALLOC_BLOCKS
+	lastblock = (blockno + count) % info->super->s_blocks_count;
 #else
 	lastblock = (blockno + 1) % info->super->s_blocks_count;
+#endif
 	if(purpose == PURPOSE_FILEDATA)
 		info->last_fblock = lastblock;
 	else if(purpose == PURPOSE_DIRDATA)
@@ -1156,6 +1424,11 @@ static void __ext2_free_fdesc(ext2_fdesc_t * f)
 static inline void ext2_free_fdesc(LFS_t * object, fdesc_t * fdesc)
 {
 	ext2_fdesc_t * f = (ext2_fdesc_t *) fdesc;
+#if PREALLOC_BLOCKS
+	/* give back the window once nothing but the cache has the file open */
+	if(f && f->f_prealloc_count && f->f_nopen - 1 == (f->f_age ? 1 : 0))
+		ext2_discard_prealloc(object, f);
+#endif
 	if(f && !--f->f_nopen)
 		__ext2_free_fdesc(f);
 }
@@ -1200,6 +1473,12 @@ static fdesc_t * ext2_lookup_inode(LFS_t * object, inode_t ino)
 	fd->f_lastblock = 0;
 #endif
 	fd->f_age = age;
+	fd->f_extent_count = 0;
+#if PREALLOC_BLOCKS
+	fd->f_prealloc_start = 0;
+	fd->f_prealloc_count = 0;
+	WEAK_INIT(fd->f_prealloc_patch);
+#endif
 	
 	r = ext2_get_inode(info, fd, 1);
 	if(r < 0)
@@ -1276,63 +1555,121 @@ static uint32_t ext2_get_file_numblocks(LFS_t * object, fdesc_t * file)
 	return (f->f_ip->i_size + object->blocksize - 1) / object->blocksize;
 }
 
-static uint32_t get_file_block(LFS_t * object, ext2_fdesc_t * file, uint32_t offset)
+/* Return a pointer to the block pointer for file block 'blocknum', and set
+ * '*left' to the number of pointers from there to the end of its array.
+ * A missing indirect block reads as a single zero pointer. */
+static const uint32_t * get_block_pointer(LFS_t * object, ext2_fdesc_t * file, uint32_t blocknum, uint32_t * left)
 {
-	Dprintf("EXT2DEBUG: %s %p %d\n", __FUNCTION__, file, offset);
+	static const uint32_t hole = 0;
 	struct ext2_info * info = (struct ext2_info *) object;
-	uint32_t blockno, n_per_block;
-	bdesc_t * block_desc;
-	uint32_t * inode_nums, blocknum;
-	
-	if(offset >= file->f_ip->i_size || file->f_type == TYPE_SYMLINK)
-		return INVALID_BLOCK;
-	
-	n_per_block = object->blocksize / (sizeof(uint32_t));
+	const uint32_t n_per_block = object->blocksize / sizeof(uint32_t);
+	uint32_t indirect, span;
 	
-	// non block aligned offsets suck (aka aren't supported)
-	blocknum = offset / object->blocksize;
+	if(blocknum < EXT2_NDIRECT)
+	{
+		*left = EXT2_NDIRECT - blocknum;
+		return &file->f_ip->i_block[blocknum];
+	}
+	blocknum -= EXT2_NDIRECT;
 	
-	// TODO: compress this code, but right now its much easier to understand...
-	if(blocknum >= n_per_block * n_per_block + n_per_block + EXT2_NDIRECT)
+	if(blocknum < n_per_block)
 	{
-		// Lets not worry about tripley indirect for the momment
-		return INVALID_BLOCK;
+		indirect = file->f_ip->i_block[EXT2_INDIRECT];
+		span = 1;
 	}
-	else if(blocknum >= n_per_block + EXT2_NDIRECT)
+	else if((blocknum -= n_per_block) < n_per_block * n_per_block)
 	{
-		blocknum -= (EXT2_NDIRECT + n_per_block);
-		block_desc = CALL(info->ubd, read_block, file->f_ip->i_block[EXT2_DINDIRECT], 1, NULL);
-		if(!block_desc)
+		indirect = file->f_ip->i_block[EXT2_DINDIRECT];
+		span = n_per_block;
+	}
+	else
+	{
+		blocknum -= n_per_block * n_per_block;
+		if(blocknum / n_per_block / n_per_block >= n_per_block)
+			return NULL;
+		indirect = file->f_ip->i_block[EXT2_TINDIRECT];
+		span = n_per_block * n_per_block;
+	}
+	
+	/* walk down the indirect blocks */
+	for(;;)
+	{
+		const uint32_t * pointers;
+		bdesc_t * block_desc;
+		
+		if(!indirect)
 		{
-			Dprintf("failed dindirect block lookup in %s\n", __FUNCTION__);
-			return INVALID_BLOCK;
+			*left = 1;
+			return &hole;
 		}
-		inode_nums = (uint32_t *) bdesc_data(block_desc);
-		blockno = inode_nums[blocknum / n_per_block];
-		block_desc = CALL(info->ubd, read_block, blockno, 1, NULL);
+		block_desc = CALL(info->ubd, read_block, indirect, 1, NULL);
 		if(!block_desc)
 		{
 			Dprintf("failed indirect block lookup in %s\n", __FUNCTION__);
-			return INVALID_BLOCK;
+			return NULL;
 		}
-		inode_nums = (uint32_t *) bdesc_data(block_desc);
-		blocknum %= n_per_block;
-		return inode_nums[blocknum];
+		pointers = (const uint32_t *) bdesc_data(block_desc);
+		if(span == 1)
+		{
+			*left = n_per_block - blocknum;
+			return &pointers[blocknum];
+		}
+		indirect = pointers[blocknum / span];
+		blocknum %= span;
+		span /= n_per_block;
 	}
-	else if(blocknum >= EXT2_NDIRECT)
+}
+
+/* Map file block 'blocknum', caching the run of blocks that follow it
+ * contiguously on disk in the fdesc */
+static uint32_t map_file_extent(LFS_t * object, ext2_fdesc_t * file, uint32_t blocknum)
+{
+	const uint32_t nblocks = (file->f_ip->i_size + object->blocksize - 1) / object->blocksize;
+	const uint32_t * pointer;
+	uint32_t first, left, count = 0;
+	
+	pointer = get_block_pointer(object, file, blocknum, &left);
+	if(!pointer)
+		return INVALID_BLOCK;
+	first = *pointer;
+	if(!first)
+		return first;
+	
+	while(count < EXTENT_CACHE_MAX && blocknum + count < nblocks)
 	{
-		blocknum -= EXT2_NDIRECT;
-		block_desc = CALL(info->ubd, read_block, file->f_ip->i_block[EXT2_INDIRECT], 1, NULL);
-		if(!block_desc)
+		if(!left)
 		{
-			Dprintf("failed indirect block lookup in %s\n", __FUNCTION__);
-			return INVALID_BLOCK;
+			pointer = get_block_pointer(object, file, blocknum + count, &left);
+			if(!pointer)
+				break;
 		}
-		inode_nums = (uint32_t *) bdesc_data(block_desc);
-		return inode_nums[blocknum];
+		if(*pointer != first + count)
+			break;
+		pointer++;
+		left--;
+		count++;
 	}
-	else
-		return file->f_ip->i_block[blocknum];
+	
+	file->f_extent_file = blocknum;
+	file->f_extent_disk = first;
+	file->f_extent_count = count;
+	return first;
+}
+
+static uint32_t get_file_block(LFS_t * object, ext2_fdesc_t * file, uint32_t offset)
+{
+	Dprintf("EXT2DEBUG: %s %p %d\n", __FUNCTION__, file, offset);
+	uint32_t blocknum;
+	
+	if(offset >= file->f_ip->i_size || file->f_type == TYPE_SYMLINK)
+		return INVALID_BLOCK;
+	
+	// non block aligned offsets suck (aka aren't supported)
+	blocknum = offset / object->blocksize;
+	
+	if(blocknum - file->f_extent_file < file->f_extent_count)
+		return file->f_extent_disk + blocknum - file->f_extent_file;
+	return map_file_extent(object, file, blocknum);
 }
 
 // Offset is a byte offset
@@ -1342,6 +1679,22 @@ static uint32_t ext2_get_file_block(LFS_t * object, fdesc_t * file, uint32_t off
 	return get_file_block(object, (ext2_fdesc_t *) file, offset);
 }
 
+static uint32_t ext2_get_file_extent(LFS_t * object, fdesc_t * file, uint32_t offset, uint32_t * nblocks)
+{
+	Dprintf("EXT2DEBUG: ext2_get_file_extent %p, %u\n", file, offset);
+	ext2_fdesc_t * f = (ext2_fdesc_t *) file;
+	uint32_t number = get_file_block(object, f, offset);
+	uint32_t blocknum = offset / object->blocksize;
+	
+	if(number == INVALID_BLOCK)
+		*nblocks = 0;
+	else if(blocknum - f->f_extent_file < f->f_extent_count)
+		*nblocks = f->f_extent_count - (blocknum - f->f_extent_file);
+	else
+		*nblocks = 1;
+	return number;
+}
+
 static int fill_dirent(ext2_info_t * info, const EXT2_Dir_entry_t * dirfile, inode_t ino, struct dirent * entry, uint16_t size, uint32_t * basep)
 {
 	Dprintf("EXT2DEBUG: %s inode number %u, %u\n", __FUNCTION__, ino, *basep);
@@ -1447,6 +1800,7 @@ static int ext2_append_file_block_set(LFS_t * object, fdesc_t * file, uint32_t b
 	set.size = 1;
 	
 	assert(tail && f && block != INVALID_BLOCK && f->f_type != TYPE_SYMLINK);
+	f->f_extent_count = 0;
 	
 	/* calculate current number of blocks */
 	nblocks = f->f_ip->i_blocks / (object->blocksize / 512);
@@ -2529,6 +2883,16 @@ static uint32_t ext2_truncate_file_block(LFS_t * object, fdesc_t * file, patch_t
 	// Update ext2_mdir code if we want to directory truncation
 	assert(f->f_type != TYPE_DIR);
 	
+	f->f_extent_count = 0;
+#if PREALLOC_BLOCKS
+	if(f->f_prealloc_count)
+	{
+		r = ext2_discard_prealloc(object, f);
+		if(r < 0)
+			return INVALID_BLOCK;
+	}
+#endif
+	
 	// FIXME: need to do [d]indirect block count decrement, and write it, here!
 	DECL_INODE_MOD(f);
 	INODE_ADD(f, i_blocks, -(object->blocksize / 512));
@@ -2775,6 +3139,7 @@ static int ext2_rename(LFS_t * object, inode_t oldparent, const char * oldname,
 			// TODO: make these dependencies less strict (like in remove_name)
 			
 			uint32_t i, n = ext2_get_file_numblocks(object, (fdesc_t *) fnew);
+			ext2_free_batch_t batch = {.count = 0};
 			for(i = 0; i < n; i++)
 			{
 				uint32_t block = ext2_truncate_file_block(object, (fdesc_t *) fnew, &prev_head);
@@ -2783,10 +3148,13 @@ static int ext2_rename(LFS_t * object, inode_t oldparent, const char * oldname,
 					r = -1;
 					goto exit_fnew;
 				}
-				r = _ext2_free_block(object, block, &prev_head);
+				r = ext2_free_batch_add(object, &batch, block, &prev_head);
 				if(r < 0)
 					goto exit_fnew;
 			}
+			r = ext2_free_batch_flush(object, &batch, &prev_head);
+			if(r < 0)
+				goto exit_fnew;
 			
 			INODE_CLEAR(fnew);
 			r = ext2_write_inode(info, fnew, &prev_head, 0, sizeof(EXT2_inode_t));
@@ -2836,6 +3204,44 @@ static int ext2_free_block(LFS_t * object, fdesc_t * file, uint32_t block, patch
 	return _ext2_free_block(object, block, head);
 }
 
+static int ext2_free_blocks(LFS_t * object, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head)
+{
+	ext2_free_batch_t batch = {.count = 0};
+	uint32_t i;
+	int r;
+
+	Dprintf("EXT2DEBUG: ext2_free_blocks %u\n", count);
+	
+	for(i = 0; i < count; i++)
+	{
+		if(blocks[i] == INVALID_BLOCK)
+			return -EINVAL;
+		r = ext2_free_batch_add(object, &batch, blocks[i], head);
+		if(r < 0)
+			return r;
+	}
+	return ext2_free_batch_flush(object, &batch, head);
+}
+
+#if PREALLOC_BLOCKS
+/* Free the blocks in a file's preallocation window that it has not used */
+static int ext2_discard_prealloc(LFS_t * object, ext2_fdesc_t * f)
+{
+	Dprintf("EXT2DEBUG: %s %u+%u\n", __FUNCTION__, f->f_prealloc_start, f->f_prealloc_count);
+	struct ext2_info * info = (struct ext2_info *) object;
+	patch_t * head = info->write_head ? *info->write_head : NULL;
+	int r;
+	
+	r = ext2_write_block_bitmap_run(object, f->f_prealloc_start, f->f_prealloc_count, 0, &head);
+	if(r >= 0 && head)
+		lfs_add_fork_head(head);
+	f->f_prealloc_count = 0;
+	if(WEAK(f->f_prealloc_patch))
+		patch_weak_release(&f->f_prealloc_patch, 0);
+	return r;
+}
+#endif
+
 static int ext2_delete_dirent(LFS_t * object, ext2_fdesc_t * dir_file, ext2_mdir_t * mdir, ext2_mdirent_t * mdirent, patch_t ** phead)
 {
 	Dprintf("EXT2DEBUG: ext2_delete_dirent %u\n", mdirent->offset);
@@ -3034,6 +3440,8 @@ static int ext2_remove_name(LFS_t * object, inode_t parent, const char * name, p
 		
 		file->f_xinode = inode; // XXX slow
 		int ioff1 = sizeof(EXT2_inode_t), ioff2 = 0; // XXX lame
+		ext2_free_batch_t batch = {.count = 0};
+		patch_t * free_head = *head;
 		for(j = 0; j < nblocks; j++)
 		{
 			prev_head = *head;
@@ -3045,12 +3453,15 @@ static int ext2_remove_name(LFS_t * object, inode_t parent, const char * name, p
 			}
 			lfs_add_fork_head(prev_head);
 			
-			prev_head = *head;
-			r = _ext2_free_block(object, number, &prev_head);
+			r = ext2_free_batch_add(object, &batch, number, &free_head);
 			if(r < 0)
 				goto remove_name_exit;
-			lfs_add_fork_head(prev_head);
 		}
+		r = ext2_free_batch_flush(object, &batch, &free_head);
+		if(r < 0)
+			goto remove_name_exit;
+		if(free_head != *head)
+			lfs_add_fork_head(free_head);
 		memset(&file->f_xinode, 0, sizeof(EXT2_inode_t)); // XXX slow
 		if(file->f_type == TYPE_DIR)
 		{
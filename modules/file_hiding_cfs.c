@@ -210,6 +210,18 @@ static int file_hiding_read(CFS_t * cfs, fdesc_t * fdesc, void * data, uint32_t
 	return CALL(state->frontend_cfs, read, fhf->inner, data, ofhfset, size);
 }
 
+static int file_hiding_read_extents(CFS_t * cfs, fdesc_t * fdesc, uint32_t ofhfset, uint32_t size, cfs_extent_t * extents, uint32_t * nextents)
+{
+	Dprintf("%s(0x%08x, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, ofhfset, size);
+	file_hiding_state_t * state = (file_hiding_state_t *) cfs;
+	file_hiding_fdesc_t * fhf = (file_hiding_fdesc_t *) fdesc;
+
+	if (fhf->ino == INODE_NONE)
+		return -ENOENT;
+
+	return CALL(state->frontend_cfs, read_extents, fhf->inner, ofhfset, size, extents, nextents);
+}
+
 static int file_hiding_write(CFS_t * cfs, fdesc_t * fdesc, const void * data, uint32_t ofhfset, uint32_t size)
 {
 	Dprintf("%s(0x%08x, 0x%x, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, data, ofhfset, size);
@@ -369,6 +381,16 @@ static int file_hiding_set_metadata(CFS_t * cfs, inode_t ino, uint32_t id, size_
 	return CALL(state->frontend_cfs, set_metadata, ino, id, size, data);
 }
 
+static int file_hiding_sync_inode(CFS_t * cfs, inode_t ino)
+{
+	Dprintf("%s(%u)\n", __FUNCTION__, ino);
+	file_hiding_state_t * state = (file_hiding_state_t *) cfs;
+	if (hide_lookup(state->hide_table, ino) >= 0)
+		return -ENOENT;
+
+	return CALL(state->frontend_cfs, sync_inode, ino);
+}
+
 static int file_hiding_destroy(CFS_t * cfs)
 {
 	Dprintf("%s(0x%08x)\n", __FUNCTION__, cfs);
@@ -127,6 +127,13 @@ static int icase_read(CFS_t * cfs, fdesc_t * fdesc, page_t * page, void * data,
 	return CALL(state->frontend_cfs, read, fdesc, page, data, ofhfset, size);
 }
 
+static int icase_read_extents(CFS_t * cfs, fdesc_t * fdesc, uint32_t offset, uint32_t size, cfs_extent_t * extents, uint32_t * nextents)
+{
+	Dprintf("%s\n", __FUNCTION__);
+	icase_state_t * state = (icase_state_t *) cfs;
+	return CALL(state->frontend_cfs, read_extents, fdesc, offset, size, extents, nextents);
+}
+
 static int icase_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void * data, uint32_t ofhfset, uint32_t size)
 {
 	Dprintf("%s\n", __FUNCTION__);
@@ -274,6 +281,13 @@ static int icase_set_metadata2(CFS_t * cfs, inode_t ino, const fsmetadata_t *fsm
 	return CALL(state->frontend_cfs, set_metadata2, ino, fsm, nfsm);
 }
 
+static int icase_sync_inode(CFS_t * cfs, inode_t ino)
+{
+	Dprintf("%s(%u)\n", __FUNCTION__, ino);
+	icase_state_t * state = (icase_state_t *) cfs;
+	return CALL(state->frontend_cfs, sync_inode, ino);
+}
+
 static int icase_destroy(CFS_t * cfs)
 {
 	Dprintf("%s(0x%08x)\n", __FUNCTION__, (signed int)cfs);
@@ -488,6 +488,13 @@ static uint32_t josfs_get_file_block(LFS_t * object, fdesc_t * file, uint32_t of
 	return get_file_block(object, f->file, offset);
 }
 
+static uint32_t josfs_get_file_extent(LFS_t * object, fdesc_t * file, uint32_t offset, uint32_t * nblocks)
+{
+	uint32_t number = josfs_get_file_block(object, file, offset);
+	*nblocks = (number == INVALID_BLOCK) ? 0 : 1;
+	return number;
+}
+
 static int fill_dirent(JOSFS_File_t * dirfile, inode_t ino, struct dirent * entry, uint16_t size, uint32_t * basep)
 {
 	uint16_t namelen = MIN(strlen(dirfile->f_name), sizeof(entry->d_name) - 1);
@@ -1030,6 +1037,18 @@ static int josfs_free_block(LFS_t * object, fdesc_t * file, uint32_t block, patc
 	return write_bitmap(object, block, 1, head);
 }
 
+static int josfs_free_blocks(LFS_t * object, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head)
+{
+	uint32_t i;
+	for(i = 0; i < count; i++)
+	{
+		int r = josfs_free_block(object, file, blocks[i], head);
+		if(r < 0)
+			return r;
+	}
+	return 0;
+}
+
 static int josfs_remove_name(LFS_t * object, inode_t parent, const char * name, patch_t ** head)
 {
 	Dprintf("JOSFSDEBUG: josfs_remove_name %s\n", name);
@@ -5,6 +5,8 @@
 #include <lib/platform.h>
 #include <lib/jiffies.h>
 #include <lib/hash_map.h>
+#include <lib/vector.h>
+#include <lib/crc32c.h>
 
 #include <fscore/bd.h>
 #include <fscore/fstitchd.h>
@@ -12,6 +14,7 @@
 #include <fscore/modman.h>
 #include <fscore/patch.h>
 #include <fscore/sched.h>
+#include <fscore/sync.h>
 #include <fscore/debug.h>
 #include <fscore/revision.h>
 
@@ -30,17 +33,32 @@
 #define Dprintf(x...)
 #endif
 
-/* transaction period of 5 seconds */
-#define TRANSACTION_PERIOD (5 * HZ)
+/* Group commit: a sync commits the running transaction right away, and
+ * otherwise the transaction period follows the observed interval between
+ * syncs, so each sync finds little left to commit. With only background
+ * writes pending the period backs off to the maximum of 5 seconds. */
+#define TRANSACTION_PERIOD_MIN (HZ / 10)
+#define TRANSACTION_PERIOD_MAX (5 * HZ)
+/* how often to check whether the transaction period has elapsed */
+#define TRANSACTION_TICK (HZ / 20)
 /* transaction slot size of 512 x 4K */
 #define TRANSACTION_SIZE (512 * 4096)
 
 /* In principle we can stack journal slots with later transactions, but this
  * really hurts performance because of the effect it has on patch
- * optimizations and rollback. The simple and surprisingly effective fix is to
- * cause the device to flush when this happens, to avoid ever needing to stack
- * transactions. This could be made asynchronous later if necessary. */
+ * optimizations and rollback. Instead, when few slots are free we push the
+ * oldest transaction out once the global lock is released, and if we still
+ * run out, we sync just the transaction holding the oldest slot rather than
+ * flushing the whole device. */
 #define AVOID_STACKING_JOURNAL 1
+/* start pushing out old transactions when this few slots are free */
+#define SLOT_LOW_WATER(cr_count) ((cr_count) / 4 + 1)
+
+/* Store a CRC32C of each transaction's block numbers and journal data in its
+ * commit record. Replay can then tell whether the whole transaction reached
+ * the disk, so the commit record need not wait for the journal data and can
+ * be written along with it. */
+#define JOURNAL_CHECKSUM 1
 
 /* Theory of operation:
  * 
@@ -121,8 +139,18 @@
  *   provide a single patch that exists at the beginning of the transaction
  *   which represents the whole transaction, so we can weak retain it to claim
  *   slots in the journal
+ * 
+ * With a checksummed commit record, commit depends only on prev_cr (and any
+ * ordered data pivoted before "wait") rather than on "wait", and "hold"
+ * depends on "wait" directly. prev_cr then refers to the previous "hold", so
+ * a commit record is never written before the last transaction is complete.
  * */
 
+struct journal_slot {
+	patchweakref_t cr;
+	uint32_t seq;
+};
+
 struct journal_info {
 	BD_t my_bd;
 	
@@ -148,14 +176,16 @@ struct journal_info {
 	patchweakref_t jdata_head;
 	patchweakref_t prev_cr;
 	patchweakref_t prev_cancel;
-	struct {
-		patchweakref_t cr;
-		uint32_t seq;
-	} * cr_retain;
+	struct journal_slot * cr_retain;
 	/* map from FS block number -> journal block number (note 0 is invalid) */
 	hash_map_t * block_map;
 	uint16_t trans_slot_count;
 	uint8_t recursion, only_metadata;
+	/* the journal is on another device, with its own cache */
+	uint8_t external;
+	/* group commit: when the transaction got its first block, when the
+	 * last sync committed one, and the average time between syncs */
+	int trans_start, last_sync, sync_interval;
 };
 
 #define CREMPTY     0
@@ -167,8 +197,17 @@ struct commit_record {
 	uint16_t type, next;
 	uint32_t nblocks;
 	uint32_t seq;
+	/* CRC32C of the whole transaction, with JOURNAL_CSUM_MAGIC */
+	uint32_t checksum;
 };
 
+#define CR_MAGIC_OK(magic) ((magic) == JOURNAL_MAGIC || (magic) == JOURNAL_CSUM_MAGIC)
+#if JOURNAL_CHECKSUM
+#define CR_MAGIC JOURNAL_CSUM_MAGIC
+#else
+#define CR_MAGIC JOURNAL_MAGIC
+#endif
+
 static unsigned int nholds = 0;
 
 /* number of block numbers that can be stored in a block */
@@ -208,12 +247,143 @@ static bdesc_t * journal_bd_synthetic_read_block(BD_t * object, uint32_t number,
 	return CALL(info->bd, synthetic_read_block, number, count, page);
 }
 
+/* Compute the CRC32C of a transaction: the block numbers and data of each slot
+ * in its chain, starting with 'slot', which holds 'commit'. The commit record
+ * itself is passed in since it may not be written yet. Returns -EINVAL if the
+ * chain is broken. */
+static int journal_bd_checksum(BD_t * object, uint16_t slot, const struct commit_record * commit, uint32_t * checksum)
+{
+	struct journal_info * info = (struct journal_info *) object;
+	const uint32_t npb = numbers_per_block(object->blocksize);
+	uint32_t nblocks = commit->nblocks;
+	uint16_t next = commit->next;
+	uint16_t count = 0;
+	uint32_t crc = ~0;
+	
+	for(;;)
+	{
+		uint32_t number = slot * info->trans_total_blocks + 1;
+		uint32_t data = number + trans_number_block_count(object->blocksize);
+		struct commit_record * cr;
+		bdesc_t * block;
+		uint32_t i;
+		
+		crc = crc32c(crc, &nblocks, sizeof(nblocks));
+		for(i = 0; i < nblocks; i += npb)
+		{
+			block = CALL(info->journal, read_block, number++, 1, NULL);
+			if(!block)
+				return -ENOMEM;
+			crc = crc32c(crc, bdesc_data(block), MIN(npb, nblocks - i) * sizeof(uint32_t));
+		}
+		for(i = 0; i < nblocks; i++)
+		{
+			block = CALL(info->journal, read_block, data++, 1, NULL);
+			if(!block)
+				return -ENOMEM;
+			crc = crc32c(crc, bdesc_data(block), object->blocksize);
+		}
+		
+		if(next == slot)
+			break;
+		/* follow the chain to the next subcommit record */
+		if(++count == info->cr_count)
+			return -EINVAL;
+		slot = next;
+		block = CALL(info->journal, read_block, slot * info->trans_total_blocks, 1, NULL);
+		if(!block)
+			return -ENOMEM;
+		cr = (struct commit_record *) bdesc_data(block);
+		if(cr->magic != JOURNAL_CSUM_MAGIC || cr->type != CRSUBCOMMIT || cr->seq != commit->seq)
+			return -EINVAL;
+		next = cr->next;
+		nblocks = cr->nblocks;
+	}
+	
+	*checksum = crc;
+	return 0;
+}
+
+#if JOURNAL_CHECKSUM
+/* A checksummed commit record does not wait for "wait", but ordered file data
+ * pivoted before "wait" must still reach the disk before the commit does. */
+static int journal_bd_order_commit(struct journal_info * info, patch_t * commit)
+{
+	patchdep_t * dep;
+	for(dep = info->wait->befores; dep; dep = dep->before.next)
+		if(dep->before.patch->flags & PATCH_DATA)
+		{
+			int r = patch_add_depend(commit, dep->before.patch);
+			if(r < 0)
+				return r;
+		}
+	return 0;
+}
+#endif
+
+static int journal_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct journal_info * info = (struct journal_info *) object;
+	return CALL(info->bd, read_ahead, number, count, nbdescs);
+}
+
 static void journal_bd_unlock_callback(void * data, int count);
 
+#if AVOID_STACKING_JOURNAL
+/* find the slot held by the oldest earlier transaction, or -1 if none is */
+static int journal_bd_oldest_slot(struct journal_info * info)
+{
+	int slot = -1;
+	uint16_t scan;
+	for(scan = 0; scan < info->cr_count; scan++)
+	{
+		if(!WEAK(info->cr_retain[scan].cr) || info->cr_retain[scan].seq == info->trans_seq)
+			continue;
+		if(slot < 0 || (int32_t) (info->cr_retain[scan].seq - info->cr_retain[slot].seq) < 0)
+			slot = scan;
+	}
+	return slot;
+}
+
+static uint16_t journal_bd_free_slots(struct journal_info * info)
+{
+	uint16_t scan, free = 0;
+	for(scan = 0; scan < info->cr_count; scan++)
+		if(!WEAK(info->cr_retain[scan].cr))
+			free++;
+	return free;
+}
+
+/* Push the oldest transaction toward disk without waiting for its writes to
+ * land, so that its slot is likely free by the time we need it. The slot's
+ * weak reference to the transaction's "done" patch frees it on landing. */
+static void journal_bd_drain_callback(void * data, int count)
+{
+	struct journal_info * info = (struct journal_info *) data;
+	int slot;
+	if(!info->cr_retain || journal_bd_free_slots(info) >= SLOT_LOW_WATER(info->cr_count))
+		return;
+	/* with an external journal, committing never flushes the home device,
+	 * so checkpoint everything there in one sorted pass instead */
+	if(info->external)
+	{
+		CALL(info->journal, flush, FLUSH_DEVICE, NULL);
+		CALL(info->bd, flush, FLUSH_DEVICE, NULL);
+		return;
+	}
+	slot = journal_bd_oldest_slot(info);
+	if(slot >= 0)
+		fstitch_push_patch(WEAK(info->cr_retain[slot].cr));
+}
+#endif
+
 static int journal_bd_grab_slot(BD_t * object)
 {
 	struct journal_info * info = (struct journal_info *) object;
 	uint16_t scan = info->trans_slot;
+#if AVOID_STACKING_JOURNAL
+	int oldest, r;
+#endif
 	
 	/* we must stay below the total size of the journal */
 	assert(info->trans_slot_count != info->cr_count);
@@ -221,6 +391,10 @@ static int journal_bd_grab_slot(BD_t * object)
 #if AVOID_STACKING_JOURNAL
 	for(;;)
 	{
+#if REVISION_TAIL_FLIGHTS
+		/* slots whose transactions have landed are free */
+		revision_tail_process_landing_requests();
+#endif
 #endif
 		do {
 			if(!WEAK(info->cr_retain[scan].cr) && info->cr_retain[scan].seq != info->trans_seq)
@@ -242,13 +416,22 @@ static int journal_bd_grab_slot(BD_t * object)
 				scan = 0;
 		} while(scan != info->trans_slot);
 #if AVOID_STACKING_JOURNAL
-		CALL(info->journal, flush, FLUSH_DEVICE, NULL);
-		CALL(info->bd, flush, FLUSH_DEVICE, NULL);
-#ifdef __KERNEL__
+		/* no slot is free: push the oldest transaction toward disk and
+		 * wait for its writes to land, which releases its slot. This
+		 * flushes only the blocks its "done" patch depends on. */
+		oldest = journal_bd_oldest_slot(info);
+		assert(oldest >= 0);
+		r = fstitch_push_patch(WEAK(info->cr_retain[oldest].cr));
+#if REVISION_TAIL_FLIGHTS
 		if(revision_tail_flights_exist())
+		{
 			revision_tail_wait_for_landing_requests();
+			r = 0;
+		}
 #endif
-		CALL(info->journal, flush, FLUSH_DEVICE, NULL);
+		if(r < 0)
+			return r;
+		scan = info->trans_slot;
 	}
 #else
 	/* we could not find an available slot, so start stacking */
@@ -305,11 +488,12 @@ static uint32_t journal_bd_lookup_block(BD_t * object, bdesc_t * block, uint32_t
 			Dprintf("%s(): writing subcommit record for slot %d (sequence %u) to journal block %u\n", __FUNCTION__, info->trans_slot, info->trans_seq, record_number);
 			
 			/* first write the subcommit record */
-			commit.magic = JOURNAL_MAGIC;
+			commit.magic = CR_MAGIC;
 			commit.type = CRSUBCOMMIT;
 			commit.next = info->prev_slot;
 			commit.nblocks = info->trans_data_blocks;
 			commit.seq = info->trans_seq;
+			commit.checksum = 0;
 			r = patch_create_byte(record, info->journal, 0, sizeof(commit), &commit, &head);
 			assert(r >= 0);
 			FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, head, "subcommit");
@@ -444,6 +628,7 @@ static int journal_bd_stop_transaction(BD_t * object)
 	struct journal_info * info = (struct journal_info *) object;
 	struct commit_record commit;
 	uint32_t block_number;
+	size_t blocks = hash_map_size(info->block_map);
 	bdesc_t * block;
 	patch_t * head;
 	int r;
@@ -463,28 +648,53 @@ static int journal_bd_stop_transaction(BD_t * object)
 	commit.magic = JOURNAL_MAGIC;
 	commit.type = CRCOMMIT;
 	commit.next = info->prev_slot;
-	commit.nblocks = hash_map_size(info->block_map) % info->trans_data_blocks;
+	/* the last slot is full, not empty, when the block count divides evenly */
+	commit.nblocks = blocks ? (blocks - 1) % info->trans_data_blocks + 1 : 0;
 	commit.seq = info->trans_seq++;
+	commit.checksum = 0;
 	/* skip 0 */
 	if(!info->trans_seq)
 		info->trans_seq = 1;
 	
 	/* create commit record, make it depend on wait */
 	head = info->wait;
+#if JOURNAL_CHECKSUM
+	/* unless we can checksum the transaction: then it need only follow the
+	 * previous transaction, and is written along with the journal data */
+	if(journal_bd_checksum(object, info->trans_slot, &commit, &commit.checksum) >= 0)
+	{
+		commit.magic = JOURNAL_CSUM_MAGIC;
+		head = WEAK(info->prev_cr);
+	}
+#endif
 	r = patch_create_byte(block, info->journal, 0, sizeof(commit), &commit, &head);
 	if(r < 0)
 		kpanic("Holy Mackerel!");
 	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, head, "commit");
+#if JOURNAL_CHECKSUM
+	if(commit.magic == JOURNAL_CSUM_MAGIC && journal_bd_order_commit(info, head) < 0)
+		kpanic("Holy Mackerel!");
+#endif
 	/* ...and make hold depend on it */
 	info->hold->flags |= PATCH_SAFE_AFTER;
 	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FLAGS, info->hold, PATCH_SAFE_AFTER);
 	r = patch_add_depend(info->hold, head);
 	if(r < 0)
 		kpanic("Holy Mackerel!");
+#if JOURNAL_CHECKSUM
+	/* the filesystem changes must still wait for all the journal data */
+	if(commit.magic == JOURNAL_CSUM_MAGIC)
+	{
+		r = patch_add_depend(info->hold, info->wait);
+		if(r < 0)
+			kpanic("Holy Mackerel!");
+	}
+#endif
 	info->hold->flags &= ~PATCH_SAFE_AFTER;
 	FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_CLEAR_FLAGS, info->hold, PATCH_SAFE_AFTER);
-	/* set the new previous commit record */
-	patch_weak_retain(head, &info->prev_cr, NULL, NULL);
+	/* set the new previous commit record: once the commit record no longer
+	 * implies the journal data is on disk, use hold, which does */
+	patch_weak_retain(commit.magic == JOURNAL_CSUM_MAGIC ? info->hold : head, &info->prev_cr, NULL, NULL);
 	
 	/* we no longer need hold -> prev_cancel */
 	if(WEAK(info->prev_cancel))
@@ -538,9 +748,39 @@ static int journal_bd_stop_transaction(BD_t * object)
 	if(++info->trans_slot == info->cr_count)
 		info->trans_slot = 0;
 	
+#if AVOID_STACKING_JOURNAL
+	if(journal_bd_free_slots(info) < SLOT_LOW_WATER(info->cr_count))
+		fstitchd_unlock_callback(journal_bd_drain_callback, object);
+#endif
+	
 	return 0;
 }
 
+/* Called when a sync commits the running transaction: track the average
+ * interval between syncs to set the transaction period. */
+static void journal_bd_note_sync(struct journal_info * info)
+{
+	int now = jiffy_time();
+	info->sync_interval = (3 * info->sync_interval + (now - info->last_sync)) / 4;
+	info->last_sync = now;
+}
+
+/* Commit in the background about halfway between syncs, so that the next
+ * sync has only half an interval of changes to write. A long silence since
+ * the last sync counts too, so the period grows when syncs stop. */
+static int journal_bd_period(struct journal_info * info)
+{
+	int interval = jiffy_time() - info->last_sync;
+	if(interval < info->sync_interval)
+		interval = info->sync_interval;
+	interval /= 2;
+	if(interval < TRANSACTION_PERIOD_MIN)
+		return TRANSACTION_PERIOD_MIN;
+	if(interval > TRANSACTION_PERIOD_MAX)
+		return TRANSACTION_PERIOD_MAX;
+	return interval;
+}
+
 /* We will register this callback to be called as soon as fstitchd_global_lock is
  * unlocked if the cache below us ever reports it is running out of room. We
  * will also register it if the size of the current transaction exceeds half the
@@ -665,6 +905,9 @@ static int journal_bd_write_block(BD_t * object, bdesc_t * block, uint32_t block
 				r = patch_add_depend(info->data, patch);
 				if(r < 0)
 					kpanic("Holy Mackerel!");
+				/* and can be recovered from the journal until then */
+				patch->flags |= PATCH_JOURNALED;
+				FSTITCH_DEBUG_SEND(FDB_MODULE_PATCH_ALTER, FDB_PATCH_SET_FLAGS, patch, PATCH_JOURNALED);
 			}
 			
 			while(*deps)
@@ -716,6 +959,8 @@ static int journal_bd_write_block(BD_t * object, bdesc_t * block, uint32_t block
 	{
 		bool fresh = 0;
 		patch_t * head;
+		if(!hash_map_size(info->block_map))
+			info->trans_start = jiffy_time();
 		number = journal_bd_lookup_block(object, block, block_number, &fresh);
 		assert(number != INVALID_BLOCK);
 		journal_block = CALL(info->journal, synthetic_read_block, number, 1, NULL);
@@ -773,6 +1018,11 @@ static int journal_bd_write_block(BD_t * object, bdesc_t * block, uint32_t block
 	return r;
 }
 
+static int journal_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int journal_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	struct journal_info * info = (struct journal_info *) object;
@@ -780,6 +1030,7 @@ static int journal_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 	{
 		if(journal_bd_stop_transaction(object) < 0)
 			return FLUSH_NONE;
+		journal_bd_note_sync(info);
 		/* FIXME: check return value here */
 		journal_bd_start_transaction(object);
 		return FLUSH_DONE;
@@ -803,7 +1054,7 @@ static void journal_bd_callback(void * arg)
 {
 	BD_t * object = (BD_t *) arg;
 	struct journal_info * info = (struct journal_info *) object;
-	if(info->keep_w && hash_map_size(info->block_map))
+	if(info->keep_w && hash_map_size(info->block_map) && jiffy_time() - info->trans_start >= journal_bd_period(info))
 	{
 		int r = journal_bd_stop_transaction(object);
 		if(r < 0 && r != -EBUSY)
@@ -856,264 +1107,304 @@ static int journal_bd_destroy(BD_t * bd)
 	return 0;
 }
 
-static int replay_single_transaction(BD_t * bd, uint32_t transaction_start, uint16_t expected_type)
+/* these macros are for the circular sequence number space */
+#define GT32(a, b) (((int32_t) ((a) - (b))) > 0)
+#define GE32(a, b) (((int32_t) ((a) - (b))) >= 0)
+#define LT32(a, b) (((int32_t) ((a) - (b))) < 0)
+#define LE32(a, b) (((int32_t) ((a) - (b))) <= 0)
+
+/* Replay works in three passes: find the committed transactions and sort them
+ * by sequence number, map each home block to its copy in the latest of them,
+ * and then write each home block just once, in block number order, so that
+ * the cache below can keep many of the writes in flight. */
+
+static int replay_seq_compare(const void * a, const void * b)
+{
+	const struct journal_slot * x = *(const struct journal_slot **) a;
+	const struct journal_slot * y = *(const struct journal_slot **) b;
+	if(LT32(x->seq, y->seq))
+		return -1;
+	return GT32(x->seq, y->seq);
+}
+
+static int replay_number_compare(const void * a, const void * b)
+{
+	uint32_t x = (uint32_t) *(void * const *) a;
+	uint32_t y = (uint32_t) *(void * const *) b;
+	if(x < y)
+		return -1;
+	return x > y;
+}
+
+/* Check the committed transaction in 'slot' and map the home blocks in each
+ * slot of its chain to their journal copies, replacing copies from earlier
+ * transactions. Returns 1 if it was mapped, or 0 if it is invalid. */
+static int replay_map_transaction(BD_t * bd, uint16_t slot, uint32_t * nmapped)
 {
 	struct journal_info * info = (struct journal_info *) bd;
-	patch_t * head = NULL;
-	int r = -ENOMEM;
-	
 	const uint32_t bnpb = numbers_per_block(bd->blocksize);
-	const uint32_t transaction_number = transaction_start / info->trans_total_blocks;
-	
-	uint32_t block, bnb, db;
-	struct commit_record * cr;
-	bdesc_t * commit_block = CALL(info->journal, read_block, transaction_start, 1, NULL);
+	struct commit_record record;
+	uint16_t count = 0;
+	bdesc_t * block;
 	
-	if(!commit_block)
+	block = CALL(info->journal, read_block, slot * info->trans_total_blocks, 1, NULL);
+	if(!block)
 		return -1;
-	
-	cr = (struct commit_record *) bdesc_data(commit_block);
-	if(cr->magic != JOURNAL_MAGIC || cr->type != expected_type)
-	{
-		printf("%s(): journal subtransaction %d signature mismatch! (0x%08x:%d)\n", __FUNCTION__, transaction_number, cr->magic, cr->type);
-		return 0;
-	}
-	
-	/* make sure our block doesn't go anywhere for a while */
-	bdesc_autorelease(bdesc_retain(commit_block));
-	
-	if(expected_type == CRCOMMIT)
+	record = *(struct commit_record *) bdesc_data(block);
+	if(record.magic == JOURNAL_CSUM_MAGIC)
 	{
-		/* create the three EMPTYs we will need for this chain */
-		r = patch_create_empty_list(NULL, &info->keep_d, NULL);
-		if(r < 0)
-			goto error_1;
-		FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, info->keep_d, "keep_d");
-		patch_claim_empty(info->keep_d);
-		/* make the new complete record (via data) depend on the previous via info->prev_cancel */
-		r = patch_create_empty_list(NULL, &info->data, info->keep_d, WEAK(info->prev_cancel), NULL);
-		if(r < 0)
-			goto error_2;
-		FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, info->data, "data");
-		r = patch_create_empty_list(NULL, &info->done, NULL);
-		if(r < 0)
-		{
-			patch_destroy(&info->data);
-		error_2:
-			patch_destroy(&info->keep_d);
-		error_1:
+		uint32_t checksum;
+		int r = journal_bd_checksum(bd, slot, &record, &checksum);
+		if(r == -ENOMEM)
 			return r;
+		if(r < 0 || checksum != record.checksum)
+		{
+			/* the commit record was written, but not all of the
+			 * journal data: nothing was written in place yet */
+			printf("%s(): journal transaction %d checksum mismatch, skipping\n", __FUNCTION__, slot);
+			return 0;
 		}
-		FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, info->done, "done");
-		patch_claim_empty(info->done);
 	}
 	
-	/* check for chained transaction */
-	block = cr->next * info->trans_total_blocks;
-	if(block != transaction_start)
-	{
-		/* expect a CRSUBCOMMIT as the next element */
-		r = replay_single_transaction(bd, block, CRSUBCOMMIT);
-		if(r < 0)
-			return r;
-	}
-	
-	Dprintf("%s(): recovering journal subtransaction %d (%d data blocks, sequence %u)\n", __FUNCTION__, transaction_number, cr->nblocks, cr->seq);
-	
-	/* bnb is "block number block" number */
-	bnb = transaction_start + 1;
-	/* db is "data block" number */
-	db = bnb + trans_number_block_count(bd->blocksize);
-	Dprintf("%s(): first number block %u, first journal block %u\n", __FUNCTION__, bnb, db);
-	for(block = 0; block < cr->nblocks; block += bnpb)
+	for(;;)
 	{
-		uint32_t index, max = MIN(bnpb, cr->nblocks - block);
-		bdesc_t * number_block;
-		uint32_t * numbers;
-		
-		Dprintf("%s(): using number block %u (max = %d, bnpb = %d)\n", __FUNCTION__, bnb, max, bnpb);
-		number_block = CALL(info->journal, read_block, bnb++, 1, NULL);
-		if(!number_block)
-			return -1;
-		bdesc_retain(number_block);
+		/* bnb is "block number block" number */
+		uint32_t bnb = slot * info->trans_total_blocks + 1;
+		/* db is "data block" number */
+		uint32_t db = bnb + trans_number_block_count(bd->blocksize);
+		uint32_t index;
 		
-		numbers = (uint32_t *) bdesc_data(number_block);
-		for(index = 0; index != max; index++)
+		Dprintf("%s(): mapping journal subtransaction %d (%d data blocks, sequence %u)\n", __FUNCTION__, slot, record.nblocks, record.seq);
+		/* the data will be read in home block order: start reading it now */
+		if(record.nblocks)
+			CALL(info->journal, read_ahead, db, 1, record.nblocks);
+		for(index = 0; index < record.nblocks; index++)
 		{
-			bdesc_t * output;
-			bdesc_t * data_block;
-			
-			Dprintf("%s(): recovering journal block %u -> data block %u\n", __FUNCTION__, db, numbers[index]);
-			data_block = CALL(info->journal, read_block, db++, 1, NULL);
-			r = -1;
-			if(!data_block)
-				goto data_error;
-			bdesc_retain(data_block);
-			
-			output = CALL(info->bd, synthetic_read_block, numbers[index], 1, NULL);
-			if(!output)
-				goto output_error;
-			
-			head = NULL;
-			r = patch_create_full(output, info->bd, bdesc_data(data_block), &head);
-			if(r < 0)
-				goto output_error;
-			r = patch_add_depend(info->data, head);
-			if(r < 0)
-				goto patch_error;
-			r = CALL(info->bd, write_block, output, numbers[index]);
+			uint32_t * numbers;
+			int r;
+			if(!(index % bnpb))
+			{
+				block = CALL(info->journal, read_block, bnb++, 1, NULL);
+				if(!block)
+					return -1;
+			}
+			numbers = (uint32_t *) bdesc_data(block);
+			r = hash_map_insert(info->block_map, (void *) numbers[index % bnpb], (void *) (db + index));
 			if(r < 0)
-				goto patch_error;
-			bdesc_release(&data_block);
-			continue;
-			
-		patch_error:
-			/* FIXME clean up patches */
-			assert(0);
-		output_error:
-			bdesc_release(&data_block);
-		data_error:
-			bdesc_release(&number_block);
-			return r;
+				return r;
 		}
+		*nmapped += record.nblocks;
+		
+		patch_weak_retain(info->done, &info->cr_retain[slot].cr, NULL, NULL);
+		info->cr_retain[slot].seq = record.seq;
 		
-		bdesc_release(&number_block);
+		/* check for chained transaction */
+		if(record.next == slot || ++count == info->cr_count)
+			break;
+		slot = record.next;
+		block = CALL(info->journal, read_block, slot * info->trans_total_blocks, 1, NULL);
+		if(!block)
+			return -1;
+		record = *(struct commit_record *) bdesc_data(block);
+		if(!CR_MAGIC_OK(record.magic) || record.type != CRSUBCOMMIT)
+		{
+			printf("%s(): journal subtransaction %d signature mismatch! (0x%08x:%d)\n", __FUNCTION__, slot, record.magic, record.type);
+			break;
+		}
 	}
 	
-	patch_weak_retain(info->done, &info->cr_retain[transaction_start / info->trans_total_blocks].cr, NULL, NULL);
-	info->cr_retain[transaction_start / info->trans_total_blocks].seq = cr->seq;
+	return 1;
+}
+
+/* write the latest journal copy of home block 'number' */
+static int replay_block(BD_t * bd, uint32_t number, uint32_t journal_number)
+{
+	struct journal_info * info = (struct journal_info *) bd;
+	bdesc_t * data_block;
+	bdesc_t * output;
+	patch_t * head = NULL;
+	int r = -1;
 	
-	/* only CRCOMMIT records need to be cancelled */
-	if(cr->type == CRCOMMIT)
-	{
-		typeof(cr->type) empty = CREMPTY;
-		head = info->data;
-		r = patch_create_byte_atomic(commit_block, info->journal, (uint16_t) &((struct commit_record *) NULL)->type, sizeof(cr->type), &empty, &head);
-		if(r < 0)
-			kpanic("Holy Mackerel!");
-		FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, head, "complete");
-		r = patch_add_depend(info->done, head);
-		if(r < 0)
-			kpanic("Holy Mackerel!");
-		/* set the new previous cancellation record */
-		patch_weak_retain(head, &info->prev_cancel, NULL, NULL);
-		/* clean up the transaction state */
-		patch_satisfy(&info->keep_d);
-		info->data = NULL;
-		info->done = NULL;
-		/* and write it to disk */
-		info->recursion = 1;
-		info->write_head = NULL;
-		r = CALL(info->journal, write_block, commit_block, transaction_start);
-		info->write_head = info->hold;
-		info->recursion = 0;
-		if(r < 0)
-			kpanic("Holy Mackerel!");
-	}
+	Dprintf("%s(): recovering journal block %u -> data block %u\n", __FUNCTION__, journal_number, number);
+	data_block = CALL(info->journal, read_block, journal_number, 1, NULL);
+	if(!data_block)
+		return -1;
+	bdesc_retain(data_block);
 	
-	return 0;
+	output = CALL(info->bd, synthetic_read_block, number, 1, NULL);
+	if(!output)
+		goto out;
+	r = patch_create_full(output, info->bd, bdesc_data(data_block), &head);
+	if(r < 0)
+		goto out;
+	r = patch_add_depend(info->data, head);
+	/* FIXME clean up patches */
+	assert(r >= 0);
+	r = CALL(info->bd, write_block, output, number);
+	assert(r >= 0);
+out:
+	bdesc_release(&data_block);
+	return r;
 }
 
-/* these macros are for the circular sequence number space */
-#define GT32(a, b) (((int32_t) ((a) - (b))) > 0)
-#define GE32(a, b) (((int32_t) ((a) - (b))) >= 0)
-#define LT32(a, b) (((int32_t) ((a) - (b))) < 0)
-#define LE32(a, b) (((int32_t) ((a) - (b))) <= 0)
-
 static int replay_journal(BD_t * bd)
 {
 	struct journal_info * info = (struct journal_info *) bd;
-	uint32_t transaction;
-	uint32_t min_trans = 0;
-	uint32_t min_idx = 0;
-	uint16_t recover_count = 0;
+	const int start = jiffy_time();
+	vector_t * transactions;
+	vector_t * blocks = NULL;
+	uint32_t nmapped = 0, skipped = 0;
+	hash_map_it2_t it;
+	uint16_t slot;
+	size_t i;
+	int r = -ENOMEM;
 	
-	for(transaction = 0; transaction < info->cr_count; transaction++)
+	transactions = vector_create();
+	if(!transactions)
+		return -ENOMEM;
+	
+	for(slot = 0; slot < info->cr_count; slot++)
 	{
 		struct commit_record * cr;
-		uint32_t commit_block_number = transaction * info->trans_total_blocks;
+		uint32_t commit_block_number = slot * info->trans_total_blocks;
 		bdesc_t * commit_block = CALL(info->journal, read_block, commit_block_number, 1, NULL);
 		
 		if(!commit_block)
-			return -1;
+		{
+			r = -1;
+			goto out;
+		}
 		
-		Dprintf("%s(): slot %d commit record on journal block %u\n", __FUNCTION__, transaction, commit_block_number);
+		Dprintf("%s(): slot %d commit record on journal block %u\n", __FUNCTION__, slot, commit_block_number);
 		cr = (struct commit_record *) bdesc_data(commit_block);
-		if(cr->magic != JOURNAL_MAGIC || cr->type != CRCOMMIT)
+		if(!CR_MAGIC_OK(cr->magic) || cr->type != CRCOMMIT)
 			continue;
-		Dprintf("%s(): transaction %d (sequence %u) will be recovered\n", __FUNCTION__, transaction, cr->seq);
+		Dprintf("%s(): transaction %d (sequence %u) will be recovered\n", __FUNCTION__, slot, cr->seq);
 		
-		recover_count++;
-		info->cr_retain[transaction].seq = cr->seq;
-		if(!min_trans || LT32(cr->seq, min_trans))
-		{
-			min_trans = cr->seq;
-			min_idx = transaction;
-		}
+		info->cr_retain[slot].seq = cr->seq;
+		r = vector_push_back(transactions, &info->cr_retain[slot]);
+		if(r < 0)
+			goto out;
+	}
+	printf("%s(): %u transactions will be recovered\n", __FUNCTION__, (uint32_t) vector_size(transactions));
+	r = 0;
+	if(vector_empty(transactions))
+		goto out;
+	vector_sort(transactions, replay_seq_compare);
+	
+	/* one set of EMPTYs covers the whole replay */
+	r = patch_create_empty_list(NULL, &info->keep_d, NULL);
+	if(r < 0)
+		goto out;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, info->keep_d, "keep_d");
+	patch_claim_empty(info->keep_d);
+	r = patch_create_empty_list(NULL, &info->data, info->keep_d, WEAK(info->prev_cancel), NULL);
+	if(r < 0)
+	{
+		patch_destroy(&info->keep_d);
+		goto out;
 	}
-	printf("%s(): %d transactions will be recovered\n", __FUNCTION__, recover_count);
+	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, info->data, "data");
+	r = patch_create_empty_list(NULL, &info->done, NULL);
+	if(r < 0)
+	{
+		patch_destroy(&info->data);
+		patch_destroy(&info->keep_d);
+		goto out;
+	}
+	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, info->done, "done");
+	patch_claim_empty(info->done);
 	
-	transaction = min_idx;
-	while(recover_count)
+	/* map each home block to its latest journal copy */
+	for(i = 0; i < vector_size(transactions); i++)
 	{
-		printf("%s(): request recovery of transaction %d (%d left)\n", __FUNCTION__, transaction, recover_count - 1);
-		int r = replay_single_transaction(bd, transaction * info->trans_total_blocks, CRCOMMIT);
+		slot = (struct journal_slot *) vector_elt(transactions, i) - info->cr_retain;
+		r = replay_map_transaction(bd, slot, &nmapped);
 		if(r < 0)
+			goto fail;
+		if(!r)
 		{
-			if(info->keep_w)
-			{
-				patch_satisfy(&info->keep_w);
-				patch_satisfy(&info->keep_d);
-				info->data = NULL;
-				if(!info->done->befores)
-					patch_satisfy(&info->done);
-				else
-					info->done = NULL;
-			}
-			return r;
-		}
-		if(--recover_count)
-		{
-			uint32_t scan = transaction + 1;
-			uint32_t next_seq = info->cr_retain[transaction].seq + 1;
-			if(scan == info->cr_count)
-				scan = 0;
-			/* skip 0 */
-			if(!next_seq)
-				next_seq = 1;
-			if(info->cr_retain[scan].seq != next_seq)
-			{
-				/* FIXME: this case will generally always happen, and is O(n^2) */
-				min_trans = 0;
-				/* find lowest remaining sequence number */
-				while(scan != transaction)
-				{
-					if(info->cr_retain[scan].seq && GT32(info->cr_retain[scan].seq, info->cr_retain[transaction].seq))
-					{
-						if(!min_trans || LT32(info->cr_retain[scan].seq, min_trans))
-						{
-							min_trans = info->cr_retain[scan].seq;
-							min_idx = scan;
-						}
-					}
-					if(++scan == info->cr_count)
-						scan = 0;
-				}
-				assert(min_trans);
-				transaction = min_idx;
-			}
-			else
-				transaction = scan;
+			/* keep its slot until it is cancelled below */
+			patch_weak_retain(info->done, &info->cr_retain[slot].cr, NULL, NULL);
+			skipped++;
 		}
-		else
+	}
+	
+	/* write each home block once, in block number order */
+	blocks = vector_create();
+	if(!blocks || vector_reserve(blocks, hash_map_size(info->block_map)) < 0)
+	{
+		r = -ENOMEM;
+		goto fail;
+	}
+	it = hash_map_it2_create(info->block_map);
+	while(hash_map_it2_next(&it))
+		vector_push_back(blocks, it.key);
+	vector_sort(blocks, replay_number_compare);
+	for(i = 0; i < vector_size(blocks); i++)
+	{
+		uint32_t number = (uint32_t) vector_elt(blocks, i);
+		r = replay_block(bd, number, (uint32_t) hash_map_find_val(info->block_map, (void *) number));
+		if(r < 0)
+			goto fail;
+	}
+	
+	/* cancel every commit record once all of that is on disk, including
+	 * those with bad checksums so they are not considered again */
+	for(i = 0; i < vector_size(transactions); i++)
+	{
+		typeof(((struct commit_record *) NULL)->type) empty = CREMPTY;
+		uint32_t commit_block_number;
+		bdesc_t * commit_block;
+		patch_t * head = info->data;
+		
+		slot = (struct journal_slot *) vector_elt(transactions, i) - info->cr_retain;
+		commit_block_number = slot * info->trans_total_blocks;
+		commit_block = CALL(info->journal, read_block, commit_block_number, 1, NULL);
+		if(!commit_block)
 		{
-			info->trans_seq = min_trans + 1;
-			if(!info->trans_seq)
-				info->trans_seq = 1;
+			r = -1;
+			goto fail;
 		}
+		r = patch_create_byte_atomic(commit_block, info->journal, (uint16_t) &((struct commit_record *) NULL)->type, sizeof(empty), &empty, &head);
+		if(r < 0)
+			kpanic("Holy Mackerel!");
+		FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, head, "complete");
+		r = patch_add_depend(info->done, head);
+		if(r < 0)
+			kpanic("Holy Mackerel!");
+		/* and write it to disk */
+		info->recursion = 1;
+		info->write_head = NULL;
+		r = CALL(info->journal, write_block, commit_block, commit_block_number);
+		info->write_head = info->hold;
+		info->recursion = 0;
+		if(r < 0)
+			kpanic("Holy Mackerel!");
 	}
 	
-	return 0;
+	/* the next transaction follows all of the cancellations */
+	patch_weak_retain(info->done, &info->prev_cancel, NULL, NULL);
+	info->trans_seq = ((struct journal_slot *) vector_elt_end(transactions))->seq + 1;
+	/* skip 0 */
+	if(!info->trans_seq)
+		info->trans_seq = 1;
+	printf("%s(): recovered %u transactions (%u skipped), %u journal blocks to %u home blocks in %d ms\n", __FUNCTION__, (uint32_t) vector_size(transactions) - skipped, skipped, nmapped, (uint32_t) vector_size(blocks), (jiffy_time() - start) * 1000 / HZ);
+	r = 0;
+	
+fail:
+	hash_map_clear(info->block_map);
+	patch_satisfy(&info->keep_d);
+	info->data = NULL;
+	if(!info->done->befores)
+		patch_satisfy(&info->done);
+	else
+		info->done = NULL;
+out:
+	if(blocks)
+		vector_destroy(blocks);
+	vector_destroy(transactions);
+	return r;
 }
 
 BD_t * journal_bd(BD_t * disk, uint8_t only_metadata)
@@ -1161,6 +1452,10 @@ BD_t * journal_bd(BD_t * disk, uint8_t only_metadata)
 	info->cr_retain = NULL;
 	info->recursion = 0;
 	info->only_metadata = only_metadata;
+	info->external = 0;
+	info->trans_start = jiffy_time();
+	info->last_sync = info->trans_start;
+	info->sync_interval = 2 * TRANSACTION_PERIOD_MAX;
 	bd->level = disk->level;
 	bd->graph_index = disk->graph_index + 1;
 	if(bd->graph_index >= NBDINDEX)
@@ -1177,7 +1472,7 @@ BD_t * journal_bd(BD_t * disk, uint8_t only_metadata)
 	}
 	
 	/* set up transaction callback */
-	if(sched_register(journal_bd_callback, bd, TRANSACTION_PERIOD) < 0)
+	if(sched_register(journal_bd_callback, bd, TRANSACTION_TICK) < 0)
 	{
 		DESTROY(bd);
 		return NULL;
@@ -1268,6 +1563,8 @@ int journal_bd_set_journal(BD_t * bd, BD_t * journal)
 		return -EINVAL;
 	
 	info->journal = journal;
+	/* an internal journal is a file above us in the graph */
+	info->external = journal->graph_index < bd->graph_index;
 	
 	info->cr_count = journal->numblocks / info->trans_total_blocks;
 	if(info->cr_count < 3)
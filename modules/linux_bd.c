@@ -68,6 +68,8 @@ static struct dentry * debug_writes_dentry;
 #endif
 
 #define LINUX_BLOCKSIZE 512
+/* maximum number of blocks (bio segments) in one vectored write */
+#define LINUX_MAX_RUN 32
 
 struct linux_info {
 	BD_t bd;
@@ -96,6 +98,8 @@ struct linux_bio_private {
 	int need_blockman;
 	uint32_t number;
 	uint32_t nbytes;
+	/* the next block in the same (write) bio */
+	struct linux_bio_private * next;
 #if DEBUG_WRITES
 	uint32_t issue;
 #endif
@@ -132,21 +136,30 @@ static int linux_bd_end_io(struct bio * bio, unsigned int done, int error)
 	KDprintk(KERN_ERR "[%d] done w/ bio transfer 2\n", private->seq);
 	
 #if DEBUG_WRITES
-	if(dir == WRITE && private->issue < MAXWRITES)
+	if(dir == WRITE)
 	{
-		struct bio_vec * bv = bio_iovec_idx(bio, 0);
-		struct linux_bd_write * write = &debug_writes.writes[private->issue];
-		uint32_t pre_checksum = write->checksum;
-		uint32_t post_checksum = block_checksum(page_address(bv->bv_page), bv->bv_len);
-		if(pre_checksum != post_checksum)
-			printk("pre- (0x%x) and post-write (0x%x) checksums differ for write %d (block %u)\n", pre_checksum, post_checksum, private->issue, write->blockno);
-		write->completed = debug_writes_completed++;
-		if(write->blockno < MAXBLOCKNO)
-			atomic_dec(&debug_writes_ninflight[write->blockno]);
+		struct linux_bio_private * segment = private;
+		for(i = 0; segment; segment = segment->next, i++)
+		{
+			struct bio_vec * bv;
+			struct linux_bd_write * write;
+			uint32_t pre_checksum, post_checksum;
+			if(segment->issue >= MAXWRITES)
+				continue;
+			bv = bio_iovec_idx(bio, i);
+			write = &debug_writes.writes[segment->issue];
+			pre_checksum = write->checksum;
+			post_checksum = block_checksum(page_address(bv->bv_page), bv->bv_len);
+			if(pre_checksum != post_checksum)
+				printk("pre- (0x%x) and post-write (0x%x) checksums differ for write %d (block %u)\n", pre_checksum, post_checksum, segment->issue, write->blockno);
+			write->completed = debug_writes_completed++;
+			if(write->blockno < MAXBLOCKNO)
+				atomic_dec(&debug_writes_ninflight[write->blockno]);
+		}
 	}
 #endif
 	
-	assert(bio->bi_vcnt == 1);
+	assert(dir == WRITE || bio->bi_vcnt == 1);
 	assert(private->bdesc);
 	for(i = 0; i < bio->bi_vcnt; i++)
 	{
@@ -174,10 +187,13 @@ static int linux_bd_end_io(struct bio * bio, unsigned int done, int error)
 	if(dir == READ)
 		private->bdesc->synthetic = 0;
 	else if(dir == WRITE)
-	{
-		revision_tail_request_landing(private->bdesc);
-		bio_private_free(private);
-	}
+		while(private)
+		{
+			struct linux_bio_private * next = private->next;
+			revision_tail_request_landing(private->bdesc);
+			bio_private_free(private);
+			private = next;
+		}
 	bio_put(bio);
 	
 	if(dir == READ)
@@ -306,6 +322,7 @@ static bdesc_t * linux_bd_read_block(BD_t * object, uint32_t number, uint16_t co
 		private[i].bdesc = blocks[i];
 		private[i].number = i_number;
 		private[i].nbytes = count * LINUX_BLOCKSIZE;
+		private[i].next = NULL;
 #if DEBUG_LINUX_BD
 		private[i].seq = info->seq++;
 #endif
@@ -401,14 +418,22 @@ static bdesc_t * linux_bd_synthetic_read_block(BD_t * object, uint32_t number, u
 	return bdesc;
 }
 
-static int linux_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
+static int linux_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	/* linux_bd_read_block() already reads ahead READ_AHEAD_COUNT blocks */
+	return 0;
+}
+
+static int linux_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
 {
-	DEFINE_WAIT(wait);
 	struct linux_info * info = (struct linux_info *) object;
 	struct bio * bio;
-	struct bio_vec * bv;
-	int r, revision_back;
-	struct linux_bio_private * private;
+	struct linux_bio_private * privates = NULL;
+	struct linux_bio_private ** tail = &privates;
+	int revision_back[LINUX_MAX_RUN];
+	uint32_t block_number = number;
+	uint32_t size = 0;
+	int i, r;
 	KERNEL_INTERVAL(write);
 	
 #if RANDOM_REBOOT
@@ -419,68 +444,95 @@ static int linux_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 		emergency_restart();
 	}
 #endif
-
-	KDprintk(KERN_ERR "entered write (blk: %d, cnt: %d)\n", number, block->length / LINUX_BLOCKSIZE);
-	assert(number < object->numblocks);
 	
-	private = bio_private_alloc();
-	assert(private);
+	if(count > LINUX_MAX_RUN)
+		count = LINUX_MAX_RUN;
+	KDprintk(KERN_ERR "entered write (blk: %d, run: %d)\n", number, count);
 	
-	assert(block->length <= PAGE_SIZE);
+	for(i = 0; i < count; i++)
+		if(blocks[i]->in_flight)
+		{
+			KERNEL_INTERVAL(wait);
+			TIMING_START(wait);
+			while(blocks[i]->in_flight)
+			{
+				revision_tail_wait_for_landing_requests();
+				revision_tail_process_landing_requests();
+			}
+			TIMING_STOP(wait, wait);
+		}
 	
-	bio = bio_alloc(GFP_KERNEL, 1);
+	bio = bio_alloc(GFP_KERNEL, count);
 	assert(bio);
 	
-	bv = bio_iovec_idx(bio, 0);
-	bv->bv_page = alloc_page(GFP_KERNEL);
-	assert(bv->bv_page);
-	bv->bv_len = block->length;
-	bv->bv_offset = 0;
-	
 	KDprintk(KERN_ERR "starting real work for the write\n");
 	
+	for(i = 0; i < count; i++)
+	{
+		bdesc_t * block = blocks[i];
+		struct bio_vec * bv = bio_iovec_idx(bio, i);
+		struct linux_bio_private * private;
+		
+		assert(block_number < object->numblocks);
+		assert(block->length <= PAGE_SIZE);
+		
+		private = bio_private_alloc();
+		assert(private);
+		
+		bv->bv_page = alloc_page(GFP_KERNEL);
+		assert(bv->bv_page);
+		bv->bv_len = block->length;
+		bv->bv_offset = 0;
+		
 #if REVISION_TAIL_INPLACE
-	revision_back = revision_tail_prepare(block, object);
-	assert(revision_back >= 0);
-	memcpy(page_address(bv->bv_page), bdesc_data(block), block->length);
+		revision_back[i] = revision_tail_prepare(block, object);
+		assert(revision_back[i] >= 0);
+		memcpy(page_address(bv->bv_page), bdesc_data(block), block->length);
 #else
-	revision_back = revision_tail_prepare(block, object, page_address(bv->bv_page));
-	assert(revision_back >= 0);
+		revision_back[i] = revision_tail_prepare(block, object, page_address(bv->bv_page));
+		assert(revision_back[i] >= 0);
 #endif
-	
+		
 #if DEBUG_WRITES
-	private->issue = debug_writes.next;
-	if(debug_writes.next < MAXWRITES)
-	{
-		struct linux_bd_write * write = &debug_writes.writes[debug_writes.next];
-		write->blockno = number;
-		write->checksum = block_checksum(page_address(bv->bv_page), block->length);
-		/* NOTE: ninflight may overcount as any inflight writes could complete before we actually make the request below... */
-		if(number < MAXBLOCKNO)
-			write->ninflight = atomic_inc_return(&debug_writes_ninflight[number]) - 1;
-		else
-			write->ninflight = -1;
-		debug_writes.next++;
-	}
-	else if(debug_writes.next == MAXWRITES)
-	{
-		printk("linux_bd: number of writes has exceeded maximum supported by debugging (%u)\n", MAXWRITES);
-		debug_writes.next++;
-	}
+		private->issue = debug_writes.next;
+		if(debug_writes.next < MAXWRITES)
+		{
+			struct linux_bd_write * write = &debug_writes.writes[debug_writes.next];
+			write->blockno = block_number;
+			write->checksum = block_checksum(page_address(bv->bv_page), block->length);
+			/* NOTE: ninflight may overcount as any inflight writes could complete before we actually make the request below... */
+			if(block_number < MAXBLOCKNO)
+				write->ninflight = atomic_inc_return(&debug_writes_ninflight[block_number]) - 1;
+			else
+				write->ninflight = -1;
+			debug_writes.next++;
+		}
+		else if(debug_writes.next == MAXWRITES)
+		{
+			printk("linux_bd: number of writes has exceeded maximum supported by debugging (%u)\n", MAXWRITES);
+			debug_writes.next++;
+		}
 #endif
-	
-	private->info = info;
-	private->bdesc = block;
-	private->number = number;
-	private->nbytes = block->length;
+		
+		private->info = info;
+		private->bdesc = block;
+		private->number = block_number;
+		private->nbytes = block->length;
+		private->next = NULL;
 #if DEBUG_LINUX_BD
-	private->seq = info->seq++;
+		private->seq = info->seq++;
 #endif
+		*tail = private;
+		tail = &private->next;
+		
+		size += block->length;
+		block_number += block->length / LINUX_BLOCKSIZE;
+	}
 	
 	bio->bi_idx = 0;
-	bio->bi_vcnt = 1;
+	bio->bi_vcnt = count;
 	bio->bi_sector = number;
-	bio->bi_size = block->length;
+	bio->bi_size = size;
 	bio->bi_bdev = info->bdev;
 #if ALLOW_UNSAFE_DISK_CACHE
 	bio->bi_rw = WRITE | info->fua;
@@ -488,42 +540,45 @@ static int linux_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 	bio->bi_rw = WRITE | (1 << BIO_RW_FUA);
 #endif
 	bio->bi_end_io = linux_bd_end_io;
-	bio->bi_private = private;
+	bio->bi_private = privates;
 	
-	if(block->in_flight)
+	/* one flight per block: each block requests its own landing */
+	for(i = 0; i < count; i++)
 	{
-		KERNEL_INTERVAL(wait);
-		TIMING_START(wait);
-		while(block->in_flight)
-		{
-			revision_tail_wait_for_landing_requests();
-			revision_tail_process_landing_requests();
-		}
-		TIMING_STOP(wait, wait);
+		r = revision_tail_schedule_flight();
+		assert(!r);
 	}
-	
-	r = revision_tail_schedule_flight();
-	assert(!r);
 	atomic_inc(&info->outstanding_io_count);
 	
-	KDprintk(KERN_ERR "issuing DMA write request [%d]\n", private->seq);
+	KDprintk(KERN_ERR "issuing DMA write request [%d]\n", privates->seq);
 	TIMING_START(write);
 	generic_make_request(bio);
 	
 	TIMING_STOP(write, write);
 	
-	r = revision_tail_inflight_ack(block, object);
-	if(r < 0)
+	block_number = number;
+	for(i = 0; i < count; i++)
 	{
-		kpanic("revision_tail_acknowledge gave error: %i\n", r);
-		return r;
+		r = revision_tail_inflight_ack(blocks[i], object);
+		if(r < 0)
+		{
+			kpanic("revision_tail_acknowledge gave error: %i\n", r);
+			return r;
+		}
+		
+		if(revision_back[i] != r)
+			printk("%s(): block %u: revision_back (%d) != revision_forward (%d)\n", __FUNCTION__, block_number, revision_back[i], r);
+		block_number += blocks[i]->length / LINUX_BLOCKSIZE;
 	}
 	
-	if(revision_back != r)
-		printk("%s(): block %u: revision_back (%d) != revision_forward (%d)\n", __FUNCTION__, number, revision_back, r);
-	
 	KDprintk(KERN_ERR "exiting write\n");
-	return 0;
+	return count;
+}
+
+static int linux_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
+{
+	int r = linux_bd_write_blocks(object, &block, 1, number);
+	return (r < 0) ? r : 0;
 }
 
 static int linux_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
@@ -61,6 +61,12 @@ static bdesc_t * loop_synthetic_read_block(BD_t * bd, uint32_t number, uint16_t
 	return CALL(info->lfs, synthetic_lookup_block, lfs_bno, page);
 }
 
+static int loop_read_ahead(BD_t * bd, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	/* loop blocks need not be contiguous in the underlying file */
+	return 0;
+}
+
 static int loop_write_block(BD_t * bd, bdesc_t * block, uint32_t loop_number)
 {
 	Dprintf("%s(0x%08x)\n", __FUNCTION__, block);
@@ -84,6 +90,11 @@ static int loop_write_block(BD_t * bd, bdesc_t * block, uint32_t loop_number)
 	return r;
 }
 
+static int loop_write_blocks(BD_t * bd, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(bd, blocks, count, number);
+}
+
 static int loop_flush(BD_t * bd, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
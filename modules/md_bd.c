@@ -37,6 +37,12 @@ static bdesc_t * md_bd_synthetic_read_block(BD_t * object, uint32_t number, uint
 	return CALL(info->bd[number & 1], synthetic_read_block, number >> 1, count, page);
 }
 
+static int md_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	/* consecutive blocks are striped across both devices */
+	return 0;
+}
+
 static int md_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct md_info * info = (struct md_info *) object;
@@ -54,6 +60,11 @@ static int md_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 	return CALL(info->bd[number & 1], write_block, block, number >> 1);
 }
 
+static int md_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int md_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
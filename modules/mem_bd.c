@@ -68,6 +68,11 @@ static bdesc_t * mem_bd_synthetic_read_block(BD_t * object, uint32_t number, uin
 	return mem_bd_read_block(object, number, count, page);
 }
 
+static int mem_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	return 0;
+}
+
 static int mem_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct mem_info * info = (struct mem_info *) object;
@@ -106,6 +111,11 @@ static int mem_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 	return 0;
 }
 
+static int mem_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int mem_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
@@ -38,6 +38,16 @@ static bdesc_t * partition_bd_synthetic_read_block(BD_t * object, uint32_t numbe
 	return CALL(info->bd, synthetic_read_block, info->start + number, count, page);
 }
 
+static int partition_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct partition_info * info = (struct partition_info *) object;
+	
+	/* make sure it's a valid block */
+	assert(count && number + count * nbdescs <= object->numblocks);
+	
+	return CALL(info->bd, read_ahead, info->start + number, count, nbdescs);
+}
+
 static int partition_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct partition_info * info = (struct partition_info *) object;
@@ -55,6 +65,35 @@ static int partition_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 	return CALL(info->bd, write_block, block, number + info->start);
 }
 
+static int partition_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	struct partition_info * info = (struct partition_info *) object;
+	uint32_t end = number;
+	uint16_t i;
+	int value;
+	
+	for(i = 0; i < count; i++)
+	{
+		/* this should never fail */
+		value = patch_push_down(blocks[i], object, info->bd);
+		if(value < 0)
+		{
+			if(!i)
+				return value;
+			/* write the blocks we did push down */
+			count = i;
+			break;
+		}
+		end += blocks[i]->length / object->blocksize;
+	}
+	
+	/* make sure it's a valid run */
+	assert(count && end <= object->numblocks);
+	
+	/* write them */
+	return CALL(info->bd, write_blocks, blocks, count, number + info->start);
+}
+
 static int partition_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
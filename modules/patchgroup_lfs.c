@@ -80,6 +80,11 @@ static uint32_t patchgroup_lfs_get_file_block(LFS_t * object, fdesc_t * file, ui
 	return CALL(((struct patchgroup_info *) object)->lfs, get_file_block, file, offset);
 }
 
+static uint32_t patchgroup_lfs_get_file_extent(LFS_t * object, fdesc_t * file, uint32_t offset, uint32_t * nblocks)
+{
+	return CALL(((struct patchgroup_info *) object)->lfs, get_file_extent, file, offset, nblocks);
+}
+
 static int patchgroup_lfs_get_dirent(LFS_t * object, fdesc_t * file, struct dirent * entry, uint16_t size, uint32_t * basep)
 {
 	return CALL(((struct patchgroup_info *) object)->lfs, get_dirent, file, entry, size, basep);
@@ -182,6 +187,25 @@ static int patchgroup_lfs_free_block(LFS_t * object, fdesc_t * file, uint32_t bl
 	return value;
 }
 
+static int patchgroup_lfs_free_blocks(LFS_t * object, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head)
+{
+	struct patchgroup_info * info = (struct patchgroup_info *) object;
+	int value, r;
+
+	r = patchgroup_prepare_head(head);
+	if(r < 0)
+		return r;
+
+	value = CALL(info->lfs, free_blocks, file, blocks, count, head);
+	if(value >= 0)
+	{
+		r = patchgroup_finish_head(*head);
+		/* can we do better than this? */
+		assert(r >= 0);
+	}
+	return value;
+}
+
 static int patchgroup_lfs_remove_name(LFS_t * object, inode_t parent, const char * name, patch_t ** head)
 {
 	struct patchgroup_info * info = (struct patchgroup_info *) object;
@@ -0,0 +1,220 @@
+/* This file is part of Featherstitch. Featherstitch is copyright 2005-2007 The
+ * Regents of the University of California. It is distributed under the terms of
+ * version 2 of the GNU GPL. See the file LICENSE for details. */
+
+#include <lib/platform.h>
+
+#include <modules/ufs_alloc_summary.h>
+
+// The three bitmaps we allocate from
+#define MAP_BLOCK 0
+#define MAP_FRAG 1
+#define MAP_INODE 2
+#define MAP_COUNT 3
+
+struct ufsmod_alloc_info {
+	UFSmod_alloc_t ufsmod_alloc;
+
+	struct ufs_info *info;
+	// Where to start when there is no file to be near
+	uint32_t last[MAP_COUNT];
+	// Per cylinder group position of the last allocation, as in cg_rotor
+	uint32_t (*rotors)[MAP_COUNT];
+	int32_t ncg;
+};
+
+#define GET_UFS_INFO(object) (((struct ufsmod_alloc_info *) (object))->info)
+
+// Number of map entries in each cylinder group
+static uint32_t map_per_cg(const struct UFS_Super * super, int map)
+{
+	if (map == MAP_BLOCK)
+		return super->fs_fpg / super->fs_frag;
+	if (map == MAP_FRAG)
+		return super->fs_fpg;
+	return super->fs_ipg;
+}
+
+// Whether the summary says cylinder group 'cyl' has anything free in 'map'
+static bool map_has_free(struct ufs_info * info, int32_t cyl, int map)
+{
+	const struct UFS_csum * csum = info->csums + cyl;
+	if (map == MAP_BLOCK)
+		return csum->cs_nbfree > 0;
+	if (map == MAP_FRAG)
+		return csum->cs_nbfree > 0 || csum->cs_nffree > 0;
+	return csum->cs_nifree > 0;
+}
+
+/* Find the first available entry in [start, end) of a cylinder group bitmap,
+ * a word at a time. Available entries have their bits set in the block and
+ * fragment maps, and clear in the inode map. Returns the entry, -1 if there
+ * is none, or another negative error. */
+static int32_t map_scan(struct ufs_info * info, int32_t cyl, const struct UFS_cg * cg, int map, uint32_t start, uint32_t end)
+{
+	const struct UFS_Super * super = CALL(info->parts.p_super, read);
+	uint32_t cgblock = CALL(info->parts.p_cg, get_cylstart, cyl) + super->fs_cblkno;
+	uint32_t mapoff, word, blockno = INVALID_BLOCK;
+	bdesc_t * block = NULL;
+
+	if (map == MAP_BLOCK)
+		mapoff = cg->cg_clusteroff;
+	else if (map == MAP_FRAG)
+		mapoff = cg->cg_freeoff;
+	else
+		mapoff = cg->cg_iusedoff;
+
+	for (word = start / 32; word * 32 < end; word++) {
+		uint32_t offset = mapoff + word * 4;
+		uint32_t bits;
+
+		if (cgblock + offset / super->fs_fsize != blockno) {
+			blockno = cgblock + offset / super->fs_fsize;
+			block = CALL(info->ubd, read_block, blockno, 1, NULL);
+			if (!block)
+				return -ENOENT;
+		}
+
+		bits = ((uint32_t *) bdesc_data(block))[(offset % super->fs_fsize) / 4];
+		if (map == MAP_INODE)
+			bits = ~bits;
+		if (word == start / 32)
+			bits &= ~0U << (start % 32);
+		if (bits) {
+			uint32_t entry = word * 32 + __builtin_ctz(bits);
+			return (entry < end) ? entry : -1;
+		}
+	}
+
+	return -1;
+}
+
+/* Find an available entry in 'map', starting in the cylinder group containing
+ * 'goal' at 'goal' itself, then trying the following cylinder groups from
+ * where they last allocated. Full cylinder groups are skipped. */
+static uint32_t ufs_alloc_summary_find(UFSmod_alloc_t * object, int map, uint32_t goal)
+{
+	struct ufsmod_alloc_info * obj = (struct ufsmod_alloc_info *) object;
+	struct ufs_info * info = obj->info;
+	const struct UFS_Super * super = CALL(info->parts.p_super, read);
+	uint32_t per_cg = map_per_cg(super, map);
+	int32_t i, start_cyl;
+
+	if (!obj->rotors) {
+		obj->ncg = super->fs_ncg;
+		obj->rotors = scalloc(obj->ncg, sizeof(*obj->rotors));
+		if (!obj->rotors)
+			return INVALID_BLOCK;
+	}
+
+	if (goal == INVALID_BLOCK || goal / per_cg >= obj->ncg)
+		goal = 0;
+	start_cyl = goal / per_cg;
+
+	for (i = 0; i < obj->ncg; i++) {
+		int32_t cyl = (start_cyl + i) % obj->ncg;
+		uint32_t low = 0, end, from;
+		const struct UFS_cg * cg;
+		int32_t r;
+
+		if (!map_has_free(info, cyl, map))
+			continue;
+		cg = CALL(info->parts.p_cg, read, cyl);
+		if (!cg)
+			return INVALID_BLOCK;
+
+		if (map == MAP_BLOCK)
+			end = cg->cg_nclusterblks;
+		else if (map == MAP_FRAG)
+			end = cg->cg_ndblk;
+		else {
+			end = cg->cg_niblk;
+			if (!cyl)
+				low = UFS_ROOT_INODE + 1;
+		}
+
+		from = i ? obj->rotors[cyl][map] : goal % per_cg;
+		if (from < low || from >= end)
+			from = low;
+
+		r = map_scan(info, cyl, cg, map, from, end);
+		if (r == -1 && from > low)
+			r = map_scan(info, cyl, cg, map, low, from);
+		if (r >= 0) {
+			obj->rotors[cyl][map] = r + 1;
+			obj->last[map] = cyl * per_cg + r + 1;
+			return cyl * per_cg + r;
+		}
+		if (r != -1)
+			return INVALID_BLOCK;
+	}
+
+	return INVALID_BLOCK;
+}
+
+static uint32_t ufs_alloc_summary_find_free_block(UFSmod_alloc_t * object, fdesc_t * file, int purpose)
+{
+	struct ufsmod_alloc_info * obj = (struct ufsmod_alloc_info *) object;
+	const struct UFS_Super * super = CALL(obj->info->parts.p_super, read);
+	ufs_fdesc_t * f = (ufs_fdesc_t *) file;
+	uint32_t goal = obj->last[MAP_BLOCK];
+
+	// Try to continue right after the file's last block
+	if (f && f->f_numfrags)
+		goal = f->f_lastfrag / super->fs_frag + 1;
+	return ufs_alloc_summary_find(object, MAP_BLOCK, goal);
+}
+
+static uint32_t ufs_alloc_summary_find_free_frag(UFSmod_alloc_t * object, fdesc_t * file, int purpose)
+{
+	struct ufsmod_alloc_info * obj = (struct ufsmod_alloc_info *) object;
+	ufs_fdesc_t * f = (ufs_fdesc_t *) file;
+	uint32_t goal = obj->last[MAP_FRAG];
+
+	if (f && f->f_numfrags)
+		goal = f->f_lastfrag + 1;
+	return ufs_alloc_summary_find(object, MAP_FRAG, goal);
+}
+
+static uint32_t ufs_alloc_summary_find_free_inode(UFSmod_alloc_t * object, fdesc_t * file, int purpose)
+{
+	struct ufsmod_alloc_info * obj = (struct ufsmod_alloc_info *) object;
+	ufs_fdesc_t * f = (ufs_fdesc_t *) file;
+	uint32_t goal = obj->last[MAP_INODE];
+
+	// 'file' is the parent directory: keep its entries nearby
+	if (f)
+		goal = f->f_num;
+	return ufs_alloc_summary_find(object, MAP_INODE, goal);
+}
+
+static int ufs_alloc_summary_destroy(UFSmod_alloc_t * obj)
+{
+	struct ufsmod_alloc_info * info = (struct ufsmod_alloc_info *) obj;
+	if (info->rotors)
+		sfree(info->rotors, info->ncg * sizeof(*info->rotors));
+	memset(info, 0, sizeof(*info));
+	free(info);
+	return 0;
+}
+
+UFSmod_alloc_t * ufs_alloc_summary(struct ufs_info * info)
+{
+	struct ufsmod_alloc_info * obj;
+	int i;
+
+	if (!info)
+		return NULL;
+
+	obj = malloc(sizeof(*obj));
+	if (!obj)
+		return NULL;
+
+	UFS_ALLOC_INIT(&obj->ufsmod_alloc, ufs_alloc_summary);
+	obj->info = info;
+	for (i = 0; i < MAP_COUNT; i++)
+		obj->last[i] = INVALID_BLOCK;
+	obj->rotors = NULL;
+	obj->ncg = 0;
+	return &obj->ufsmod_alloc;
+}
@@ -0,0 +1,16 @@
+/* This file is part of Featherstitch. Featherstitch is copyright 2005-2007 The
+ * Regents of the University of California. It is distributed under the terms of
+ * version 2 of the GNU GPL. See the file LICENSE for details. */
+
+#ifndef __FSTITCH_MODULES_UFS_ALLOC_SUMMARY_H
+#define __FSTITCH_MODULES_UFS_ALLOC_SUMMARY_H
+
+#include <modules/ufs_alloc.h>
+#include <modules/ufs_common.h>
+
+/* Allocates near the file's last fragment (or the parent directory's inode),
+ * skipping cylinder groups whose summary says they are full and scanning
+ * cylinder group bitmaps a word at a time. */
+UFSmod_alloc_t * ufs_alloc_summary(struct ufs_info * info);
+
+#endif /* __FSTITCH_MODULES_UFS_ALLOC_SUMMARY_H */
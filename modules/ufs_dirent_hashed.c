@@ -0,0 +1,716 @@
+/* This file is part of Featherstitch. Featherstitch is copyright 2005-2007 The
+ * Regents of the University of California. It is distributed under the terms of
+ * version 2 of the GNU GPL. See the file LICENSE for details. */
+
+#include <lib/platform.h>
+#include <lib/hash_map.h>
+
+#include <fscore/debug.h>
+
+#include <modules/ufs_dirent_hashed.h>
+
+// Directory entries never cross one of these
+#define UFS_DIRBLKSIZ 512
+// Perhaps this is a good number?
+#define UFS_CACHED_DIRS 64
+// Entries with free space are kept in one list per 4 bytes of free space
+#define UFS_FREE_CLASSES (UFS_DIRBLKSIZ / 4 + 1)
+
+#define DIRENT_LEN(namlen) ROUNDUP32(sizeof(struct UFS_direct) + (namlen) - UFS_MAXNAMELEN, 4)
+
+typedef struct ufs_mdirent ufs_mdirent_t;
+typedef struct ufs_mdir ufs_mdir_t;
+
+// In-memory dirent
+struct ufs_mdirent {
+	uint32_t offset;
+	uint32_t ino; // 0 for an unused entry
+	uint16_t reclen;
+	uint8_t type;
+	uint8_t namlen;
+	char * name; // NULL for an unused entry
+	ufs_mdirent_t * offset_prev, * offset_next;
+	ufs_mdirent_t ** free_pprev, * free_next;
+};
+
+// In-memory directory
+struct ufs_mdir {
+	inode_t ino; // INODE_NONE if this slot is unused
+	uint32_t size; // directory size when last indexed or changed by us
+	hash_map_t * mdirents; // file name -> ufs_mdirent
+	ufs_mdirent_t * offset_first, * offset_last;
+	ufs_mdirent_t * free[UFS_FREE_CLASSES];
+	ufs_mdir_t ** lru_polder, * lru_newer;
+};
+
+struct ufsmod_dirent_info {
+	UFSmod_dirent_t ufsmod_dirent;
+
+	struct ufs_info *info;
+	hash_map_t * mdirs_map; // inode -> ufs_mdir
+	ufs_mdir_t mdirs_table[UFS_CACHED_DIRS];
+	ufs_mdir_t * lru_oldest, * lru_newest;
+};
+
+#define GET_UFS_INFO(object) (((struct ufsmod_dirent_info *) (object))->info)
+
+static int read_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, struct UFS_direct * entry, uint32_t * basep)
+{
+	struct ufs_info * info = GET_UFS_INFO(object);
+	struct UFS_direct * dirent;
+	bdesc_t * dirblock = NULL;
+	uint32_t blockno, offset;
+	const struct UFS_Super * super = CALL(info->parts.p_super, read);
+
+	if (!entry)
+		return -EINVAL;
+
+	// Make sure it's a directory and we can read from it
+	if (dirf->f_type != TYPE_DIR)
+		return -ENOTDIR;
+
+	if (*basep >= dirf->f_inode.di_size)
+		return -1;
+
+	blockno = CALL(info->parts.base, get_file_block, (fdesc_t *) dirf, ROUNDDOWN32(*basep, super->fs_fsize));
+	if (blockno != INVALID_BLOCK)
+		dirblock = CALL(info->parts.base, lookup_block, blockno, NULL);
+	if (!dirblock)
+		return -ENOENT;
+
+	offset = *basep % super->fs_fsize;
+	dirent = (struct UFS_direct *) (bdesc_data(dirblock) + offset);
+
+	if (offset + dirent->d_reclen > super->fs_fsize
+			|| dirent->d_reclen < dirent->d_namlen)
+		return -1;
+
+	entry->d_ino = dirent->d_ino;
+	entry->d_reclen = dirent->d_reclen;
+	entry->d_type = dirent->d_type;
+	entry->d_namlen = dirent->d_namlen;
+	memcpy(entry->d_name, dirent->d_name, dirent->d_namlen);
+	entry->d_name[dirent->d_namlen] = 0;
+
+	*basep += dirent->d_reclen;
+	return 0;
+}
+
+// Writes a directory entry, does not check for free space
+static int write_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, struct UFS_direct entry, uint32_t basep, patch_t ** head)
+{
+	struct ufs_info * info = GET_UFS_INFO(object);
+	bdesc_t * block;
+	uint32_t foffset, blockno;
+	uint16_t offset, actual_len;
+	int r;
+	const struct UFS_Super * super = CALL(info->parts.p_super, read);
+
+	if (!head || !dirf)
+		return -EINVAL;
+
+	actual_len = sizeof(struct UFS_direct) + entry.d_namlen - UFS_MAXNAMELEN;
+
+	offset = basep % super->fs_fsize;
+	foffset = basep - offset;
+	blockno = CALL(info->parts.base, get_file_block, (fdesc_t *) dirf, foffset);
+	if (blockno == INVALID_BLOCK)
+		return -ENOENT;
+	block = CALL(info->ubd, read_block, blockno, 1, NULL);
+	if (!block)
+		return -ENOENT;
+
+	r = patch_create_byte(block, info->ubd, offset, actual_len, &entry, head);
+	if (r < 0)
+		return r;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, *head, "write dirent");
+
+	return CALL(info->ubd, write_block, block, blockno);
+}
+
+// Writes the on-disk version of an mdirent
+static int write_mdirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, const ufs_mdirent_t * mdirent, patch_t ** head)
+{
+	struct UFS_direct entry;
+
+	entry.d_ino = mdirent->ino;
+	entry.d_reclen = mdirent->reclen;
+	entry.d_type = mdirent->type;
+	entry.d_namlen = mdirent->name ? mdirent->namlen : 0;
+	if (mdirent->name)
+		memcpy(entry.d_name, mdirent->name, entry.d_namlen);
+	entry.d_name[entry.d_namlen] = 0;
+
+	return write_dirent(object, dirf, entry, mdirent->offset, head);
+}
+
+static uint16_t ufs_mdirent_free_space(const ufs_mdirent_t * mdirent)
+{
+	if (!mdirent->ino)
+		return mdirent->reclen;
+	if (mdirent->reclen < DIRENT_LEN(mdirent->namlen))
+		return 0;
+	return mdirent->reclen - DIRENT_LEN(mdirent->namlen);
+}
+
+// Remove mdirent from its free list, if it is on one
+static void ufs_mdirent_remove_free_list(ufs_mdirent_t * mdirent)
+{
+	if (!mdirent->free_pprev)
+		return;
+	*mdirent->free_pprev = mdirent->free_next;
+	if (mdirent->free_next)
+		mdirent->free_next->free_pprev = mdirent->free_pprev;
+	mdirent->free_pprev = NULL;
+	mdirent->free_next = NULL;
+}
+
+// Put mdirent on the free list matching its free space
+static void ufs_mdirent_update_free_list(ufs_mdir_t * mdir, ufs_mdirent_t * mdirent)
+{
+	uint16_t class = ufs_mdirent_free_space(mdirent) / 4;
+
+	ufs_mdirent_remove_free_list(mdirent);
+	if (!class)
+		return;
+	if (class >= UFS_FREE_CLASSES)
+		class = UFS_FREE_CLASSES - 1;
+
+	mdirent->free_pprev = &mdir->free[class];
+	mdirent->free_next = mdir->free[class];
+	if (mdirent->free_next)
+		mdirent->free_next->free_pprev = &mdirent->free_next;
+	mdir->free[class] = mdirent;
+}
+
+// Return an mdirent with room for a new entry of length 'len'
+static ufs_mdirent_t * ufs_mdirent_find_free(ufs_mdir_t * mdir, uint16_t len)
+{
+	uint16_t class;
+	for (class = len / 4; class < UFS_FREE_CLASSES; class++)
+		if (mdir->free[class])
+			return mdir->free[class];
+	return NULL;
+}
+
+// Add a new unused mdirent to mdir, following 'prev' (or first if NULL)
+static ufs_mdirent_t * ufs_mdirent_add(ufs_mdir_t * mdir, ufs_mdirent_t * prev, uint32_t offset, uint16_t reclen)
+{
+	ufs_mdirent_t * mdirent = malloc(sizeof(*mdirent));
+	if (!mdirent)
+		return NULL;
+
+	mdirent->offset = offset;
+	mdirent->ino = 0;
+	mdirent->reclen = reclen;
+	mdirent->type = 0;
+	mdirent->namlen = 0;
+	mdirent->name = NULL;
+	mdirent->free_pprev = NULL;
+	mdirent->free_next = NULL;
+
+	mdirent->offset_prev = prev;
+	mdirent->offset_next = prev ? prev->offset_next : mdir->offset_first;
+	if (prev)
+		prev->offset_next = mdirent;
+	else
+		mdir->offset_first = mdirent;
+	if (mdirent->offset_next)
+		mdirent->offset_next->offset_prev = mdirent;
+	else
+		mdir->offset_last = mdirent;
+
+	return mdirent;
+}
+
+// Mark mdirent as used by the entry 'name'
+static int ufs_mdirent_use(ufs_mdir_t * mdir, ufs_mdirent_t * mdirent, uint32_t ino, uint8_t type, const char * name, uint8_t namlen)
+{
+	int r;
+	assert(!mdirent->name);
+
+	mdirent->name = malloc(namlen + 1);
+	if (!mdirent->name)
+		return -ENOMEM;
+	memcpy(mdirent->name, name, namlen);
+	mdirent->name[namlen] = 0;
+
+	// a duplicate name means the directory is corrupt
+	if (hash_map_find_val(mdir->mdirents, mdirent->name))
+		r = -EEXIST;
+	else
+		r = hash_map_insert(mdir->mdirents, mdirent->name, mdirent);
+	if (r < 0) {
+		free(mdirent->name);
+		mdirent->name = NULL;
+		return r;
+	}
+
+	mdirent->ino = ino;
+	mdirent->type = type;
+	mdirent->namlen = namlen;
+	return 0;
+}
+
+// Mark mdirent as unused
+static void ufs_mdirent_clear(ufs_mdir_t * mdir, ufs_mdirent_t * mdirent)
+{
+	if (mdirent->name) {
+		ufs_mdirent_t * mde = hash_map_erase(mdir->mdirents, mdirent->name);
+		assert(mde == mdirent); (void) mde;
+		free(mdirent->name);
+		mdirent->name = NULL;
+	}
+	mdirent->ino = 0;
+	mdirent->namlen = 0;
+}
+
+// Remove mdirent from mdir entirely
+static void ufs_mdirent_remove(ufs_mdir_t * mdir, ufs_mdirent_t * mdirent)
+{
+	ufs_mdirent_clear(mdir, mdirent);
+	ufs_mdirent_remove_free_list(mdirent);
+
+	if (mdirent->offset_prev)
+		mdirent->offset_prev->offset_next = mdirent->offset_next;
+	else
+		mdir->offset_first = mdirent->offset_next;
+	if (mdirent->offset_next)
+		mdirent->offset_next->offset_prev = mdirent->offset_prev;
+	else
+		mdir->offset_last = mdirent->offset_prev;
+
+	free(mdirent);
+}
+
+// Free the contents of mdir
+static void ufs_mdirents_free(ufs_mdir_t * mdir)
+{
+	ufs_mdirent_t * mdirent = mdir->offset_first;
+	int i;
+
+	hash_map_clear(mdir->mdirents);
+	while (mdirent) {
+		ufs_mdirent_t * next = mdirent->offset_next;
+		free(mdirent->name);
+		free(mdirent);
+		mdirent = next;
+	}
+	mdir->offset_first = mdir->offset_last = NULL;
+	for (i = 0; i < UFS_FREE_CLASSES; i++)
+		mdir->free[i] = NULL;
+}
+
+// Update mdir lru list to make mdir the most recent
+static void ufs_mdir_use(struct ufsmod_dirent_info * cache, ufs_mdir_t * mdir)
+{
+	if (!mdir->lru_newer)
+		return;
+	mdir->lru_newer->lru_polder = mdir->lru_polder;
+	*mdir->lru_polder = mdir->lru_newer;
+	mdir->lru_polder = &cache->lru_newest->lru_newer;
+	*mdir->lru_polder = mdir;
+	mdir->lru_newer = NULL;
+	cache->lru_newest = mdir;
+}
+
+// Drop a directory from the cache, making its slot the oldest
+static void ufs_mdir_remove(struct ufsmod_dirent_info * cache, ufs_mdir_t * mdir)
+{
+	ufs_mdirents_free(mdir);
+	hash_map_erase(cache->mdirs_map, (void *) mdir->ino);
+	mdir->ino = INODE_NONE;
+
+	if (cache->lru_oldest == mdir)
+		return;
+	if (mdir->lru_newer)
+		mdir->lru_newer->lru_polder = mdir->lru_polder;
+	else
+		cache->lru_newest = container_of(mdir->lru_polder, ufs_mdir_t, lru_newer);
+	*mdir->lru_polder = mdir->lru_newer;
+	mdir->lru_newer = cache->lru_oldest;
+	mdir->lru_polder = &cache->lru_oldest;
+	mdir->lru_newer->lru_polder = &mdir->lru_newer;
+	cache->lru_oldest = mdir;
+}
+
+// Add a directory to the cache by reading all of its entries
+static int ufs_mdir_add(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, ufs_mdir_t ** pmdir)
+{
+	struct ufsmod_dirent_info * cache = (struct ufsmod_dirent_info *) object;
+	ufs_mdir_t * mdir = cache->lru_oldest;
+	struct UFS_direct entry;
+	uint32_t cur_base = 0, next_base = 0;
+	int r;
+
+	if (mdir->ino != INODE_NONE) {
+		// Oldest mdir is still alive. Free it.
+		ufs_mdirents_free(mdir);
+		hash_map_erase(cache->mdirs_map, (void *) mdir->ino);
+	}
+	mdir->ino = dirf->f_num;
+	mdir->size = dirf->f_inode.di_size;
+	r = hash_map_insert(cache->mdirs_map, (void *) mdir->ino, mdir);
+	if (r < 0) {
+		mdir->ino = INODE_NONE;
+		return r;
+	}
+
+	for (;; cur_base = next_base) {
+		ufs_mdirent_t * mdirent;
+		r = read_dirent(object, dirf, &entry, &next_base);
+		if (r == -1)
+			break;
+		if (r < 0)
+			goto fail;
+		if (!entry.d_reclen) {
+			r = -EINVAL;
+			goto fail;
+		}
+
+		mdirent = ufs_mdirent_add(mdir, mdir->offset_last, cur_base, entry.d_reclen);
+		if (!mdirent) {
+			r = -ENOMEM;
+			goto fail;
+		}
+		if (entry.d_ino) {
+			r = ufs_mdirent_use(mdir, mdirent, entry.d_ino, entry.d_type, entry.d_name, entry.d_namlen);
+			if (r < 0)
+				goto fail;
+		}
+		ufs_mdirent_update_free_list(mdir, mdirent);
+	}
+
+	ufs_mdir_use(cache, mdir);
+	*pmdir = mdir;
+	return 0;
+
+  fail:
+	ufs_mdir_remove(cache, mdir);
+	return r;
+}
+
+// Get (and create, if it is not cached) the index for a directory
+static int ufs_mdir_get(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, ufs_mdir_t ** pmdir)
+{
+	struct ufsmod_dirent_info * cache = (struct ufsmod_dirent_info *) object;
+	ufs_mdir_t * mdir;
+
+	if (dirf->f_type != TYPE_DIR)
+		return -ENOTDIR;
+
+	mdir = hash_map_find_val(cache->mdirs_map, (void *) dirf->f_num);
+	if (mdir) {
+		// A size we did not set means the inode was freed and reused
+		if (mdir->size == dirf->f_inode.di_size) {
+			ufs_mdir_use(cache, mdir);
+			*pmdir = mdir;
+			return 0;
+		}
+		ufs_mdir_remove(cache, mdir);
+	}
+
+	return ufs_mdir_add(object, dirf, pmdir);
+}
+
+// Append a new fragment-sized chunk to the directory
+static int ufs_dirent_hashed_extend(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, ufs_mdir_t * mdir, patch_t ** head)
+{
+	struct ufs_info * info = GET_UFS_INFO(object);
+	uint32_t offset = ROUNDUP32(dirf->f_inode.di_size, UFS_DIRBLKSIZ);
+	uint32_t newsize = offset + UFS_DIRBLKSIZ;
+	fsmetadata_t fsm;
+	int r;
+	const struct UFS_Super * super = CALL(info->parts.p_super, read);
+
+	// Need to allocate/append fragment
+	if (offset % super->fs_fsize == 0) {
+		bdesc_t * block;
+		uint32_t blockno = CALL(info->parts.base, allocate_block, (fdesc_t *) dirf, 0, head);
+		if (blockno == INVALID_BLOCK)
+			return -1;
+		block = CALL(info->ubd, synthetic_read_block, blockno, 1, NULL);
+		assert(block); // FIXME Leiz == Lazy
+		r = patch_create_init(block, info->ubd, head);
+		assert(r >= 0); // FIXME Leiz == Lazy
+		FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, *head, "clear dirblock");
+		r = CALL(info->parts.base, append_file_block, (fdesc_t *) dirf, blockno, head);
+		if (r < 0)
+			return r;
+	}
+
+	// Set directory size
+	fsm.fsm_feature = FSTITCH_FEATURE_SIZE;
+	fsm.fsm_value.u = newsize;
+	r = CALL(info->parts.base, set_metadata2_fdesc, (fdesc_t *) dirf, &fsm, 1, head);
+	if (r < 0)
+		return r;
+	mdir->size = newsize;
+
+	if (!ufs_mdirent_add(mdir, mdir->offset_last, offset, UFS_DIRBLKSIZ))
+		return -ENOMEM;
+	return 0;
+}
+
+static int ufs_dirent_hashed_insert_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, struct dirent dirinfo, patch_t ** head)
+{
+	struct ufsmod_dirent_info * cache = (struct ufsmod_dirent_info *) object;
+	ufs_mdir_t * mdir;
+	ufs_mdirent_t * mdirent, * prev = NULL;
+	uint16_t len;
+	uint8_t fs_type;
+	int r;
+
+	if (!head || !dirf || ufs_check_name(dirinfo.d_name))
+		return -EINVAL;
+
+	fs_type = fstitch_to_ufs_type(dirinfo.d_type);
+	if (fs_type == (uint8_t) -EINVAL)
+		return -EINVAL;
+	len = DIRENT_LEN(dirinfo.d_namelen);
+
+	r = ufs_mdir_get(object, dirf, &mdir);
+	if (r < 0)
+		return r;
+
+	// Find a place to put the new entry
+	mdirent = ufs_mdirent_find_free(mdir, len);
+	if (!mdirent) {
+		r = ufs_dirent_hashed_extend(object, dirf, mdir, head);
+		if (r < 0)
+			goto fail;
+		mdirent = mdir->offset_last;
+	}
+	else if (mdirent->ino) {
+		// Split the unused tail off of an existing entry
+		uint16_t actual_len = DIRENT_LEN(mdirent->namlen);
+		prev = mdirent;
+		mdirent = ufs_mdirent_add(mdir, prev, prev->offset + actual_len, prev->reclen - actual_len);
+		if (!mdirent) {
+			r = -ENOMEM;
+			goto fail;
+		}
+		prev->reclen = actual_len;
+	}
+
+	r = ufs_mdirent_use(mdir, mdirent, dirinfo.d_fileno, fs_type, dirinfo.d_name, dirinfo.d_namelen);
+	if (r < 0)
+		goto fail;
+	ufs_mdirent_update_free_list(mdir, mdirent);
+
+	r = write_mdirent(object, dirf, mdirent, head);
+	if (r < 0)
+		goto fail;
+	if (prev) {
+		ufs_mdirent_update_free_list(mdir, prev);
+		r = write_mdirent(object, dirf, prev, head);
+		if (r < 0)
+			goto fail;
+	}
+	return 0;
+
+  fail:
+	// Rebuild the index from disk next time
+	ufs_mdir_remove(cache, mdir);
+	return r;
+}
+
+static int ufs_dirent_hashed_get_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, struct dirent * entry, uint16_t size, uint32_t * basep)
+{
+	struct ufs_info * info = GET_UFS_INFO(object);
+	struct UFS_direct dirent;
+	struct UFS_dinode inode;
+	uint32_t actual_len;
+	uint32_t new_basep;
+	int r;
+
+	if (!entry)
+		return -EINVAL;
+
+	new_basep = *basep;
+	r = read_dirent(object, dirf, &dirent, &new_basep);
+	if (r < 0)
+		return r;
+
+	actual_len = sizeof(struct dirent) + dirent.d_namlen - DIRENT_MAXNAMELEN;
+	if (size < actual_len)
+		return -EINVAL;
+
+	if (dirent.d_ino) {
+		r = ufs_read_inode(info, dirent.d_ino, &inode);
+		if (r < 0)
+			return r;
+
+		if (inode.di_size > UFS_MAXFILESIZE) {
+			printf("%s: file too big?\n", __FUNCTION__);
+			inode.di_size &= UFS_MAXFILESIZE;
+		}
+	}
+
+	entry->d_type = ufs_to_fstitch_type(dirent.d_type);
+	entry->d_fileno = dirent.d_ino;
+	entry->d_reclen = actual_len;
+	entry->d_namelen = dirent.d_namlen;
+	memcpy(entry->d_name, dirent.d_name, dirent.d_namlen);
+	entry->d_name[dirent.d_namlen] = 0;
+	*basep = new_basep;
+
+	return 0;
+}
+
+static int ufs_dirent_hashed_search_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, const char * name, inode_t * ino, int * offset)
+{
+	ufs_mdir_t * mdir;
+	ufs_mdirent_t * mdirent;
+	int r;
+
+	if (!dirf || ufs_check_name(name))
+		return -EINVAL;
+
+	r = ufs_mdir_get(object, dirf, &mdir);
+	if (r < 0)
+		return r;
+
+	mdirent = hash_map_find_val(mdir->mdirents, name);
+	if (!mdirent)
+		return -ENOENT;
+	if (ino)
+		*ino = mdirent->ino;
+	if (offset)
+		*offset = mdirent->offset;
+	return 0;
+}
+
+static int ufs_dirent_hashed_delete_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * dirf, const char * name, patch_t ** head)
+{
+	struct ufsmod_dirent_info * cache = (struct ufsmod_dirent_info *) object;
+	ufs_mdir_t * mdir;
+	ufs_mdirent_t * mdirent, * prev;
+	int r;
+
+	if (!head || !dirf || ufs_check_name(name))
+		return -EINVAL;
+
+	r = ufs_mdir_get(object, dirf, &mdir);
+	if (r < 0)
+		return r;
+
+	mdirent = hash_map_find_val(mdir->mdirents, name);
+	if (!mdirent)
+		return -ENOENT;
+
+	if (mdirent->offset % UFS_DIRBLKSIZ == 0) {
+		// We are the first entry in the chunk
+		ufs_mdirent_clear(mdir, mdirent);
+		ufs_mdirent_update_free_list(mdir, mdirent);
+		r = write_mdirent(object, dirf, mdirent, head);
+		if (r < 0)
+			goto fail;
+		return 0;
+	}
+
+	// Merge into the entry in front of us
+	prev = mdirent->offset_prev;
+	if (!prev || prev->offset + prev->reclen != mdirent->offset) {
+		printf("%s: went past the directory entry\n", __FUNCTION__);
+		r = -1;
+		goto fail;
+	}
+	prev->reclen += mdirent->reclen;
+	ufs_mdirent_remove(mdir, mdirent);
+	ufs_mdirent_update_free_list(mdir, prev);
+	r = write_mdirent(object, dirf, prev, head);
+	if (r < 0)
+		goto fail;
+	return 0;
+
+  fail:
+	ufs_mdir_remove(cache, mdir);
+	return r;
+}
+
+// Unlike ufs_dirent_linear, this keeps the entry's record length
+static int ufs_dirent_hashed_modify_dirent(UFSmod_dirent_t * object, ufs_fdesc_t * file, struct dirent entry, uint32_t basep, patch_t ** head)
+{
+	struct ufsmod_dirent_info * cache = (struct ufsmod_dirent_info *) object;
+	ufs_mdir_t * mdir;
+	ufs_mdirent_t * mdirent;
+	uint8_t fs_type;
+	int r;
+
+	fs_type = fstitch_to_ufs_type(entry.d_type);
+	if (fs_type == (uint8_t) -EINVAL)
+		return -EINVAL;
+
+	r = ufs_mdir_get(object, file, &mdir);
+	if (r < 0)
+		return r;
+
+	mdirent = hash_map_find_val(mdir->mdirents, entry.d_name);
+	if (!mdirent || mdirent->offset != basep)
+		return -ENOENT;
+
+	mdirent->ino = entry.d_fileno;
+	mdirent->type = fs_type;
+	r = write_mdirent(object, file, mdirent, head);
+	if (r < 0)
+		ufs_mdir_remove(cache, mdir);
+	return r;
+}
+
+static int ufs_dirent_hashed_destroy(UFSmod_dirent_t * obj)
+{
+	struct ufsmod_dirent_info *info = (struct ufsmod_dirent_info *) obj;
+	int i;
+
+	for (i = 0; i < UFS_CACHED_DIRS; i++) {
+		if (!info->mdirs_table[i].mdirents)
+			continue;
+		ufs_mdirents_free(&info->mdirs_table[i]);
+		hash_map_destroy(info->mdirs_table[i].mdirents);
+	}
+	if (info->mdirs_map)
+		hash_map_destroy(info->mdirs_map);
+
+	memset(info, 0, sizeof(*info));
+	free(info);
+	return 0;
+}
+
+UFSmod_dirent_t * ufs_dirent_hashed(struct ufs_info * info)
+{
+	struct ufsmod_dirent_info * obj;
+	int i;
+
+	if (!info)
+		return NULL;
+
+	obj = malloc(sizeof(*obj));
+	if (!obj)
+		return NULL;
+	memset(obj, 0, sizeof(*obj));
+
+	UFS_DIRENT_INIT(&obj->ufsmod_dirent, ufs_dirent_hashed);
+	obj->info = info;
+
+	obj->mdirs_map = hash_map_create_size(UFS_CACHED_DIRS, 0);
+	if (!obj->mdirs_map)
+		goto fail;
+	for (i = 0; i < UFS_CACHED_DIRS; i++) {
+		ufs_mdir_t * mdir = &obj->mdirs_table[i];
+		mdir->ino = INODE_NONE;
+		mdir->mdirents = hash_map_create_str();
+		if (!mdir->mdirents)
+			goto fail;
+		mdir->lru_polder = i ? &obj->mdirs_table[i - 1].lru_newer : &obj->lru_oldest;
+		*mdir->lru_polder = mdir;
+		mdir->lru_newer = NULL;
+	}
+	obj->lru_newest = &obj->mdirs_table[UFS_CACHED_DIRS - 1];
+
+	return &obj->ufsmod_dirent;
+
+  fail:
+	ufs_dirent_hashed_destroy(&obj->ufsmod_dirent);
+	return NULL;
+}
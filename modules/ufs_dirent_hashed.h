@@ -0,0 +1,16 @@
+/* This file is part of Featherstitch. Featherstitch is copyright 2005-2007 The
+ * Regents of the University of California. It is distributed under the terms of
+ * version 2 of the GNU GPL. See the file LICENSE for details. */
+
+#ifndef __FSTITCH_MODULES_UFS_DIRENT_HASHED_H
+#define __FSTITCH_MODULES_UFS_DIRENT_HASHED_H
+
+#include <modules/ufs_dirent.h>
+#include <modules/ufs_common.h>
+
+/* Like ufs_dirent_linear, but keeps an in-memory index of recently used
+ * directories: a name hash for lookups and lists of entries with free space
+ * for inserts. The on-disk format is unchanged. */
+UFSmod_dirent_t * ufs_dirent_hashed(struct ufs_info * info);
+
+#endif /* __FSTITCH_MODULES_UFS_DIRENT_HASHED_H */
@@ -12,12 +12,19 @@
 #include <modules/ufs_common.h>
 #include <modules/ufs_alloc_lastpos.h>
 #include <modules/ufs_alloc_linear.h>
+#include <modules/ufs_alloc_summary.h>
 #include <modules/ufs_dirent_linear.h>
+#include <modules/ufs_dirent_hashed.h>
 #include <modules/ufs_cg_wb.h>
 #include <modules/ufs_super_wb.h>
 
 #define UFS_BASE_DEBUG 0
 
+/* Index directory entries in memory instead of scanning directories */
+#define UFS_HASHED_DIRENTS 1
+/* Allocate near the previous block using the cylinder group summaries */
+#define UFS_SUMMARY_ALLOC 1
+
 #if UFS_BASE_DEBUG
 #define Dprintf(x...) printf(x)
 #else
@@ -853,6 +860,13 @@ static uint32_t ufs_get_file_block(LFS_t * object, fdesc_t * file, uint32_t offs
 	return -1;
 }
 
+static uint32_t ufs_get_file_extent(LFS_t * object, fdesc_t * file, uint32_t offset, uint32_t * nblocks)
+{
+	uint32_t number = ufs_get_file_block(object, file, offset);
+	*nblocks = (number == INVALID_BLOCK) ? 0 : 1;
+	return number;
+}
+
 static int ufs_get_dirent(LFS_t * object, fdesc_t * file, struct dirent * entry, uint16_t size, uint32_t * basep)
 {
 	struct ufs_info * info = (struct ufs_info *) object;
@@ -1349,6 +1363,17 @@ static int ufs_free_block(LFS_t * object, fdesc_t * file, uint32_t block, patch_
 	return ufs_write_fragment_bitmap(info, block, UFS_FREE, head);
 }
 
+static int ufs_free_blocks(LFS_t * object, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head)
+{
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		int r = ufs_free_block(object, file, blocks[i], head);
+		if (r < 0)
+			return r;
+	}
+	return 0;
+}
+
 static int ufs_remove_name(LFS_t * object, inode_t parent, const char * name, patch_t ** head)
 {
 	Dprintf("UFSDEBUG: %s %d %s\n", __FUNCTION__, parent, name);
@@ -1782,8 +1807,16 @@ LFS_t * ufs_lfs(BD_t * block_device)
 	info->write_head = CALL(block_device, get_write_head);
 	info->parts.base = lfs;
 	info->parts.p_super = ufs_super_wb(info); // Initialize first
+#if UFS_SUMMARY_ALLOC
+	info->parts.p_allocator = ufs_alloc_summary(info);
+#else
 	info->parts.p_allocator = ufs_alloc_lastpos(info);
+#endif
+#if UFS_HASHED_DIRENTS
+	info->parts.p_dirent = ufs_dirent_hashed(info);
+#else
 	info->parts.p_dirent = ufs_dirent_linear(info);
+#endif
 	info->parts.p_cg = ufs_cg_wb(info);
 	assert(info->parts.p_allocator);
 	assert(info->parts.p_dirent);
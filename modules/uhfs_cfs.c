@@ -4,8 +4,11 @@
 
 #include <lib/platform.h>
 #include <lib/pool.h>
+#include <lib/jiffies.h>
 
 #include <fscore/modman.h>
+#include <fscore/sched.h>
+#include <fscore/sync.h>
 #include <fscore/patch.h>
 #include <fscore/debug.h>
 #include <fscore/patchgroup.h>
@@ -17,6 +20,28 @@
 
 #define UHFS_DEBUG 0
 
+/* Gather consecutive small writes to a file and pass them to the LFS as one
+ * write, so that each block gets one data patch and the size is set once */
+#define UHFS_WRITE_BEHIND 1
+/* the most data to hold back for one fdesc */
+#define WRITE_BEHIND_SIZE (128 * 1024)
+/* how often to push down held back data */
+#define WRITE_BEHIND_PERIOD (HZ / 10)
+
+/* Map a read's file blocks an extent at a time, and ask the block device to
+ * read each physically contiguous run of them with one request */
+#define UHFS_EXTENT_READ 1
+/* the most file blocks to map at once */
+#define UHFS_EXTENT_BLOCKS 64
+
+/* Free truncated blocks with one free_blocks call per batch, so the LFS can
+ * combine their bitmap changes; the most blocks in a batch */
+#define UHFS_FREE_BATCH 64
+
+/* Track the unwritten changes to each inode, so that syncing a file writes
+ * just those changes and what they depend on rather than the whole cache */
+#define UHFS_INODE_SYNC 1
+
 #if UHFS_DEBUG
 #define Dprintf(x...) printf(x)
 #else
@@ -29,18 +54,69 @@ struct uhfs_fdesc {
 	inode_t inode;
 	feature_id_t size_id; /* metadata id for filesize, 0 if not supported */
 	bool type; /* whether the type metadata is supported */
+#if UHFS_WRITE_BEHIND
+	/* data written to [wb_offset, wb_offset + wb_size) but not yet
+	 * passed to the LFS, and any unreported error from passing it on */
+	uint8_t * wb_data;
+	uint32_t wb_offset, wb_size;
+	int wb_error;
+	/* next fdesc on wb_pending, or on wb_failed if wb_error is set */
+	struct uhfs_fdesc * wb_next;
+#endif
 };
 typedef struct uhfs_fdesc uhfs_fdesc_t;
 
+#if UHFS_INODE_SYNC
+/* an EMPTY that depends on the inode's changes until they are all written */
+struct inode_sync {
+	patchweakref_t empty;
+	inode_t inode;
+	struct uhfs_state * state;
+};
+typedef struct inode_sync inode_sync_t;
+#endif
+
 struct uhfs_state {
 	CFS_t cfs;
 	
 	LFS_t * lfs;
 	patch_t ** write_head;
 	uint32_t nopen;
+#if UHFS_WRITE_BEHIND
+	uhfs_fdesc_t * wb_pending; /* fdescs with held back data */
+	uhfs_fdesc_t * wb_failed; /* fdescs with an unreported wb_error */
+#endif
+#if UHFS_INODE_SYNC
+	hash_map_t * inode_syncs; /* inode -> inode_sync_t */
+	bool inode_sync_lost; /* a change went untracked; next sync is global */
+#endif
 };
 
 DECLARE_POOL(uhfs_fdesc, uhfs_fdesc_t);
+#if UHFS_INODE_SYNC
+DECLARE_POOL(inode_sync, inode_sync_t);
+#endif
+
+#if UHFS_WRITE_BEHIND
+static int write_behind_flush(struct uhfs_state * state, uhfs_fdesc_t * uf);
+static int write_behind_take_error(struct uhfs_state * state, uhfs_fdesc_t * uf);
+static void write_behind_flush_inode(struct uhfs_state * state, inode_t ino, uhfs_fdesc_t * except);
+static void write_behind_flush_all(void * arg);
+static int write_behind_sync_inode(struct uhfs_state * state, inode_t ino);
+#define WRITE_BEHIND_FLUSH_INODE(state, ino) write_behind_flush_inode(state, ino, NULL)
+#define WRITE_BEHIND_FLUSH_ALL(state) write_behind_flush_all(state)
+#define WRITE_BEHIND_SYNC_INODE(state, ino) write_behind_sync_inode(state, ino)
+#else
+#define WRITE_BEHIND_FLUSH_INODE(state, ino) do {} while(0)
+#define WRITE_BEHIND_FLUSH_ALL(state) do {} while(0)
+#define WRITE_BEHIND_SYNC_INODE(state, ino) ((void) (state), 0)
+#endif
+#if UHFS_INODE_SYNC
+static void inode_sync_add(struct uhfs_state * state, inode_t ino, patch_t * head);
+#define INODE_SYNC_ADD(state, ino, head) inode_sync_add(state, ino, head)
+#else
+#define INODE_SYNC_ADD(state, ino, head) do {} while(0)
+#endif
 static int n_uhfs_instances;
 
 static bool lfs_feature_supported(LFS_t * lfs, feature_id_t id)
@@ -81,11 +157,23 @@ static uhfs_fdesc_t * uhfs_fdesc_create(fdesc_t * inner, inode_t ino, feature_id
 	uf->inode = ino;
 	uf->size_id = size_id;
 	uf->type = type;
+#if UHFS_WRITE_BEHIND
+	uf->wb_data = NULL;
+	uf->wb_offset = 0;
+	uf->wb_size = 0;
+	uf->wb_error = 0;
+	uf->wb_next = NULL;
+#endif
 	return uf;
 }
 
 static void uhfs_fdesc_destroy(uhfs_fdesc_t * uf)
 {
+#if UHFS_WRITE_BEHIND
+	assert(!uf->wb_size && !uf->wb_error);
+	free(uf->wb_data);
+	uf->wb_data = NULL;
+#endif
 	uf->common = NULL;
 	uf->inner = NULL;
 	uf->size_id = 0;
@@ -100,6 +188,58 @@ static void uhfs_fdesc_close(struct uhfs_state * state, uhfs_fdesc_t * uf)
 	state->nopen--;
 }
 
+#if UHFS_INODE_SYNC
+/* all of the inode's changes have been written */
+static void inode_sync_satisfy_callback(patchweakref_t * weak, patch_t * old, void * data)
+{
+	inode_sync_t * is = (inode_sync_t *) data;
+	inode_sync_t * erased = hash_map_erase(is->state->inode_syncs, (void *) is->inode);
+	assert(erased == is);
+	inode_sync_free(is);
+}
+
+/* make syncing ino also write head */
+static void inode_sync_add(struct uhfs_state * state, inode_t ino, patch_t * head)
+{
+	inode_sync_t * is;
+	patch_t * empty;
+
+	/* nothing new to write */
+	if (!head || (state->write_head && head == *state->write_head))
+		return;
+	is = hash_map_find_val(state->inode_syncs, (void *) ino);
+	if (is)
+	{
+		if (patch_add_depend(WEAK(is->empty), head) < 0)
+			state->inode_sync_lost = 1;
+		return;
+	}
+
+	if (patch_create_empty_list(NULL, &empty, head, NULL) < 0)
+		goto error;
+	/* head may already have been written */
+	if (!empty->befores)
+		return;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, empty, "inode sync");
+	is = inode_sync_alloc();
+	if (!is)
+		goto error;
+	is->inode = ino;
+	is->state = state;
+	if (hash_map_insert(state->inode_syncs, (void *) ino, is) < 0)
+		goto error_is;
+	WEAK_INIT(is->empty);
+	patch_weak_retain(empty, &is->empty, inode_sync_satisfy_callback, is);
+	return;
+
+error_is:
+	inode_sync_free(is);
+error:
+	/* the EMPTY, if any, will be satisfied along with head */
+	state->inode_sync_lost = 1;
+}
+#endif
+
 
 
 static int uhfs_get_root(CFS_t * cfs, inode_t * ino)
@@ -121,8 +261,13 @@ static int uhfs_close(CFS_t * cfs, fdesc_t * fdesc)
 	Dprintf("%s(%p)\n", __FUNCTION__, fdesc);
 	struct uhfs_state * state = (struct uhfs_state *) cfs;
 	uhfs_fdesc_t * uf = (uhfs_fdesc_t *) fdesc;
+	int r = 0;
+#if UHFS_WRITE_BEHIND
+	r = write_behind_flush(state, uf);
+	write_behind_take_error(state, uf);
+#endif
 	uhfs_fdesc_close(state, uf);
-	return 0;
+	return r;
 }
 
 static int uhfs_truncate(CFS_t * cfs, fdesc_t * fdesc, uint32_t target_size)
@@ -134,8 +279,10 @@ static int uhfs_truncate(CFS_t * cfs, fdesc_t * fdesc, uint32_t target_size)
 	size_t nblks, target_nblks = ROUNDUP32(target_size, blksize) / blksize;
 	patch_t * prev_head = state->write_head ? *state->write_head : NULL;
 	patch_t * save_head;
+	uint32_t freed[UHFS_FREE_BATCH], nfreed = 0;
 	int r;
 
+	WRITE_BEHIND_FLUSH_INODE(state, uf->inode);
 	nblks = CALL(state->lfs, get_file_numblocks, uf->inner);
 
 	/* Truncate and free the blocks no longer in use because of this trunc */
@@ -143,17 +290,21 @@ static int uhfs_truncate(CFS_t * cfs, fdesc_t * fdesc, uint32_t target_size)
 	{
 		/* Truncate the block */
 		uint32_t block = CALL(state->lfs, truncate_file_block, uf->inner, &prev_head);
+		if (block != INVALID_BLOCK)
+			freed[nfreed++] = block;
+
+		/* Now free the truncated blocks, a batch at a time */
+		if (nfreed && (nfreed == UHFS_FREE_BATCH || target_nblks + 1 == nblks || block == INVALID_BLOCK))
+		{
+			save_head = prev_head;
+			r = CALL(state->lfs, free_blocks, uf->inner, freed, nfreed, &prev_head);
+			if (r < 0)
+				return r;
+			prev_head = save_head;
+			nfreed = 0;
+		}
 		if (block == INVALID_BLOCK)
 			return -1;
-
-		save_head = prev_head;
-
-		/* Now free the block */
-		r = CALL(state->lfs, free_block, uf->inner, block, &prev_head);
-		if (r < 0)
-			return r;
-
-		prev_head = save_head;
 	}
 
 	/* Update the file's size as recorded by lfs, which also updates
@@ -178,6 +329,7 @@ static int uhfs_truncate(CFS_t * cfs, fdesc_t * fdesc, uint32_t target_size)
 		}
 	}
 
+	INODE_SYNC_ADD(state, uf->inode, prev_head);
 	return 0;
 }
 
@@ -294,6 +446,8 @@ static int uhfs_create(CFS_t * cfs, inode_t parent, const char * name, int mode,
 	inner = CALL(state->lfs, allocate_name, parent, name, type, NULL, initialmd, newino, &prev_head);
 	if (!inner)
 		return -1;
+	INODE_SYNC_ADD(state, *newino, prev_head);
+	INODE_SYNC_ADD(state, parent, prev_head);
 
 	r = open_common(state, inner, *newino, fdesc);
 	if (r < 0)
@@ -301,19 +455,12 @@ static int uhfs_create(CFS_t * cfs, inode_t parent, const char * name, int mode,
 	return r;
 }
 
-static int uhfs_read(CFS_t * cfs, fdesc_t * fdesc, page_t * page, void * data, uint32_t offset, uint32_t size)
+/* check that uf can be read and get its size, or -1 if size is not supported */
+static int read_prepare(struct uhfs_state * state, uhfs_fdesc_t * uf, uint32_t * file_size)
 {
-	Dprintf("%s(cfs, %p, %p, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, data, offset, size);
-	struct uhfs_state * state = (struct uhfs_state *) cfs;
-	uhfs_fdesc_t * uf = (uhfs_fdesc_t *) fdesc;
-	const uint32_t blocksize = state->lfs->blocksize;
-	const uint32_t blockoffset = offset - (offset % blocksize);
-	const uint32_t pageoffset = offset & (PAGE_SIZE - 1);
-	uint32_t dataoffset = (offset % blocksize);
-	uint32_t size_read = 0;
-	uint32_t file_size = -1;
 	uint32_t filetype;
 
+	WRITE_BEHIND_FLUSH_INODE(state, uf->inode);
 	if (check_type_supported(state->lfs, uf->inner, &filetype))
 	{
 		if (filetype == TYPE_DIR)
@@ -322,48 +469,188 @@ static int uhfs_read(CFS_t * cfs, fdesc_t * fdesc, page_t * page, void * data, u
 			return -1; // This seems bad too
 	}
 
+	*file_size = -1;
 	/* if we have filesize, use it! */
 	if (uf->size_id)
 	{
 		int r;
-		r = CALL(state->lfs, get_metadata_fdesc, uf->inner, uf->size_id, sizeof(file_size), &file_size);
+		r = CALL(state->lfs, get_metadata_fdesc, uf->inner, uf->size_id, sizeof(*file_size), file_size);
 		if (r < 0)
 			return r;
-		assert(r == sizeof(file_size));
+		assert(r == sizeof(*file_size));
 	}
-	while (size_read < size)
-	{
-		uint32_t limit, number;
-		bdesc_t * block = NULL;
+	return 0;
+}
 
-		number = CALL(state->lfs, get_file_block, uf->inner, blockoffset + (offset % blocksize) - dataoffset + size_read);
-		if (number != INVALID_BLOCK)
+#if UHFS_EXTENT_READ
+/* Map up to 'count' file blocks starting at 'offset' into 'numbers' a run at
+ * a time, and hint to the block device that each run will be read. Returns
+ * the number of blocks mapped, including a final INVALID_BLOCK if there is one. */
+static uint32_t uhfs_map_extent(struct uhfs_state * state, uhfs_fdesc_t * uf, uint32_t offset, uint32_t count, uint32_t * numbers)
+{
+	const uint32_t blocksize = state->lfs->blocksize;
+	BD_t * bd = state->lfs->blockdev;
+	uint32_t i = 0;
+
+	while (i < count)
+	{
+		uint32_t j, run;
+		uint32_t number = CALL(state->lfs, get_file_extent, uf->inner, offset + i * blocksize, &run);
+		if (number == INVALID_BLOCK)
 		{
-			bool in_first_page = (pageoffset + size_read) < PAGE_SIZE;
-			page_t * cur_page = in_first_page ? page : NULL;
-			block = CALL(state->lfs, lookup_block, number, cur_page);
+			numbers[i] = INVALID_BLOCK;
+			return i + 1;
 		}
-		if (!block)
-			return size_read ? size_read : -1;
+		if (!run)
+			run = 1;
+		if (run > count - i)
+			run = count - i;
+		for (j = 0; j < run; j++)
+			numbers[i + j] = number + j;
+		if (bd && run > 1)
+			CALL(bd, read_ahead, number, 1, run);
+		i += run;
+	}
+	return count;
+}
+#endif
+
+/* walks the blocks of one read, mapping them an extent at a time */
+struct read_cursor {
+	uhfs_fdesc_t * uf;
+	uint32_t offset, size;
+	uint32_t file_size;
+	uint32_t size_read;
+#if UHFS_EXTENT_READ
+	uint32_t numbers[UHFS_EXTENT_BLOCKS];
+	uint32_t mapped, next;
+#endif
+};
+
+static int read_cursor_init(struct uhfs_state * state, struct read_cursor * cursor, uhfs_fdesc_t * uf, uint32_t offset, uint32_t size)
+{
+	cursor->uf = uf;
+	cursor->offset = offset;
+	cursor->size = size;
+	cursor->size_read = 0;
+#if UHFS_EXTENT_READ
+	cursor->mapped = 0;
+	cursor->next = 0;
+#endif
+	return read_prepare(state, uf, &cursor->file_size);
+}
+
+/* Return the next block of the read, not retained, and set *dataoffset and
+ * *length to the part of it that is read. Returns NULL at the end of the
+ * read or of the file, and at the first block that can not be read. */
+static bdesc_t * read_cursor_next(struct uhfs_state * state, struct read_cursor * cursor, page_t * page, uint32_t * dataoffset, uint32_t * length)
+{
+	uhfs_fdesc_t * uf = cursor->uf;
+	const uint32_t blocksize = state->lfs->blocksize;
+	const uint32_t file_offset = cursor->offset + cursor->size_read;
+	const uint32_t block_offset = file_offset - (file_offset % blocksize);
+	uint32_t limit, number;
+	bdesc_t * block;
+
+	if (cursor->size_read >= cursor->size)
+		return NULL;
+	if (uf->size_id && file_offset >= cursor->file_size)
+		return NULL;
+
+#if UHFS_EXTENT_READ
+	if (cursor->next == cursor->mapped)
+	{
+		/* map the rest of the read, up to the end of the file */
+		uint32_t end = cursor->offset + cursor->size;
+		uint32_t count = 1;
+		if (uf->size_id && end > cursor->file_size)
+			end = cursor->file_size;
+		if (end > block_offset)
+			count = MIN((end - block_offset + blocksize - 1) / blocksize, UHFS_EXTENT_BLOCKS);
+		cursor->mapped = uhfs_map_extent(state, uf, block_offset, count, cursor->numbers);
+		cursor->next = 0;
+	}
+	number = cursor->numbers[cursor->next++];
+#else
+	number = CALL(state->lfs, get_file_block, uf->inner, block_offset);
+#endif
+	if (number == INVALID_BLOCK)
+		return NULL;
+	block = CALL(state->lfs, lookup_block, number, page);
+	if (!block)
+		return NULL;
 
-		limit = MIN(block->length - dataoffset, size - size_read);
-		if (uf->size_id)
-			if (offset + size_read + limit > file_size)
-				limit = file_size - offset - size_read;
+	*dataoffset = file_offset - block_offset;
+	limit = MIN(block->length - *dataoffset, cursor->size - cursor->size_read);
+	if (uf->size_id)
+		if (file_offset + limit > cursor->file_size)
+			limit = cursor->file_size - file_offset;
+	if (!limit)
+		return NULL;
+	*length = limit;
+	cursor->size_read += limit;
+	return block;
+}
 
+static int uhfs_read(CFS_t * cfs, fdesc_t * fdesc, page_t * page, void * data, uint32_t offset, uint32_t size)
+{
+	Dprintf("%s(cfs, %p, %p, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, data, offset, size);
+	struct uhfs_state * state = (struct uhfs_state *) cfs;
+	uhfs_fdesc_t * uf = (uhfs_fdesc_t *) fdesc;
+	const uint32_t pageoffset = offset & (PAGE_SIZE - 1);
+	struct read_cursor cursor;
+	uint32_t size_read = 0;
+	int r;
+
+	r = read_cursor_init(state, &cursor, uf, offset, size);
+	if (r < 0)
+		return r;
+	for (;;)
+	{
+		bool in_first_page = (pageoffset + size_read) < PAGE_SIZE;
+		page_t * cur_page = in_first_page ? page : NULL;
+		uint32_t dataoffset, limit;
+		bdesc_t * block = read_cursor_next(state, &cursor, cur_page, &dataoffset, &limit);
+		if (!block)
+			break;
 		memcpy((uint8_t*)data + size_read, bdesc_data(block) + dataoffset, limit);
 		size_read += limit;
-		/* dataoffset only needed for first block */
-		dataoffset = 0;
+	}
+
+	return size_read ? size_read : (size ? -1 : 0);
+}
+
+static int uhfs_read_extents(CFS_t * cfs, fdesc_t * fdesc, uint32_t offset, uint32_t size, cfs_extent_t * extents, uint32_t * nextents)
+{
+	Dprintf("%s(cfs, %p, 0x%x, 0x%x, %u)\n", __FUNCTION__, fdesc, offset, size, *nextents);
+	struct uhfs_state * state = (struct uhfs_state *) cfs;
+	uhfs_fdesc_t * uf = (uhfs_fdesc_t *) fdesc;
+	const uint32_t max_extents = *nextents;
+	struct read_cursor cursor;
+	uint32_t size_read = 0;
+	int r;
 
-		if (!limit)
+	*nextents = 0;
+	r = read_cursor_init(state, &cursor, uf, offset, size);
+	if (r < 0)
+		return r;
+	while (*nextents < max_extents)
+	{
+		uint32_t dataoffset, limit;
+		bdesc_t * block = read_cursor_next(state, &cursor, NULL, &dataoffset, &limit);
+		if (!block)
 			break;
+		extents[*nextents].block = bdesc_retain(block);
+		extents[*nextents].offset = dataoffset;
+		extents[*nextents].length = limit;
+		++*nextents;
+		size_read += limit;
 	}
 
 	return size_read ? size_read : (size ? -1 : 0);
 }
 
-static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void * data, uint32_t offset, uint32_t size)
+static int write_data(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void * data, uint32_t offset, uint32_t size)
 {
 	Dprintf("%s(%p, %p, 0x%x, 0x%x)\n", __FUNCTION__, fdesc, data, offset, size);
 	struct uhfs_state * state = (struct uhfs_state *) cfs;
@@ -394,7 +681,7 @@ static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void *
 	{
 		while (offset > filesize)
 		{
-			r = uhfs_write(cfs, fdesc, NULL, NULL, filesize, offset - filesize);
+			r = write_data(cfs, fdesc, NULL, NULL, filesize, offset - filesize);
 			if (r < 0)
 				return r;
 			if (r == 0)
@@ -467,7 +754,7 @@ static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void *
 #if BLOCK_ALLOC_DEPS
 			if (BLOCK_ALLOC_HEAD_VALID(&state->lfs->alloc_deps))
 			{
-				r = patch_create_empty_list(NULL, &head, alloc, head, NULL);
+				r = patch_create_empty_list(NULL, &head, head, alloc, NULL);
 				if (r < 0)
 					goto no_block;
 				FSTITCH_DEBUG_SEND(FDB_MODULE_INFO, FDB_INFO_PATCH_LABEL, head, "and");
@@ -497,6 +784,7 @@ static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void *
 			r = patchgroup_finish_head(head);
 			/* can we do better than this? */
 			assert(r >= 0);
+			INODE_SYNC_ADD(state, uf->inode, head);
 
 			/* the data written will end up depending on the zeroing
 			 * automatically, so just use the previous head here */
@@ -543,6 +831,7 @@ static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void *
 		assert(r >= 0);
 
 		head = save_head;
+		INODE_SYNC_ADD(state, uf->inode, head);
 
 		size_written += length;
 		dataoffset = 0; /* dataoffset only needed for first block */
@@ -558,6 +847,7 @@ static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void *
 			r = CALL(state->lfs, set_metadata2_fdesc, uf->inner, &fsm, 1, &head);
 			if (r < 0)
 				goto uhfs_write_exit;
+			INODE_SYNC_ADD(state, uf->inode, head);
 		}
 	}
 
@@ -568,6 +858,142 @@ uhfs_write_exit:
 	return r;
 }
 
+#if UHFS_WRITE_BEHIND
+/* pass uf's held back data on to the LFS */
+static int write_behind_flush(struct uhfs_state * state, uhfs_fdesc_t * uf)
+{
+	uhfs_fdesc_t ** ufp;
+	patchgroup_scope_t * scope;
+	int r;
+
+	if (!uf->wb_size)
+		return uf->wb_error;
+	for (ufp = &state->wb_pending; *ufp != uf; ufp = &(*ufp)->wb_next)
+		assert(*ufp);
+	*ufp = uf->wb_next;
+	uf->wb_next = NULL;
+
+	/* the data was held back only while no patchgroup scope was current */
+	scope = patchgroup_scope_get_current();
+	patchgroup_scope_set_current(NULL);
+	r = write_data(&state->cfs, (fdesc_t *) uf, NULL, uf->wb_data, uf->wb_offset, uf->wb_size);
+	patchgroup_scope_set_current(scope);
+	if (r >= 0 && r < uf->wb_size)
+		r = -ENOSPC;
+	if (r < 0)
+	{
+		fprintf(stderr, "%s(): write of %u bytes at %u to inode %u failed (%d)\n", __FUNCTION__, uf->wb_size, uf->wb_offset, uf->inode, r);
+		uf->wb_error = r;
+		uf->wb_next = state->wb_failed;
+		state->wb_failed = uf;
+	}
+	uf->wb_size = 0;
+	return r < 0 ? r : 0;
+}
+
+/* return and forget uf's unreported error, if any */
+static int write_behind_take_error(struct uhfs_state * state, uhfs_fdesc_t * uf)
+{
+	uhfs_fdesc_t ** ufp;
+	int r = uf->wb_error;
+
+	if (!r)
+		return 0;
+	for (ufp = &state->wb_failed; *ufp != uf; ufp = &(*ufp)->wb_next)
+		assert(*ufp);
+	*ufp = uf->wb_next;
+	uf->wb_next = NULL;
+	uf->wb_error = 0;
+	return r;
+}
+
+/* pass on all held back data for ino, except that of the fdesc except */
+static void write_behind_flush_inode(struct uhfs_state * state, inode_t ino, uhfs_fdesc_t * except)
+{
+	uhfs_fdesc_t * uf = state->wb_pending;
+	while (uf)
+	{
+		uhfs_fdesc_t * next = uf->wb_next;
+		if (uf->inode == ino && uf != except)
+			(void) write_behind_flush(state, uf);
+		uf = next;
+	}
+}
+
+static void write_behind_flush_all(void * arg)
+{
+	struct uhfs_state * state = (struct uhfs_state *) arg;
+	while (state->wb_pending)
+		(void) write_behind_flush(state, state->wb_pending);
+}
+
+/* pass on all held back data for ino and return the first unreported error
+ * from passing on any of its data, which otherwise only a later write
+ * through the same fdesc would see */
+static int write_behind_sync_inode(struct uhfs_state * state, inode_t ino)
+{
+	uhfs_fdesc_t * uf;
+	int r = 0;
+
+	write_behind_flush_inode(state, ino, NULL);
+	uf = state->wb_failed;
+	while (uf)
+	{
+		uhfs_fdesc_t * next = uf->wb_next;
+		if (uf->inode == ino)
+		{
+			int error = write_behind_take_error(state, uf);
+			if (!r)
+				r = error;
+		}
+		uf = next;
+	}
+	return r;
+}
+#endif
+
+static int uhfs_write(CFS_t * cfs, fdesc_t * fdesc, page_t * page, const void * data, uint32_t offset, uint32_t size)
+{
+#if UHFS_WRITE_BEHIND
+	struct uhfs_state * state = (struct uhfs_state *) cfs;
+	uhfs_fdesc_t * uf = (uhfs_fdesc_t *) fdesc;
+	/* pages can only be linked to blocks while the caller holds them, and
+	 * patchgroups need their writes made while they are current */
+	const bool hold = !page && data && size < WRITE_BEHIND_SIZE && !patchgroup_scope_get_current() && !patchgroup_engaged();
+	int r;
+
+	if (uf->wb_error)
+		return write_behind_take_error(state, uf);
+
+	/* writes through other fdescs must land in order */
+	write_behind_flush_inode(state, uf->inode, uf);
+
+	if (uf->wb_size && (!hold || offset != uf->wb_offset + uf->wb_size || uf->wb_size + size > WRITE_BEHIND_SIZE))
+	{
+		r = write_behind_flush(state, uf);
+		if (r < 0)
+			return write_behind_take_error(state, uf);
+	}
+
+	if (!hold)
+		return write_data(cfs, fdesc, page, data, offset, size);
+
+	if (!uf->wb_data && !(uf->wb_data = malloc(WRITE_BEHIND_SIZE)))
+		return write_data(cfs, fdesc, page, data, offset, size);
+	if (!uf->wb_size)
+	{
+		uf->wb_offset = offset;
+		uf->wb_next = state->wb_pending;
+		state->wb_pending = uf;
+	}
+	memcpy(uf->wb_data + uf->wb_size, data, size);
+	uf->wb_size += size;
+	return size;
+#else
+	return write_data(cfs, fdesc, page, data, offset, size);
+#endif
+}
+
 static int uhfs_get_dirent(CFS_t * cfs, fdesc_t * fdesc, dirent_t * entry, uint16_t size, uint32_t * basep)
 {
 	Dprintf("%s(%p, %p, %d, %p)\n", __FUNCTION__, fdesc, entry, size, basep);
@@ -678,7 +1104,13 @@ static int uhfs_unlink(CFS_t * cfs, inode_t parent, const char * name)
 	Dprintf("%s(%u, \"%s\")\n", __FUNCTION__, parent, name);
 	struct uhfs_state * state = (struct uhfs_state *) cfs;
 	patch_t * prev_head = state->write_head ? *state->write_head : NULL;
-	return unlink_name(cfs, parent, name, &prev_head);
+	int r;
+
+	WRITE_BEHIND_FLUSH_ALL(state);
+	r = unlink_name(cfs, parent, name, &prev_head);
+	if (r >= 0)
+		INODE_SYNC_ADD(state, parent, prev_head);
+	return r;
 }
 
 static int empty_get_metadata(void * arg, feature_id_t id, size_t size, void * data)
@@ -698,6 +1130,7 @@ static int uhfs_link(CFS_t * cfs, inode_t ino, inode_t newparent, const char * n
 	metadata_set_t initialmd = { .get = empty_get_metadata, .arg = NULL };
 	int r;
 
+	WRITE_BEHIND_FLUSH_INODE(state, ino);
 	oldf = CALL(state->lfs, lookup_inode, ino);
 	if (!oldf)
 		return -1;
@@ -741,6 +1174,8 @@ static int uhfs_link(CFS_t * cfs, inode_t ino, inode_t newparent, const char * n
 	CALL(state->lfs, free_fdesc, oldf);
 	CALL(state->lfs, free_fdesc, newf);
 
+	INODE_SYNC_ADD(state, ino, prev_head);
+	INODE_SYNC_ADD(state, newparent, prev_head);
 	return 0;
 }
 
@@ -752,6 +1187,7 @@ static int uhfs_rename(CFS_t * cfs, inode_t oldparent, const char * oldname, ino
 	inode_t ino;
 	int r;
 
+	WRITE_BEHIND_FLUSH_ALL(state);
 	r = CALL(state->lfs, lookup_name, newparent, newname, &ino);
 	if (r < 0 && r != -ENOENT)
 		return r;
@@ -767,6 +1203,13 @@ static int uhfs_rename(CFS_t * cfs, inode_t oldparent, const char * oldname, ino
 	if (r < 0)
 		return r;
 
+	INODE_SYNC_ADD(state, oldparent, prev_head);
+	if (newparent != oldparent)
+		INODE_SYNC_ADD(state, newparent, prev_head);
+#if UHFS_INODE_SYNC
+	if (CALL(state->lfs, lookup_name, newparent, newname, &ino) >= 0)
+		INODE_SYNC_ADD(state, ino, prev_head);
+#endif
 	return 0;
 }
 
@@ -804,6 +1247,8 @@ static int uhfs_mkdir(CFS_t * cfs, inode_t parent, const char * name, const meta
 
 	CALL(state->lfs, free_fdesc, f);
 
+	INODE_SYNC_ADD(state, *ino, prev_head);
+	INODE_SYNC_ADD(state, parent, prev_head);
 	return 0;
 }
 
@@ -849,7 +1294,10 @@ static int uhfs_rmdir(CFS_t * cfs, inode_t parent, const char * name)
 				if (r < 0)
 				{
 					patch_t * prev_head = state->write_head ? *state->write_head : NULL;
-					return unlink_file(cfs, ino, parent, name, f, &prev_head);
+					r = unlink_file(cfs, ino, parent, name, f, &prev_head);
+					if (r >= 0)
+						INODE_SYNC_ADD(state, parent, prev_head);
+					return r;
 				}
 			} while (r != 0);
 			retval = -ENOTEMPTY;
@@ -883,6 +1331,7 @@ static int uhfs_get_metadata(CFS_t * cfs, inode_t ino, uint32_t id, size_t size,
 	Dprintf("%s(%u, 0x%x)\n", __FUNCTION__, ino, id);
 	struct uhfs_state * state = (struct uhfs_state *) cfs;
 
+	WRITE_BEHIND_FLUSH_INODE(state, ino);
 	return CALL(state->lfs, get_metadata_inode, ino, id, size, data);
 }
 
@@ -892,7 +1341,43 @@ static int uhfs_set_metadata2(CFS_t * cfs, inode_t ino, const fsmetadata_t * fsm
 	struct uhfs_state * state = (struct uhfs_state *) cfs;
 	patch_t * prev_head = state->write_head ? *state->write_head : NULL;
 
-	return CALL(state->lfs, set_metadata2_inode, ino, fsm, nfsm, &prev_head);
+	int r;
+
+	WRITE_BEHIND_FLUSH_INODE(state, ino);
+	r = CALL(state->lfs, set_metadata2_inode, ino, fsm, nfsm, &prev_head);
+	if (r >= 0)
+		INODE_SYNC_ADD(state, ino, prev_head);
+	return r;
+}
+
+static int uhfs_sync_inode(CFS_t * cfs, inode_t ino)
+{
+	Dprintf("%s(%u)\n", __FUNCTION__, ino);
+	struct uhfs_state * state = (struct uhfs_state *) cfs;
+#if UHFS_INODE_SYNC
+	inode_sync_t * is;
+#endif
+	int r;
+
+	/* report held back writes that failed; close can not report them */
+	r = WRITE_BEHIND_SYNC_INODE(state, ino);
+	if (r < 0)
+		return r;
+#if UHFS_INODE_SYNC
+	if (state->inode_sync_lost)
+	{
+		/* everything gets written, so tracking is complete again */
+		r = fstitch_sync();
+		if (r >= 0)
+			state->inode_sync_lost = 0;
+		return r;
+	}
+	/* with nothing left to write, still make the earlier writes durable */
+	is = hash_map_find_val(state->inode_syncs, (void *) ino);
+	return fstitch_sync_patch(is ? WEAK(is->empty) : NULL);
+#else
+	return -ENOSYS;
+#endif
 }
 
 static int uhfs_destroy(CFS_t * cfs)
@@ -907,10 +1392,34 @@ static int uhfs_destroy(CFS_t * cfs)
 	if(r < 0)
 		return r;
 	modman_dec_lfs(state->lfs, cfs);
+#if UHFS_WRITE_BEHIND
+	write_behind_flush_all(state);
+	sched_unregister(write_behind_flush_all, state);
+	fstitch_sync_unregister(write_behind_flush_all, state);
+#endif
+#if UHFS_INODE_SYNC
+	if(state->inode_syncs)
+	{
+		hash_map_it_t it;
+		inode_sync_t * is;
+		hash_map_it_init(&it, state->inode_syncs);
+		while((is = hash_map_val_next(&it)))
+		{
+			patch_weak_release(&is->empty, 0);
+			inode_sync_free(is);
+		}
+		hash_map_destroy(state->inode_syncs);
+	}
+#endif
 
 	n_uhfs_instances--;
 	if(!n_uhfs_instances)
+	{
 		uhfs_fdesc_free_all();
+#if UHFS_INODE_SYNC
+		inode_sync_free_all();
+#endif
+	}
 
 	memset(state, 0, sizeof(*state));
 	free(state);
@@ -935,6 +1444,19 @@ CFS_t * uhfs_cfs(LFS_t * lfs)
 	state->lfs = lfs;
 	state->write_head = CALL(lfs, get_write_head);
 	state->nopen = 0;
+#if UHFS_WRITE_BEHIND
+	state->wb_pending = NULL;
+	state->wb_failed = NULL;
+#endif
+#if UHFS_INODE_SYNC
+	state->inode_sync_lost = 0;
+	state->inode_syncs = hash_map_create();
+	if(!state->inode_syncs)
+	{
+		free(state);
+		return NULL;
+	}
+#endif
 
 	if(modman_add_anon_cfs(cfs, __FUNCTION__))
 	{
@@ -949,6 +1471,13 @@ CFS_t * uhfs_cfs(LFS_t * lfs)
 	}
 	
 	n_uhfs_instances++;
+#if UHFS_WRITE_BEHIND
+	if(sched_register(write_behind_flush_all, state, WRITE_BEHIND_PERIOD) < 0 || fstitch_sync_register(write_behind_flush_all, state) < 0)
+	{
+		DESTROY(cfs);
+		return NULL;
+	}
+#endif
 	
 	return cfs;
 }
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <fscore/bd.h>
 #include <fscore/bdesc.h>
@@ -19,10 +20,58 @@
 // define as 1 to make writes and syncs non-synchronous
 #define RECKLESS_WRITE_SPEED 1
 
+// define as 1 to submit writes asynchronously with io_uring when available;
+// blocks are then in flight until their writes complete (and, without
+// RECKLESS_WRITE_SPEED, until a linked fdatasync completes)
+#if defined(__linux__) && REVISION_TAIL_FLIGHTS
+#define UNIX_FILE_URING 1
+#else
+#define UNIX_FILE_URING 0
+#endif
+// number of submission queue entries (at most half are outstanding writes)
+#define UNIX_FILE_URING_DEPTH 64
+
+#if UNIX_FILE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+// maximum number of blocks written by one pwritev() or read ahead at once
+#define UNIX_FILE_MAX_RUN 32
+// number of read ahead blocks kept in memory until they are read
+#define UNIX_FILE_READ_AHEAD_BUFFER 256
+
 // block io activity logging
 static FILE * block_log = NULL;
 static size_t block_log_users = 0;
 
+#if UNIX_FILE_URING
+/* one asynchronous write of a run of blocks, with their prepared data,
+ * or one asynchronous read ahead of a run of blocks */
+struct unix_file_request {
+	bool read;
+	uint16_t count;
+	ssize_t length;
+	bdesc_t * blocks[UNIX_FILE_MAX_RUN];
+	struct iovec iov[UNIX_FILE_MAX_RUN];
+};
+
+struct unix_file_ring {
+	int fd;
+	unsigned * sq_head, * sq_tail, * sq_mask, * sq_array;
+	unsigned * cq_head, * cq_tail, * cq_mask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sq_map, * cq_map;
+	size_t sq_map_size, cq_map_size, sqes_size;
+	/* entries queued but not yet submitted */
+	unsigned queued;
+	/* requests submitted but not yet completed */
+	unsigned outstanding;
+};
+#endif
+
 struct unix_file_info {
 	BD_t my_bd;
 	
@@ -30,8 +79,306 @@ struct unix_file_info {
 	int fd;
 	blockman_t blockman;
 	int user_name;
+	/* written to since the last flush */
+	bool unflushed;
+#if UNIX_FILE_URING
+	struct unix_file_ring ring;
+#endif
+	
+	int read_ahead_idx;
+	bdesc_t * read_ahead[UNIX_FILE_READ_AHEAD_BUFFER];
 };
 
+#if UNIX_FILE_URING
+/* completions for a request's write carry this tag when an fdatasync is
+ * linked after it: the request completes with the fdatasync instead */
+#define URING_WRITE_TAG ((uintptr_t) 1)
+
+static int unix_file_ring_init(struct unix_file_ring * ring)
+{
+	struct io_uring_params params;
+	
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, UNIX_FILE_URING_DEPTH, &params);
+	if(ring->fd < 0)
+	{
+		ring->fd = -1;
+		return -errno;
+	}
+	
+	ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = 0;
+	}
+	
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_map == MAP_FAILED)
+		goto error_fd;
+	if(ring->cq_map_size)
+	{
+		ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_map == MAP_FAILED)
+			goto error_sq;
+	}
+	else
+		ring->cq_map = ring->sq_map;
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED)
+		goto error_cq;
+	
+	ring->sq_head = ring->sq_map + params.sq_off.head;
+	ring->sq_tail = ring->sq_map + params.sq_off.tail;
+	ring->sq_mask = ring->sq_map + params.sq_off.ring_mask;
+	ring->sq_array = ring->sq_map + params.sq_off.array;
+	ring->cq_head = ring->cq_map + params.cq_off.head;
+	ring->cq_tail = ring->cq_map + params.cq_off.tail;
+	ring->cq_mask = ring->cq_map + params.cq_off.ring_mask;
+	ring->cqes = ring->cq_map + params.cq_off.cqes;
+	return 0;
+	
+  error_cq:
+	if(ring->cq_map_size)
+		munmap(ring->cq_map, ring->cq_map_size);
+  error_sq:
+	munmap(ring->sq_map, ring->sq_map_size);
+  error_fd:
+	close(ring->fd);
+	ring->fd = -1;
+	return -ENOMEM;
+}
+
+static void unix_file_ring_destroy(struct unix_file_ring * ring)
+{
+	if(ring->fd < 0)
+		return;
+	munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_map_size)
+		munmap(ring->cq_map, ring->cq_map_size);
+	munmap(ring->sq_map, ring->sq_map_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+static struct io_uring_sqe * unix_file_ring_get_sqe(struct unix_file_ring * ring)
+{
+	unsigned index = (*ring->sq_tail + ring->queued) & *ring->sq_mask;
+	struct io_uring_sqe * sqe = &ring->sqes[index];
+	ring->sq_array[index] = index;
+	ring->queued++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/* submit the queued entries, and wait for a completion if 'wait' is set */
+static void unix_file_ring_enter(struct unix_file_ring * ring, bool wait)
+{
+	unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	if(ring->queued)
+		__atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+	while(ring->queued || wait)
+	{
+		int r = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait ? 1 : 0, flags, NULL, 0);
+		if(r < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("io_uring_enter");
+			assert(0);
+		}
+		ring->queued -= r;
+		wait = 0;
+	}
+}
+
+/* the landing source: request landings for completed writes
+ * (and finish completed read aheads) */
+static int unix_file_ring_reap(void * arg, bool wait)
+{
+	struct unix_file_info * info = (struct unix_file_info *) arg;
+	struct unix_file_ring * ring = &info->ring;
+	unsigned head, tail;
+	
+	if(wait && ring->outstanding)
+		unix_file_ring_enter(ring, 1);
+	
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head++)
+	{
+		struct io_uring_cqe * cqe = &ring->cqes[head & *ring->cq_mask];
+		uintptr_t data = (uintptr_t) cqe->user_data;
+		struct unix_file_request * request = (struct unix_file_request *) (data & ~URING_WRITE_TAG);
+		uint16_t i;
+		
+		if(cqe->res < 0)
+		{
+			errno = -cqe->res;
+			if(request->read)
+				perror("io_uring read");
+			else
+				perror((data & URING_WRITE_TAG) || RECKLESS_WRITE_SPEED ? "io_uring write" : "io_uring fdatasync");
+			assert(0);
+		}
+		if(request->read)
+		{
+			assert(cqe->res == request->length);
+			for(i = 0; i < request->count; i++)
+			{
+				request->blocks[i]->synthetic = 0;
+				request->blocks[i]->read_ahead = 0;
+				bdesc_release(&request->blocks[i]);
+			}
+			free(request);
+			ring->outstanding--;
+			continue;
+		}
+		if(data & URING_WRITE_TAG)
+		{
+			assert(cqe->res == request->length);
+			continue;
+		}
+		/* no fdatasync is linked when this is set */
+		if(RECKLESS_WRITE_SPEED)
+			assert(cqe->res == request->length);
+		
+		for(i = 0; i < request->count; i++)
+		{
+			revision_buffer_put(request->iov[i].iov_base, request->iov[i].iov_len);
+			revision_tail_request_landing(request->blocks[i]);
+		}
+		free(request);
+		ring->outstanding--;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	
+	return ring->outstanding;
+}
+
+/* write a run of blocks asynchronously: the blocks are in flight until the
+ * write (and the linked fdatasync, if any) completes */
+static int unix_file_ring_write(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	struct unix_file_info * info = (struct unix_file_info *) object;
+	struct unix_file_ring * ring = &info->ring;
+	struct unix_file_request * request;
+	struct io_uring_sqe * sqe;
+	int revision_back[UNIX_FILE_MAX_RUN];
+	ssize_t length = 0;
+	uint32_t block_number;
+	uint16_t i;
+	int r;
+	
+	/* a block must land before it can be written again */
+	for(i = 0; i < count; i++)
+		while(blocks[i]->in_flight)
+		{
+			revision_tail_wait_for_landing_requests();
+			revision_tail_process_landing_requests();
+		}
+	/* each request can use two entries */
+	while(ring->outstanding >= UNIX_FILE_URING_DEPTH / 2)
+		unix_file_ring_reap(info, 1);
+	
+	for(i = 0; i < count; i++)
+	{
+		/* make sure it's a valid block */
+		assert(blocks[i]->length && number + (length + blocks[i]->length) / object->blocksize <= object->numblocks);
+		length += blocks[i]->length;
+	}
+	request = malloc(sizeof(*request));
+	if(!request)
+		return -ENOMEM;
+	request->read = 0;
+	request->count = count;
+	request->length = length;
+	
+	/* the blocks may change while in flight, so each write gets a copy */
+	for(i = 0; i < count; i++)
+	{
+		bdesc_t * block = blocks[i];
+		uint8_t * data = revision_buffer_get(block->length);
+		if(!data)
+		{
+			while(i--)
+				revision_buffer_put(request->iov[i].iov_base, request->iov[i].iov_len);
+			free(request);
+			return -ENOMEM;
+		}
+#if REVISION_TAIL_INPLACE
+		revision_back[i] = revision_tail_prepare(block, object);
+		if(revision_back[i] >= 0)
+			memcpy(data, block->data, block->length);
+#else
+		revision_back[i] = revision_tail_prepare(block, object, data);
+#endif
+		if(revision_back[i] < 0)
+		{
+			kpanic("revision_tail_prepare gave: %d\n", revision_back[i]);
+			return revision_back[i];
+		}
+		request->blocks[i] = block;
+		request->iov[i].iov_base = data;
+		request->iov[i].iov_len = block->length;
+	}
+	
+	sqe = unix_file_ring_get_sqe(ring);
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = info->fd;
+	sqe->addr = (uintptr_t) request->iov;
+	sqe->len = count;
+	sqe->off = (off_t) number * object->blocksize;
+#if RECKLESS_WRITE_SPEED
+	sqe->user_data = (uintptr_t) request;
+#else
+	sqe->user_data = (uintptr_t) request | URING_WRITE_TAG;
+	sqe->flags = IOSQE_IO_LINK;
+	
+	/* the blocks land only once the write is on the disk */
+	sqe = unix_file_ring_get_sqe(ring);
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = info->fd;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	sqe->user_data = (uintptr_t) request;
+#endif
+	
+	for(i = 0; i < count; i++)
+	{
+		r = revision_tail_schedule_flight();
+		assert(!r);
+	}
+	ring->outstanding++;
+	unix_file_ring_enter(ring, 0);
+	
+	block_number = number;
+	for(i = 0; i < count; i++)
+	{
+		bdesc_t * block = blocks[i];
+		
+		if(block_log)
+			fprintf(block_log, "%d write %u %d\n", info->user_name, block_number, block->flags);
+		
+		r = revision_tail_inflight_ack(block, object);
+		if(r < 0)
+		{
+			kpanic("revision_tail_inflight_ack gave error: %i\n", r);
+			return r;
+		}
+		
+		if(revision_back[i] != r)
+			printf("%s(): block %u: revision_back (%d) != revision_forward (%d)\n", __FUNCTION__, block_number, revision_back[i], r);
+		block_number += block->length / object->blocksize;
+	}
+	
+	return count;
+}
+#endif
+
 static bdesc_t * unix_file_bd_read_block(BD_t * object, uint32_t number, uint16_t count, page_t * page)
 {
 	struct unix_file_info * info = (struct unix_file_info *) object;
@@ -47,8 +394,20 @@ static bdesc_t * unix_file_bd_read_block(BD_t * object, uint32_t number, uint16_
 	{
 		assert(bdesc->length == count * object->blocksize);
 		bdesc_ensure_linked_page(bdesc, page);
+#if UNIX_FILE_URING
+		while(bdesc->read_ahead)
+			unix_file_ring_reap(info, 1);
+#endif
 		if(!bdesc->synthetic)
 			return bdesc;
+#if UNIX_FILE_URING
+		/* read what an outstanding write leaves on the disk */
+		while(bdesc->in_flight)
+		{
+			revision_tail_wait_for_landing_requests();
+			revision_tail_process_landing_requests();
+		}
+#endif
 	}
 	else
 	{
@@ -98,6 +457,11 @@ static bdesc_t * unix_file_bd_synthetic_read_block(BD_t * object, uint32_t numbe
 	{
 		assert(bdesc->length == count * object->blocksize);
 		bdesc_ensure_linked_page(bdesc, page);
+#if UNIX_FILE_URING
+		/* don't let a read ahead overwrite the new contents */
+		while(bdesc->read_ahead)
+			unix_file_ring_reap(info, 1);
+#endif
 		return bdesc;
 	}
 
@@ -113,64 +477,213 @@ static bdesc_t * unix_file_bd_synthetic_read_block(BD_t * object, uint32_t numbe
 	return bdesc;
 }
 
-static int unix_file_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
+/* read a run of consecutive read ahead blocks, which must already be in
+ * the block manager and marked synthetic and read_ahead */
+static void unix_file_read_run(struct unix_file_info * info, bdesc_t ** blocks, uint16_t run, uint32_t number)
 {
-	struct unix_file_info * info = (struct unix_file_info *) object;
-	int r, revision_back;
-	off_t seeked;
-
-	/* make sure it's a valid block */
-	assert(block->length && number + block->length / object->blocksize <= object->numblocks);
-
-	seeked = lseek(info->fd, number * object->blocksize, SEEK_SET);
-	if(seeked != number * object->blocksize)
+	struct iovec iov[UNIX_FILE_MAX_RUN];
+	ssize_t length = 0;
+	uint16_t i;
+	
+	if(block_log)
 	{
-		perror("lseek");
-		assert(0);
+		uint32_t block_number = number;
+		for(i = 0; i < run; i++)
+		{
+			fprintf(block_log, "%d read %u %d\n", info->user_name, block_number, 0);
+			block_number += blocks[i]->length / info->my_bd.blocksize;
+		}
 	}
 	
-#if REVISION_TAIL_INPLACE
-	revision_back = revision_tail_prepare(block, object);
-	if(revision_back < 0)
+#if UNIX_FILE_URING
+	if(info->ring.fd >= 0)
 	{
-		kpanic("revision_tail_prepare gave: %d\n", revision_back);
-		return revision_back;
+		struct unix_file_ring * ring = &info->ring;
+		struct unix_file_request * request = malloc(sizeof(*request));
+		if(request)
+		{
+			struct io_uring_sqe * sqe;
+			while(ring->outstanding >= UNIX_FILE_URING_DEPTH / 2)
+				unix_file_ring_reap(info, 1);
+			request->read = 1;
+			request->count = run;
+			for(i = 0; i < run; i++)
+			{
+				request->blocks[i] = bdesc_retain(blocks[i]);
+				request->iov[i].iov_base = bdesc_data(blocks[i]);
+				request->iov[i].iov_len = blocks[i]->length;
+				length += blocks[i]->length;
+			}
+			request->length = length;
+			
+			sqe = unix_file_ring_get_sqe(ring);
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = info->fd;
+			sqe->addr = (uintptr_t) request->iov;
+			sqe->len = run;
+			sqe->off = (off_t) number * info->my_bd.blocksize;
+			sqe->user_data = (uintptr_t) request;
+			ring->outstanding++;
+			unix_file_ring_enter(ring, 0);
+			return;
+		}
 	}
-	if(write(info->fd, block->data, block->length) != block->length)
+#endif
+	
+	for(i = 0; i < run; i++)
 	{
-		perror("write");
-		assert(0);
+		iov[i].iov_base = bdesc_data(blocks[i]);
+		iov[i].iov_len = blocks[i]->length;
+		length += blocks[i]->length;
 	}
-#else
-	static uint8_t buffer[4096];
-	assert(block->length <= 4096);
-	revision_back = revision_tail_prepare(block, object, buffer);
-	if(revision_back < 0)
+	if(preadv(info->fd, iov, run, (off_t) number * info->my_bd.blocksize) != length)
 	{
-		kpanic("revision_tail_prepare gave: %d\n", revision_back);
-		return revision_back;
+		perror("preadv");
+		assert(0);
 	}
-	if(write(info->fd, buffer, block->length) != block->length)
+	for(i = 0; i < run; i++)
 	{
-		perror("write");
-		assert(0);
+		blocks[i]->synthetic = 0;
+		blocks[i]->read_ahead = 0;
 	}
-#endif
-
-	if(block_log)
-		fprintf(block_log, "%d write %u %d\n", info->user_name, number, block->flags);
+}
 
-	r = revision_tail_acknowledge(block, object);
-	if(r < 0)
+static int unix_file_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct unix_file_info * info = (struct unix_file_info *) object;
+	bdesc_t * blocks[UNIX_FILE_MAX_RUN];
+	uint16_t i, run = 0;
+	int started = 0;
+	
+	if(!count || number >= object->numblocks)
+		return 0;
+	/* no more than we can keep around until they are read */
+	if(nbdescs > UNIX_FILE_READ_AHEAD_BUFFER)
+		nbdescs = UNIX_FILE_READ_AHEAD_BUFFER;
+	if(number + count * nbdescs > object->numblocks)
+		nbdescs = (object->numblocks - number) / count;
+	
+	/* read each run of blocks that are not yet in memory,
+	 * at most UNIX_FILE_MAX_RUN of them at a time */
+	for(i = 0; i <= nbdescs; i++)
 	{
-		kpanic("revision_tail_acknowledge gave error: %i\n", r);
-		return r;
+		uint32_t i_number = number + i * count;
+		if(run == UNIX_FILE_MAX_RUN)
+		{
+			unix_file_read_run(info, blocks, run, i_number - run * count);
+			started += run * count;
+			run = 0;
+		}
+		if(i < nbdescs && !blockman_lookup(&info->blockman, i_number))
+		{
+			bdesc_t * bdesc = bdesc_alloc(i_number, object->blocksize, count, NULL);
+			if(bdesc)
+			{
+				bdesc_autorelease(bdesc);
+				bdesc->synthetic = 1;
+				bdesc->read_ahead = 1;
+				blockman_add(&info->blockman, bdesc, i_number);
+				
+				/* keep it around for a while */
+				bdesc_retain(bdesc);
+				if(info->read_ahead[info->read_ahead_idx])
+					bdesc_release(&info->read_ahead[info->read_ahead_idx]);
+				info->read_ahead[info->read_ahead_idx] = bdesc;
+				if(++info->read_ahead_idx == UNIX_FILE_READ_AHEAD_BUFFER)
+					info->read_ahead_idx = 0;
+				
+				blocks[run++] = bdesc;
+				continue;
+			}
+		}
+		if(run)
+		{
+			unix_file_read_run(info, blocks, run, i_number - run * count);
+			started += run * count;
+			run = 0;
+		}
 	}
+	
+	return started;
+}
 
-	if(revision_back != r)
-		printf("%s(): block %u: revision_back (%d) != revision_forward (%d)\n", __FUNCTION__, number, revision_back, r);
+static int unix_file_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	struct unix_file_info * info = (struct unix_file_info *) object;
+	struct iovec iov[UNIX_FILE_MAX_RUN];
+	int revision_back[UNIX_FILE_MAX_RUN];
+	ssize_t length = 0;
+	uint32_t block_number;
+	uint16_t i;
+	int r;
+	
+	if(count > UNIX_FILE_MAX_RUN)
+		count = UNIX_FILE_MAX_RUN;
+	info->unflushed = 1;
+	
+#if UNIX_FILE_URING
+	if(info->ring.fd >= 0)
+		return unix_file_ring_write(object, blocks, count, number);
+#endif
+	
+	for(i = 0; i < count; i++)
+	{
+		bdesc_t * block = blocks[i];
+		/* make sure it's a valid block */
+		assert(block->length && number + (length + block->length) / object->blocksize <= object->numblocks);
+#if REVISION_TAIL_INPLACE
+		revision_back[i] = revision_tail_prepare(block, object);
+		iov[i].iov_base = block->data;
+#else
+		/* the write is done before we return, so the
+		 * block's own data can be used if it is ready */
+		revision_back[i] = revision_tail_prepare_direct(block, object, (uint8_t **) &iov[i].iov_base);
+#endif
+		if(revision_back[i] < 0)
+		{
+			kpanic("revision_tail_prepare gave: %d\n", revision_back[i]);
+			return revision_back[i];
+		}
+		iov[i].iov_len = block->length;
+		length += block->length;
+	}
+	
+	if(pwritev(info->fd, iov, count, (off_t) number * object->blocksize) != length)
+	{
+		perror("pwritev");
+		assert(0);
+	}
+	
+	block_number = number;
+	for(i = 0; i < count; i++)
+	{
+		bdesc_t * block = blocks[i];
+		
+#if !REVISION_TAIL_INPLACE
+		revision_tail_release_direct(block, iov[i].iov_base);
+#endif
+		if(block_log)
+			fprintf(block_log, "%d write %u %d\n", info->user_name, block_number, block->flags);
+		
+		r = revision_tail_acknowledge(block, object);
+		if(r < 0)
+		{
+			kpanic("revision_tail_acknowledge gave error: %i\n", r);
+			return r;
+		}
+		
+		if(revision_back[i] != r)
+			printf("%s(): block %u: revision_back (%d) != revision_forward (%d)\n", __FUNCTION__, block_number, revision_back[i], r);
+		block_number += block->length / object->blocksize;
+	}
+	
+	return count;
+}
 
-	return 0;
+static int unix_file_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
+{
+	int r = unix_file_bd_write_blocks(object, &block, 1, number);
+	return (r < 0) ? r : 0;
 }
 
 /* WARNING: From man 2 sync:
@@ -181,14 +694,26 @@ static int unix_file_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 // NOTE: Mac OS X has the fcntl() command F_FULLFSYNC to flush a drive's buffer
 static int unix_file_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
-#if !RECKLESS_WRITE_SPEED
 	struct unix_file_info * info = (struct unix_file_info *) object;
-	if(fsync(info->fd))
+#if UNIX_FILE_URING
+	/* the flush covers the writes still in flight */
+	if(info->ring.fd >= 0)
+	{
+		while(unix_file_ring_reap(info, 1));
+		/* and lands them, so their patches are not left in flight */
+		revision_tail_process_landing_requests();
+	}
+#endif
+#if !RECKLESS_WRITE_SPEED
+	/* only files we wrote need syncing: a journal on another
+	 * device can then be flushed without touching this one */
+	if(info->unflushed && fsync(info->fd))
 	{
 		perror("fsync");
 		assert(0);
 	}
 #endif
+	info->unflushed = 0;
 	/* FLUSH_EMPTY is OK even if we did flush something,
 	 * because unix_file_bd is a terminal BD */
 	return FLUSH_EMPTY;
@@ -213,6 +738,19 @@ static int unix_file_bd_destroy(BD_t * bd)
 	if(r < 0)
 		return r;
 
+#if UNIX_FILE_URING
+	if(info->ring.fd >= 0)
+	{
+		while(unix_file_ring_reap(info, 1))
+			;
+		revision_tail_process_landing_requests();
+		revision_tail_remove_landing_source(unix_file_ring_reap, info);
+		unix_file_ring_destroy(&info->ring);
+	}
+#endif
+	for(r = 0; r < UNIX_FILE_READ_AHEAD_BUFFER; r++)
+		if(info->read_ahead[r])
+			bdesc_release(&info->read_ahead[r]);
 	blockman_destroy(&info->blockman);
 
 	close(info->fd);
@@ -264,25 +802,38 @@ BD_t * unix_file_bd(const char * fname, uint16_t blocksize)
 		return NULL;
 	}
 	
+#if UNIX_FILE_URING
+	/* fall back to synchronous writes without io_uring */
+	if(unix_file_ring_init(&info->ring) >= 0 && revision_tail_add_landing_source(unix_file_ring_reap, info) < 0)
+		unix_file_ring_destroy(&info->ring);
+#endif
+	
 	// TODO: use O_DIRECT open flag on linux
 	// NOTE: linux implements O_DSYNC using O_SYNC :(
 #if RECKLESS_WRITE_SPEED
 	info->fd = open(fname, O_RDWR, 0);
 #else
-	info->fd = open(fname, O_RDWR | O_DSYNC, 0);
+# if UNIX_FILE_URING
+	/* with io_uring, each write is followed by a linked fdatasync */
+	if(info->ring.fd >= 0)
+		info->fd = open(fname, O_RDWR, 0);
+	else
+# endif
+		info->fd = open(fname, O_RDWR | O_DSYNC, 0);
 #endif
-	if(!info->fd == -1)
+	if(info->fd == -1)
 	{
 		perror("open");
-		free(info);
-		return NULL;
+		goto error_ring;
 	}
 	if(blockman_init(&info->blockman) < 0)
 	{
 		close(info->fd);
-		free(info);
-		return NULL;
+		goto error_ring;
 	}
+	info->unflushed = 0;
+	info->read_ahead_idx = 0;
+	memset(info->read_ahead, 0, sizeof(info->read_ahead));
 
 	BD_INIT(bd, unix_file_bd);
 	bd->level = 0;
@@ -315,4 +866,15 @@ BD_t * unix_file_bd(const char * fname, uint16_t blocksize)
 	info->user_name = block_log_users;
 	
 	return bd;
+	
+  error_ring:
+#if UNIX_FILE_URING
+	if(info->ring.fd >= 0)
+	{
+		revision_tail_remove_landing_source(unix_file_ring_reap, info);
+		unix_file_ring_destroy(&info->ring);
+	}
+#endif
+	free(info);
+	return NULL;
 }
@@ -29,6 +29,11 @@ static bdesc_t * unlink_bd_synthetic_read_block(BD_t * object, uint32_t number,
 	return CALL(((struct unlink_info *) object)->bd, synthetic_read_block, number, count, page);
 }
 
+static int unlink_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	return CALL(((struct unlink_info *) object)->bd, read_ahead, number, count, nbdescs);
+}
+
 static int unlink_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct unlink_info * info = (struct unlink_info *) object;
@@ -100,6 +105,11 @@ static int unlink_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number
 	return CALL(info->bd, write_block, block, number);
 }
 
+static int unlink_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int unlink_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;
@@ -1282,6 +1282,13 @@ static uint32_t waffle_get_file_block(LFS_t * object, fdesc_t * file, uint32_t o
 	return waffle_get_inode_block(info, f_ip(fdesc), offset);
 }
 
+static uint32_t waffle_get_file_extent(LFS_t * object, fdesc_t * file, uint32_t offset, uint32_t * nblocks)
+{
+	uint32_t number = waffle_get_file_block(object, file, offset);
+	*nblocks = (number == INVALID_BLOCK) ? 0 : 1;
+	return number;
+}
+
 static int waffle_get_dirent(LFS_t * object, fdesc_t * file, struct dirent * entry, uint16_t size, uint32_t * basep)
 {
 	Dprintf("%s %p, %u\n", __FUNCTION__, basep, *basep);
@@ -1766,6 +1773,18 @@ static int waffle_free_block(LFS_t * object, fdesc_t * file, uint32_t block, pat
 	return waffle_mark_deallocated(info, block);
 }
 
+static int waffle_free_blocks(LFS_t * object, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head)
+{
+	uint32_t i;
+	for(i = 0; i < count; i++)
+	{
+		int r = waffle_free_block(object, file, blocks[i], head);
+		if(r < 0)
+			return r;
+	}
+	return 0;
+}
+
 static int waffle_remove_name(LFS_t * object, inode_t parent, const char * name, patch_t ** head)
 {
 	Dprintf("%s %u:%s\n", __FUNCTION__, parent, name);
@@ -6,6 +6,11 @@
 #include <lib/jiffies.h>
 #include <lib/hash_map.h>
 #include <lib/pool.h>
+#include <lib/vector.h>
+
+#ifdef __KERNEL__
+#include <linux/mm.h>
+#endif
 
 #include <fscore/fstitchd.h>
 #include <fscore/bd.h>
@@ -15,6 +20,7 @@
 #include <fscore/sched.h>
 #include <fscore/debug.h>
 #include <fscore/revision.h>
+#include <fscore/magic.h>
 
 #include <modules/wb2_cache_bd.h>
 
@@ -30,24 +36,115 @@ KERNEL_TIMING(wait);
 
 #define MAP_SIZE 32768
 
+/* adapt the cache limits to the hit rate and to free memory */
+#define WB2_ADAPT 1
+#define DEBUG_ADAPT 0
+
+/* print the cache statistics when the cache is destroyed */
+#define DEBUG_STATS 0
+/* the limit on all blocks stays within [initial / MIN_DIV, initial * MAX_MUL] */
+#define ADAPT_MIN_DIV 8
+#define ADAPT_MAX_MUL 4
+/* each adjustment moves a limit by this fraction of its current value */
+#define ADAPT_STEP_DIV 8
+/* grow when at least this fraction of misses are ghost hits */
+#define ADAPT_GHOST_DIV 8
+#define ADAPT_GHOST_MIN 8
+/* shrink below this much free memory, grow only above the high mark */
+#define ADAPT_FREE_LOW_PCT 5
+#define ADAPT_FREE_HIGH_PCT 15
+/* the dirty limit is a fraction of the block limit, in 16ths */
+#define ADAPT_DIRTY_MAX16 12
+/* blocks written back sooner than this after becoming dirty are "young" */
+#define ADAPT_DIRTY_YOUNG (2 * FLUSH_PERIOD)
+/* remember about initial / GHOST_DIV evicted blocks, at least GHOST_MIN */
+#define GHOST_DIV 2
+#define GHOST_MIN 1024
+
+/* write ready blocks in ascending block number order when flushing and
+ * preening (clipping still writes the least recently dirtied blocks) */
+#define WB2_ELEVATOR 1
+/* with the elevator, write contiguous ready blocks with one write_blocks()
+ * call of at most this many blocks (1 to write blocks one at a time) */
+#define WB2_MAX_RUN 32
+/* how deep to follow blockless befores when checking a run's dependencies */
+#define WB2_RUN_DEPTH 4
+
+/* detect sequential read streams by block number and read ahead of them,
+ * starting with READAHEAD_MIN blocks and doubling up to READAHEAD_MAX */
+#define WB2_READAHEAD 1
+#define READAHEAD_STREAMS 4
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 32
+
+/* replacement policy used by wb2_cache_bd() */
+#define WB2_DEFAULT_POLICY WB2_POLICY_2Q
+/* with 2Q, blocks seen once take up to this fraction of soft_blocks (1/n) */
+#define TWOQ_IN_DIV 4
+
+struct lru_list {
+	bdesc_t * first;
+	bdesc_t * last;
+};
+
 /* the all list is ordered by read/write usage, while the dirty list is ordered by write usage:
  * all.first -> most recently used -> next -> next -> least recently used <- all.last
- * dirty.first -> most recently written -> next -> next -> least recently written <- dirty.last */
+ * dirty.first -> most recently written -> next -> next -> least recently written <- dirty.last
+ * With the 2Q policy, blocks that are not recently evicted go on the in list
+ * instead (in the order they were read) and move to the all list only if
+ * they are read again after being evicted. */
 struct cache_info {
 	BD_t my_bd;
 	
 	BD_t * bd;
+	enum wb2_policy policy;
 	uint32_t soft_blocks, blocks;
 	uint32_t soft_dblocks, dblocks;
 	uint32_t soft_dblocks_low, soft_dblocks_high;
-	struct {
-		bdesc_t * first;
-		bdesc_t * last;
-	} all, dirty;
+	uint32_t in_blocks;
+	struct lru_list all, in, dirty;
 	
 	/* map from block number to bdesc */
 	uint32_t map_capacity;
 	bdesc_t ** map;
+	
+#if WB2_ELEVATOR
+	/* ready blocks for the current batch, and where the last batch ended */
+	vector_t * elevator;
+	uint32_t elevator_next;
+	/* the run of contiguous blocks (and their slices) being built */
+	bdesc_t * run_blocks[WB2_MAX_RUN];
+	revision_slice_t run_slices[WB2_MAX_RUN];
+	uint16_t run_count;
+#endif
+	
+#if WB2_READAHEAD
+	/* sequential read streams, replaced least recently used first */
+	struct wb2_stream {
+		/* the block a sequential reader reads next */
+		uint32_t next;
+		/* the first block not yet read ahead */
+		uint32_t ahead;
+		/* the next read ahead size, or 0 if not yet sequential */
+		uint16_t window;
+		uint32_t used;
+	} streams[READAHEAD_STREAMS];
+	uint32_t stream_clock;
+#endif
+	
+	/* recently evicted block numbers, hashed */
+	uint32_t * ghost;
+	uint32_t ghost_mask;
+#if WB2_ADAPT
+	/* dirty limit as a fraction of soft_blocks, in 16ths */
+	uint32_t dirty16, dirty16_base;
+	/* counts since the last adaptation */
+	struct {
+		uint32_t misses, ghost_hits;
+		uint32_t clips, flushed, flushed_young;
+	} period;
+#endif
+	struct wb2_cache_stats stats;
 };
 
 static inline bdesc_t * wb2_map_get_block(struct cache_info * info, uint32_t number)
@@ -78,28 +175,52 @@ static inline void wb2_map_remove_block(bdesc_t * block)
 		block->block_hash.next->block_hash.pprev = block->block_hash.pprev;
 }
 
-/* we are guaranteed that the block is not already in the list */
-static void wb2_push_block(struct cache_info * info, bdesc_t * block, uint32_t number)
+static inline uint32_t * wb2_ghost_slot(struct cache_info * info, uint32_t number)
 {
-#if DIRTY_QUEUE_REORDERING
-	block->pass = 0;
-	block->block_after_number = INVALID_BLOCK;
-	block->block_after_pass = 0;
-#endif
+	return &info->ghost[(number * 2654435761u) & info->ghost_mask];
+}
+
+/* remember that 'number' was evicted */
+static inline void wb2_ghost_add(struct cache_info * info, uint32_t number)
+{
+	*wb2_ghost_slot(info, number) = number;
+}
+
+/* return whether 'number' was evicted recently, and forget it */
+static inline bool wb2_ghost_take(struct cache_info * info, uint32_t number)
+{
+	uint32_t * slot = wb2_ghost_slot(info, number);
+	if(*slot != number)
+		return 0;
+	*slot = INVALID_BLOCK;
+	return 1;
+}
+
+#define wb2_lru_list(info, block) ((block)->cache_in ? &(info)->in : &(info)->all)
+
+/* we are guaranteed that the block is not already in the list;
+ * 'evicted' says whether it was recently evicted from the cache */
+static void wb2_push_block(struct cache_info * info, bdesc_t * block, uint32_t number, bool evicted)
+{
+	struct lru_list * list;
+	block->cache_in = info->policy == WB2_POLICY_2Q && !evicted;
+	list = wb2_lru_list(info, block);
 	block->lru_all.prev = NULL;
-	block->lru_all.next = info->all.first;
+	block->lru_all.next = list->first;
 	block->lru_dirty.prev = NULL;
 	block->lru_dirty.next = NULL;
 	
 	assert(!wb2_map_get_block(info, number));
 	wb2_map_put_block(info, block, number);
 	
-	info->all.first = block;
+	list->first = block;
 	if(block->lru_all.next)
 		block->lru_all.next->lru_all.prev = block;
 	else
-		info->all.last = block;
+		list->last = block;
 	info->blocks++;
+	if(block->cache_in)
+		info->in_blocks++;
 	
 	bdesc_retain(block);
 }
@@ -107,6 +228,7 @@ static void wb2_push_block(struct cache_info * info, bdesc_t * block, uint32_t n
 /* we are guaranteed that the block is not already in the list */
 static void wb2_push_dirty(struct cache_info * info, bdesc_t * block)
 {
+	block->dirty_time = jiffy_time();
 	block->lru_dirty.prev = NULL;
 	block->lru_dirty.next = info->dirty.first;
 	
@@ -124,16 +246,19 @@ static void wb2_push_dirty(struct cache_info * info, bdesc_t * block)
 
 static void wb2_pop_slot(struct cache_info * info, bdesc_t * block)
 {
+	struct lru_list * list = wb2_lru_list(info, block);
 	assert(wb2_map_get_block(info, block->cache_number) == block);
 	
 	if(block->lru_all.prev)
 		block->lru_all.prev->lru_all.next = block->lru_all.next;
 	else
-		info->all.first = block->lru_all.next;
+		list->first = block->lru_all.next;
 	if(block->lru_all.next)
 		block->lru_all.next->lru_all.prev = block->lru_all.prev;
 	else
-		info->all.last = block->lru_all.prev;
+		list->last = block->lru_all.prev;
+	if(block->cache_in)
+		info->in_blocks--;
 	if(wb2_dirty_slot(info, block))
 	{
 		if(block->lru_dirty.prev)
@@ -150,6 +275,19 @@ static void wb2_pop_slot(struct cache_info * info, bdesc_t * block)
 	bdesc_release(&block);
 }
 
+static void wb2_account_dirty_age(struct cache_info * info, int age)
+{
+	int bucket = 0, seconds;
+	for(seconds = age / HZ; seconds > 0 && bucket < WB2_DIRTY_AGE_BUCKETS - 1; seconds >>= 1)
+		bucket++;
+	info->stats.dirty_age[bucket]++;
+#if WB2_ADAPT
+	info->period.flushed++;
+	if(age < ADAPT_DIRTY_YOUNG)
+		info->period.flushed_young++;
+#endif
+}
+
 static void wb2_pop_slot_dirty(struct cache_info * info, bdesc_t * block)
 {
 	assert(wb2_dirty_slot(info, block));
@@ -166,12 +304,13 @@ static void wb2_pop_slot_dirty(struct cache_info * info, bdesc_t * block)
 	/* if we make it below the low mark, set the current mark high */
 	if(--info->dblocks <= info->soft_dblocks_low)
 		info->soft_dblocks = info->soft_dblocks_high;
+	wb2_account_dirty_age(info, jiffy_time() - block->dirty_time);
 }
 
 static void wb2_touch_block_read(struct cache_info * info, bdesc_t * block)
 {
-	/* already the first? */
-	if(info->all.first == block)
+	/* already the first? the in list is FIFO, so leave those alone too */
+	if(info->all.first == block || block->cache_in)
 		return;
 	
 	/* must have a prev, so detach it */
@@ -245,43 +384,198 @@ static int wb2_flush_block(BD_t * object, bdesc_t * block, int * delay)
 	return r;
 }
 
-#if DIRTY_QUEUE_REORDERING
-static bdesc_t * wb2_find_block_before(BD_t * object, patch_t * patch, bdesc_t * start_block)
+#if WB2_ELEVATOR
+static int wb2_block_number_compare(const void * a, const void * b)
 {
-	patchdep_t * dep = patch->befores;
-	for(; dep; dep = dep->before.next)
+	const bdesc_t * x = *(const bdesc_t **) a;
+	const bdesc_t * y = *(const bdesc_t **) b;
+	if(x->cache_number < y->cache_number)
+		return -1;
+	return x->cache_number > y->cache_number;
+}
+
+/* Does 'patch' depend, possibly through blockless patches, on a patch on one
+ * of the blocks in the pending run? Blocks within one run may be written in
+ * any order, so such a patch must wait for the next run. Deep chains of
+ * blockless patches are assumed to depend on the run. */
+static bool wb2_run_depends(struct cache_info * info, patch_t * patch, int depth)
+{
+	patchdep_t * dep;
+	for(dep = patch->befores; dep; dep = dep->before.next)
 	{
-		patch_t * before = dep->before.desc;
-		if(before->owner != object)
-			continue;
+		patch_t * before = dep->before.patch;
+		uint16_t i;
 		if(!before->block)
 		{
-			bdesc_t * block = wb2_find_block_before(object, before, start_block);
-			if(block)
-				return block;
+			if(!depth || wb2_run_depends(info, before, depth - 1))
+				return 1;
+			continue;
 		}
-		else if(before->block->ddesc != start_block->ddesc)
-			return before->block;
+		for(i = 0; i < info->run_count; i++)
+			if(before->block == info->run_blocks[i])
+				return 1;
 	}
-	return NULL;
+	return 0;
 }
 
-/* move "slot" to before "before" */
-static void wb2_bounce_block_write(struct cache_info * info, bdesc_t * block, bdesc_t * before)
+/* Write the pending run with one write_blocks() call and clear it. Returns
+ * the number of blocks that were written. */
+static int wb2_run_write(BD_t * object, int * delay)
 {
-	wb2_pop_slot_dirty(info, block);
-	block->lru_dirty.next = before;
-	block->lru_dirty.prev = before->lru_dirty.prev;
-	before->lru_dirty.prev = block;
-	if(block->lru_dirty.prev)
-		block->lru_dirty.prev->lru_dirty.next = block;
-	else
-		info->dirty.first = block;
-	/* there is no way we could be putting this block at the end
-	 * of the queue, since it's going before some other block */
-	/* if we go above the high mark, set the current mark low */
-	if(++info->dblocks > info->soft_dblocks_high)
-		info->soft_dblocks = info->soft_dblocks_low;
+	struct cache_info * info = (struct cache_info *) object;
+	int start = jiffy_time();
+	int i, r;
+	
+	if(!info->run_count)
+		return 0;
+	
+	r = CALL(info->bd, write_blocks, info->run_blocks, info->run_count, info->run_blocks[0]->cache_number);
+	if(r < 0)
+		r = 0;
+	*delay = jiffy_time() - start;
+	
+	/* pull up what was not written, in the reverse order of the push down */
+	for(i = info->run_count - 1; i >= r; i--)
+		revision_slice_pull_up(&info->run_slices[i]);
+	for(i = 0; i < info->run_count; i++)
+	{
+		if(i < r)
+		{
+			bdesc_t * block = info->run_blocks[i];
+			if(info->run_slices[i].all_ready)
+				wb2_pop_slot_dirty(info, block);
+			FSTITCH_DEBUG_SEND(FDB_MODULE_CACHE, FDB_CACHE_WRITEBLOCK, object, block, block->flags);
+		}
+		revision_slice_destroy(&info->run_slices[i]);
+	}
+	
+	info->run_count = 0;
+	return r;
+}
+
+/* Push 'block' down and add it to the pending run, which must be contiguous
+ * with it and not full. Returns 1 if the block was added, -EBUSY if some of
+ * its patches depend on the run, or else what wb2_flush_block() would. */
+static int wb2_run_add(BD_t * object, bdesc_t * block)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	revision_slice_t * slice = &info->run_slices[info->run_count];
+	int i, r;
+	FSTITCH_DEBUG_SEND(FDB_MODULE_CACHE, FDB_CACHE_LOOKBLOCK, object, block);
+	
+	/* in flight? */
+	if(block->in_flight)
+		return FLUSH_NONE;
+	
+	/* already flushed? */
+	if(!block->index_patches[object->graph_index].head)
+		return FLUSH_EMPTY;
+	
+	r = revision_slice_create(block, object, info->bd, slice);
+	if(r < 0)
+	{
+		printf("%s() returned %i; can't flush!\n", __FUNCTION__, r);
+		return FLUSH_NONE;
+	}
+	
+	r = 1;
+	if(!slice->ready_size)
+		r = FLUSH_NONE;
+	else if(info->run_count)
+		for(i = 0; i < slice->ready_size; i++)
+			if(slice->ready[i] && wb2_run_depends(info, slice->ready[i], WB2_RUN_DEPTH))
+			{
+				r = -EBUSY;
+				break;
+			}
+	
+	if(r != 1)
+	{
+		revision_slice_pull_up(slice);
+		revision_slice_destroy(slice);
+		return r;
+	}
+	
+	info->run_blocks[info->run_count++] = block;
+	return 1;
+}
+
+/* Write out dirty blocks in batches. Each batch is the set of blocks that
+ * have ready patches at our level, written in one ascending sweep by block
+ * number that starts where the last sweep stopped. Contiguous blocks in the
+ * sweep are written in runs. Writing a batch can make more blocks ready, so
+ * repeat until a batch writes nothing. */
+static void wb2_flush_elevator(BD_t * object, bool preen)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	
+	for(;;)
+	{
+		bdesc_t * block, * next;
+		size_t i, start, size;
+		int written = 0;
+		
+		vector_clear(info->elevator);
+		for(block = info->dirty.first; block; block = next)
+		{
+			next = block->lru_dirty.next;
+			if(block->in_flight)
+				continue;
+			/* we assume written blocks are dirty: clean them here */
+			if(!block->index_patches[object->graph_index].head)
+				wb2_pop_slot_dirty(info, block);
+			else if(block->ready_patches[object->level].head)
+				/* on failure, write the batch we have so far */
+				if(vector_push_back(info->elevator, block) < 0)
+					break;
+		}
+		
+		size = vector_size(info->elevator);
+		if(!size)
+			return;
+		vector_sort(info->elevator, wb2_block_number_compare);
+		for(start = 0; start < size; start++)
+			if(((bdesc_t *) vector_elt(info->elevator, start))->cache_number >= info->elevator_next)
+				break;
+		
+		for(i = 0; i < size; i++)
+		{
+			int status, delay = 0;
+			block = vector_elt(info->elevator, (start + i) % size);
+			
+			if(info->run_count)
+			{
+				bdesc_t * last = info->run_blocks[info->run_count - 1];
+				if(info->run_count == WB2_MAX_RUN || last->cache_number + last->length / object->blocksize != block->cache_number)
+					written += wb2_run_write(object, &delay);
+			}
+			/* if we're just preening, then stop if there was I/O delay */
+			if(preen && delay > 1)
+				return;
+			
+			status = wb2_run_add(object, block);
+			if(status == -EBUSY)
+			{
+				written += wb2_run_write(object, &delay);
+				if(preen && delay > 1)
+					return;
+				status = wb2_run_add(object, block);
+			}
+			if(status == FLUSH_EMPTY)
+				wb2_pop_slot_dirty(info, block);
+			info->elevator_next = block->cache_number + 1;
+		}
+		if(info->run_count)
+		{
+			int delay;
+			written += wb2_run_write(object, &delay);
+			if(preen && delay > 1)
+				return;
+		}
+		
+		if(!written)
+			return;
+	}
 }
 #endif
 
@@ -297,99 +591,36 @@ static void wb2_shrink_dblocks(BD_t * object, enum dshrink_strategy strategy)
 	struct cache_info * info = (struct cache_info *) object;
 	bdesc_t * block = info->dirty.last;
 	
-#if DIRTY_QUEUE_REORDERING
-	bdesc_t * stop = NULL;
-#define STOP stop
-	static uint32_t pass = 0;
-	if(!++pass)
-		pass = 1;
-#else
-#define STOP NULL
-#endif
-	
 #if DELAY_FLUSH_UNTIL_EXIT
 	if(fstitchd_is_running())
 		return;
 #endif
 	
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 	revision_tail_process_landing_requests();
 #endif
 	FSTITCH_DEBUG_SEND(FDB_MODULE_CACHE, FDB_CACHE_FINDBLOCK, object);
 	
+#if WB2_ELEVATOR
+	if(strategy != CLIP)
+	{
+		wb2_flush_elevator(object, strategy == PREEN);
+		return;
+	}
+#endif
+#if WB2_ADAPT
+	if(strategy == CLIP)
+		info->period.clips++;
+#endif
+	
 	/* in clip mode, stop as soon as we are below the soft limit */
-	while((info->dblocks > info->soft_dblocks || strategy != CLIP) && block != STOP)
+	while((info->dblocks > info->soft_dblocks || strategy != CLIP) && block)
 	{
 		int status, delay = 0;
-#if DIRTY_QUEUE_REORDERING
-		if(block->pass == pass)
-		{
-			block = block->lru_dirty.prev;
-			assert(block || !stop);
-			continue;
-		}
-		block->pass = pass;
-#endif
 		status = wb2_flush_block(object, block, &delay);
 		/* still dirty? */
 		if(status < 0)
-		{
-#if DIRTY_QUEUE_REORDERING
-			this_is_not_updated_yet();
-			/* pick somewhere later in the queue to move it */
-			bdesc_t * scan_block = NULL;
-			if(!block->in_flight)
-			{
-				patch_t * scan = block->index_patches[object->graph_index].head;
-				for(; !scan_block && scan; scan = scan->ddesc_index_next)
-					scan_block = wb2_find_block_before(object, scan, slot->block);
-			}
-			if(scan_block)
-			{
-				struct lru_slot * before_slot = NULL;
-				before_slot = (struct lru_slot *) hash_map_find_val(info->block_map, (void *) scan_block->number);
-				assert(slot != before_slot);
-				if(before_slot)
-				{
-					struct lru_slot * prev = slot->dirty.prev;
-					/* it had better be in the dirty list */
-					assert(before_slot->dirty.prev || info->dirty.first == before_slot);
-					if(before_slot->block_after_pass == pass)
-					{
-						struct lru_slot * try;
-						try = (struct lru_slot *) hash_map_find_val(info->block_map, (void *) before_slot->block_after_number);
-						if(try)
-						{
-							assert(slot != try);
-							assert(try->dirty.prev || info->dirty.first == try);
-							before_slot->block_after_number = slot->block->number;
-							before_slot = try;
-						}
-					}
-					else
-					{
-						before_slot->block_after_number = slot->block->number;
-						before_slot->block_after_pass = pass;
-					}
-					wb2_bounce_block_write(info, slot, before_slot);
-					if(info->dirty.first == slot && !stop && prev)
-						stop = slot;
-					slot = prev;
-					assert(slot || !stop);
-				}
-				else
-				{
-					slot = slot->dirty.prev;
-					assert(slot || !stop);
-				}
-			}
-			else
-#endif
-			{
-				block = block->lru_dirty.prev;
-				assert(block || !STOP);
-			}
-		}
+			block = block->lru_dirty.prev;
 		else
 		{
 			uint32_t number = block->cache_number;
@@ -413,7 +644,6 @@ static void wb2_shrink_dblocks(BD_t * object, enum dshrink_strategy strategy)
 					break;
 			}
 			block = prev;
-			assert(block || !STOP);
 		}
 		/* if we're just preening, then stop if there was I/O delay */
 		if(strategy == PREEN && delay > 1)
@@ -427,31 +657,106 @@ static void wb2_shrink_dblocks(BD_t * object, enum dshrink_strategy strategy)
 }
 
 /* reduce the number of blocks in the cache to below the soft limit, if
- * possible, by evicting clean blocks in LRU order */
+ * possible, by evicting clean blocks in LRU order (taking them from the
+ * in list first while it is over its share) */
 static void wb2_shrink_blocks(struct cache_info * info)
 {
-	bdesc_t * block = info->all.last;
+	bdesc_t * in = info->in.last;
+	bdesc_t * all = info->all.last;
+	uint32_t in_limit = info->soft_blocks / TWOQ_IN_DIV;
 	/* while there are more blocks than the soft limit, and there are clean blocks */
 	while(info->blocks >= info->soft_blocks && info->blocks > info->dblocks)
 	{
-		assert(block);
+		bdesc_t ** victim;
+		bdesc_t * block;
 		/* skip dirty blocks */
-		if(wb2_dirty_slot(info, block))
-			block = block->lru_all.prev;
+		while(in && wb2_dirty_slot(info, in))
+			in = in->lru_all.prev;
+		while(all && wb2_dirty_slot(info, all))
+			all = all->lru_all.prev;
+		if(in && (info->in_blocks > in_limit || !all))
+			victim = &in;
 		else
 		{
-			bdesc_t * prev = block->lru_all.prev;
-			wb2_pop_slot(info, block);
-			info->blocks--;
-			block = prev;
+			assert(all);
+			victim = &all;
 		}
+		block = *victim;
+		*victim = block->lru_all.prev;
+		wb2_ghost_add(info, block->cache_number);
+		wb2_pop_slot(info, block);
+		info->blocks--;
 	}
 }
 
+#if WB2_READAHEAD
+/* Note a read of 'count' blocks at 'number'. When it continues a stream,
+ * read ahead asynchronously so that at least a window's worth of blocks is
+ * being read ahead of the reader, doubling the window each time. Blocks read
+ * ahead wait below us until they are actually read, so a stream that stops
+ * does not push other blocks out of our cache. */
+static void wb2_read_ahead(BD_t * object, uint32_t number, uint16_t count)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	struct wb2_stream * stream = NULL;
+	struct wb2_stream * victim = &info->streams[0];
+	uint16_t nbdescs;
+	int i;
+	
+	info->stream_clock++;
+	for(i = 0; i < READAHEAD_STREAMS; i++)
+	{
+		if(info->streams[i].next == number)
+		{
+			stream = &info->streams[i];
+			break;
+		}
+		if(info->streams[i].used < victim->used)
+			victim = &info->streams[i];
+	}
+	if(!stream)
+	{
+		/* a candidate stream: read ahead if it is read sequentially */
+		victim->next = number + count;
+		victim->ahead = number + count;
+		victim->window = 0;
+		victim->used = info->stream_clock;
+		return;
+	}
+	
+	stream->used = info->stream_clock;
+	stream->next = number + count;
+	if(!stream->window)
+	{
+		stream->window = READAHEAD_MIN;
+		info->stats.streams++;
+	}
+	/* the reader caught up with us */
+	if(stream->ahead < stream->next)
+		stream->ahead = stream->next;
+	if(stream->ahead - stream->next >= stream->window * count)
+		return;
+	
+	nbdescs = stream->window;
+	if(stream->ahead >= object->numblocks)
+		return;
+	if(stream->ahead + nbdescs * count > object->numblocks)
+		nbdescs = (object->numblocks - stream->ahead) / count;
+	if(!nbdescs)
+		return;
+	info->stats.read_ahead += nbdescs * count;
+	CALL(info->bd, read_ahead, stream->ahead, count, nbdescs);
+	stream->ahead += nbdescs * count;
+	if(stream->window < READAHEAD_MAX)
+		stream->window *= 2;
+}
+#endif
+
 static bdesc_t * wb2_cache_bd_read_block(BD_t * object, uint32_t number, uint16_t count, page_t * page)
 {
 	struct cache_info * info = (struct cache_info *) object;
 	bdesc_t * block;
+	bool evicted = 0;
 	
 	/* make sure it's a valid block */
 	assert(count && number + count <= object->numblocks);
@@ -464,12 +769,22 @@ static bdesc_t * wb2_cache_bd_read_block(BD_t * object, uint32_t number, uint16_
 		wb2_touch_block_read(info, block);
 		if(!block->synthetic)
 		{
+			info->stats.hits++;
 			bdesc_ensure_linked_page(block, page);
+#if WB2_READAHEAD
+			wb2_read_ahead(object, number, count);
+#endif
 			return block;
 		}
 	}
 	else
 	{
+		evicted = wb2_ghost_take(info, number);
+#if WB2_ADAPT
+		info->period.misses++;
+		if(evicted)
+			info->period.ghost_hits++;
+#endif
 		if(info->dblocks > info->soft_dblocks)
 			wb2_shrink_dblocks(object, CLIP);
 		if(info->blocks >= info->soft_blocks)
@@ -480,12 +795,16 @@ static bdesc_t * wb2_cache_bd_read_block(BD_t * object, uint32_t number, uint16_
 	block = CALL(info->bd, read_block, number, count, page);
 	if(!block)
 		return NULL;
+	info->stats.misses++;
 	
 	if(block->synthetic)
 		block->synthetic = 0;
 	else
-		wb2_push_block(info, block, number);
+		wb2_push_block(info, block, number, evicted);
 	
+#if WB2_READAHEAD
+	wb2_read_ahead(object, number, count);
+#endif
 	return block;
 }
 
@@ -517,10 +836,16 @@ static bdesc_t * wb2_cache_bd_synthetic_read_block(BD_t * object, uint32_t numbe
 	if(!block)
 		return NULL;
 	
-	wb2_push_block(info, block, number);
+	wb2_push_block(info, block, number, wb2_ghost_take(info, number));
 	return block;
 }
 
+static int wb2_cache_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	return CALL(info->bd, read_ahead, number, count, nbdescs);
+}
+
 static int wb2_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct cache_info * info = (struct cache_info *) object;
@@ -543,7 +868,7 @@ static int wb2_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 	{
 		if(info->dblocks > info->soft_dblocks)
 			wb2_shrink_dblocks(object, CLIP);
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 		else
 			/* shrink_dblocks() calls revision_tail_process_landing_requests(),
 			 * so only call it if we aren't calling shrink_dblocks() above */
@@ -552,7 +877,7 @@ static int wb2_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 		if(info->blocks >= info->soft_blocks)
 			wb2_shrink_blocks(info);
 		
-		wb2_push_block(info, block, number);
+		wb2_push_block(info, block, number, wb2_ghost_take(info, number));
 		/* assume it's dirty, even if it's not: we'll discover
 		 * it later when a revision slice has zero size */
 		wb2_push_dirty(info, block);
@@ -561,6 +886,11 @@ static int wb2_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 	return 0;
 }
 
+static int wb2_cache_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int wb2_cache_bd_flush(BD_t * object, uint32_t blockno, patch_t * ch)
 {
 	struct cache_info * info = (struct cache_info *) object;
@@ -568,6 +898,19 @@ static int wb2_cache_bd_flush(BD_t * object, uint32_t blockno, patch_t * ch)
 
 	if(!start_dirty)
 		return FLUSH_EMPTY;
+	
+	if(blockno != FLUSH_DEVICE)
+	{
+		/* flush just the requested block */
+		int r;
+		bdesc_t * block = wb2_map_get_block(info, blockno);
+		if(!block || !wb2_dirty_slot(info, block))
+			return FLUSH_EMPTY;
+		r = wb2_flush_block(object, block, NULL);
+		if(r >= 0)
+			wb2_pop_slot_dirty(info, block);
+		return r;
+	}
 
 	for(;;)
 	{
@@ -577,7 +920,7 @@ static int wb2_cache_bd_flush(BD_t * object, uint32_t blockno, patch_t * ch)
 			return FLUSH_DONE;
 		if(info->dblocks == old_dirty)
 		{
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 			if(revision_tail_flights_exist())
 			{
 				KERNEL_INTERVAL(wait);
@@ -605,9 +948,153 @@ static int32_t wb2_cache_bd_get_block_space(BD_t * object)
 	return info->soft_dblocks - info->dblocks;
 }
 
+#if WB2_ADAPT
+/* get the amount of free and total memory, in KiB */
+static int wb2_read_meminfo(uint32_t * free_kb, uint32_t * total_kb)
+{
+#ifdef __KERNEL__
+	struct sysinfo si;
+	si_meminfo(&si);
+	*total_kb = si.totalram << (PAGE_SHIFT - 10);
+	*free_kb = (si.freeram + si.bufferram) << (PAGE_SHIFT - 10);
+	return 0;
+#else
+	char line[128];
+	unsigned value, mem_free = 0, cached = 0, available = 0;
+	bool have_available = 0;
+	FILE * meminfo = fopen("/proc/meminfo", "r");
+	if(!meminfo)
+		return -errno;
+	*total_kb = 0;
+	while(fgets(line, sizeof(line), meminfo))
+	{
+		if(sscanf(line, "MemTotal: %u", &value) == 1)
+			*total_kb = value;
+		else if(sscanf(line, "MemFree: %u", &value) == 1)
+			mem_free = value;
+		else if(sscanf(line, "Cached: %u", &value) == 1)
+			cached = value;
+		else if(sscanf(line, "MemAvailable: %u", &value) == 1)
+		{
+			available = value;
+			have_available = 1;
+		}
+	}
+	fclose(meminfo);
+	if(!*total_kb)
+		return -EINVAL;
+	/* older kernels do not have MemAvailable */
+	*free_kb = have_available ? available : mem_free + cached;
+	return 0;
+#endif
+}
+
+static void wb2_set_limits(struct cache_info * info, uint32_t soft_blocks, uint32_t dirty16)
+{
+	uint32_t soft_dblocks = (uint64_t) soft_blocks * dirty16 / 16;
+	bool low = info->soft_dblocks == info->soft_dblocks_low;
+	if(!soft_dblocks)
+		soft_dblocks = 1;
+	info->soft_blocks = soft_blocks;
+	info->dirty16 = dirty16;
+	info->soft_dblocks_low = soft_dblocks * 9 / 10;
+	info->soft_dblocks_high = soft_dblocks * 11 / 10;
+	info->soft_dblocks = low ? info->soft_dblocks_low : info->soft_dblocks_high;
+}
+
+/* resize the limits based on what happened since the last call */
+static void wb2_adapt(struct cache_info * info)
+{
+	enum wb2_adapt_decision decision = WB2_ADAPT_NONE;
+	uint32_t soft_blocks = info->soft_blocks;
+	uint32_t dirty16 = info->dirty16;
+	uint32_t step = soft_blocks / ADAPT_STEP_DIV;
+	uint32_t free_kb = 0, total_kb = 0;
+	uint32_t step_kb;
+	bool memory_known = wb2_read_meminfo(&free_kb, &total_kb) >= 0;
+	bool memory_low = memory_known && free_kb < total_kb / 100 * ADAPT_FREE_LOW_PCT;
+	
+	if(!step)
+		step = 1;
+	step_kb = (uint64_t) step * info->my_bd.blocksize / 1024;
+	
+	if(memory_low)
+	{
+		if(soft_blocks > info->stats.min_blocks)
+		{
+			soft_blocks -= MIN(step, soft_blocks - info->stats.min_blocks);
+			decision = WB2_ADAPT_SHRINK_MEMORY;
+		}
+		dirty16 = info->dirty16_base;
+	}
+	else if(info->period.ghost_hits >= ADAPT_GHOST_MIN && info->period.ghost_hits * ADAPT_GHOST_DIV >= info->period.misses)
+	{
+		/* only take memory if it leaves enough free */
+		if(soft_blocks < info->stats.max_blocks && (!memory_known || free_kb > step_kb + total_kb / 100 * ADAPT_FREE_HIGH_PCT))
+		{
+			soft_blocks += MIN(step, info->stats.max_blocks - soft_blocks);
+			decision = WB2_ADAPT_GROW;
+		}
+	}
+	else if(!info->period.ghost_hits && soft_blocks > info->stats.max_blocks / ADAPT_MAX_MUL)
+	{
+		/* drift back toward the initial limit */
+		soft_blocks -= MIN(step, soft_blocks - info->stats.max_blocks / ADAPT_MAX_MUL);
+		decision = WB2_ADAPT_SHRINK_IDLE;
+	}
+	
+	/* dirty blocks forced out young by the limit would likely have
+	 * absorbed more writes if they could have stayed longer */
+	if(!memory_low)
+	{
+		if(info->period.clips && info->period.flushed_young * 2 > info->period.flushed)
+		{
+			if(dirty16 < ADAPT_DIRTY_MAX16)
+				dirty16++;
+		}
+		else if(!info->period.clips && dirty16 > info->dirty16_base)
+			dirty16--;
+	}
+	
+	if(soft_blocks != info->soft_blocks || dirty16 != info->dirty16)
+	{
+		wb2_set_limits(info, soft_blocks, dirty16);
+		if(info->blocks >= info->soft_blocks)
+			wb2_shrink_blocks(info);
+	}
+	
+	switch(decision)
+	{
+		case WB2_ADAPT_GROW:
+			info->stats.grows++;
+			break;
+		case WB2_ADAPT_SHRINK_MEMORY:
+			info->stats.shrinks_memory++;
+			break;
+		case WB2_ADAPT_SHRINK_IDLE:
+			info->stats.shrinks_idle++;
+			break;
+		case WB2_ADAPT_NONE:
+			break;
+	}
+	info->stats.last_decision = decision;
+	info->stats.free_kb = free_kb;
+	info->stats.total_kb = total_kb;
+	info->stats.ghost_hits += info->period.ghost_hits;
+#if DEBUG_ADAPT
+	if(decision != WB2_ADAPT_NONE)
+		printf("%s(): decision %d: blocks %u/%u, dirty %u/%u, misses %u (ghost %u), free %u/%u KiB\n", __FUNCTION__, decision, info->blocks, info->soft_blocks, info->dblocks, info->soft_dblocks, info->period.misses, info->period.ghost_hits, free_kb, total_kb);
+#endif
+	memset(&info->period, 0, sizeof(info->period));
+}
+#endif
+
 static void wb2_cache_bd_callback(void * arg)
 {
 	BD_t * object = (BD_t *) arg;
+#if WB2_ADAPT
+	wb2_adapt((struct cache_info *) object);
+#endif
 	wb2_shrink_dblocks(object, PREEN);
 #if DEBUG_TIMING
 	struct cache_info * info = (struct cache_info *) object;
@@ -633,13 +1120,27 @@ static int wb2_cache_bd_destroy(BD_t * bd)
 		return r;
 	modman_dec_bd(info->bd, bd);
 	
+#if DEBUG_STATS
+	{
+		struct wb2_cache_stats stats;
+		wb2_cache_bd_get_stats(bd, &stats);
+		printf("%s(): policy %d, blocks %u/%u [%u, %u], hits %u, misses %u (ghost %u), streams %u, read ahead %u, grows %u, shrinks %u/%u\n", __FUNCTION__, stats.policy, stats.blocks, stats.soft_blocks, stats.min_blocks, stats.max_blocks, stats.hits, stats.misses, stats.ghost_hits, stats.streams, stats.read_ahead, stats.grows, stats.shrinks_memory, stats.shrinks_idle);
+	}
+#endif
+	
 	sched_unregister(wb2_cache_bd_callback, bd);
 	
 	/* the blocks are all clean, because we checked above - just release them */
 	while(info->all.first)
 		wb2_pop_slot(info, info->all.first);
+	while(info->in.first)
+		wb2_pop_slot(info, info->in.first);
 	
 	free(info->map);
+	free(info->ghost);
+#if WB2_ELEVATOR
+	vector_destroy(info->elevator);
+#endif
 	memset(info, 0, sizeof(*info));
 	free(info);
 	
@@ -649,11 +1150,21 @@ static int wb2_cache_bd_destroy(BD_t * bd)
 }
 
 BD_t * wb2_cache_bd(BD_t * disk, uint32_t soft_dblocks, uint32_t soft_blocks)
+{
+	return wb2_cache_bd_policy(disk, soft_dblocks, soft_blocks, WB2_DEFAULT_POLICY);
+}
+
+BD_t * wb2_cache_bd_policy(BD_t * disk, uint32_t soft_dblocks, uint32_t soft_blocks, enum wb2_policy policy)
 {
 	struct cache_info * info;
 	BD_t * bd;
+#if WB2_READAHEAD
+	int i;
+#endif
 	
-	if(soft_dblocks > soft_blocks)
+	if(soft_dblocks > soft_blocks || !soft_blocks)
+		return NULL;
+	if(policy != WB2_POLICY_LRU && policy != WB2_POLICY_2Q)
 		return NULL;
 	
 	info = malloc(sizeof(*info));
@@ -670,17 +1181,70 @@ BD_t * wb2_cache_bd(BD_t * disk, uint32_t soft_dblocks, uint32_t soft_blocks)
 	}
 	memset(info->map, 0, info->map_capacity * sizeof(*info->map));
 	
+	for(info->ghost_mask = GHOST_MIN; info->ghost_mask < soft_blocks / GHOST_DIV; info->ghost_mask <<= 1);
+	info->ghost = malloc(info->ghost_mask * sizeof(*info->ghost));
+	if(!info->ghost)
+	{
+		free(info->map);
+		free(info);
+		return NULL;
+	}
+	/* INVALID_BLOCK is all ones */
+	memset(info->ghost, 0xFF, info->ghost_mask * sizeof(*info->ghost));
+	info->ghost_mask--;
+	
+#if WB2_ELEVATOR
+	info->elevator = vector_create();
+	if(!info->elevator)
+	{
+		free(info->ghost);
+		free(info->map);
+		free(info);
+		return NULL;
+	}
+	info->elevator_next = 0;
+	info->run_count = 0;
+#endif
+#if WB2_READAHEAD
+	for(i = 0; i < READAHEAD_STREAMS; i++)
+	{
+		info->streams[i].next = INVALID_BLOCK;
+		info->streams[i].ahead = INVALID_BLOCK;
+		info->streams[i].window = 0;
+		info->streams[i].used = 0;
+	}
+	info->stream_clock = 0;
+#endif
+	
+#if WB2_ADAPT
+	info->dirty16 = soft_dblocks * 16 / soft_blocks;
+	if(!info->dirty16)
+		info->dirty16 = 1;
+	info->dirty16_base = info->dirty16;
+	memset(&info->period, 0, sizeof(info->period));
+#endif
+	memset(&info->stats, 0, sizeof(info->stats));
+	info->stats.min_blocks = soft_blocks / ADAPT_MIN_DIV;
+	info->stats.max_blocks = soft_blocks * ADAPT_MAX_MUL;
+	if(!info->stats.min_blocks)
+		info->stats.min_blocks = 1;
+	
 	BD_INIT(bd, wb2_cache_bd);
+	OBJMAGIC(bd) = WB2_CACHE_MAGIC;
 	
 	info->bd = disk;
+	info->policy = policy;
 	info->soft_blocks = soft_blocks;
 	info->blocks = 0;
+	info->in_blocks = 0;
 	info->soft_dblocks_low = soft_dblocks * 9 / 10;
 	info->soft_dblocks_high = soft_dblocks * 11 / 10;
 	info->soft_dblocks = info->soft_dblocks_high;
 	info->dblocks = 0;
 	info->all.first = NULL;
 	info->all.last = NULL;
+	info->in.first = NULL;
+	info->in.last = NULL;
 	info->dirty.first = NULL;
 	info->dirty.last = NULL;
 	bd->numblocks = disk->numblocks;
@@ -718,3 +1282,24 @@ BD_t * wb2_cache_bd(BD_t * disk, uint32_t soft_dblocks, uint32_t soft_blocks)
 	FSTITCH_DEBUG_SEND(FDB_MODULE_CACHE, FDB_CACHE_NOTIFY, bd);
 	return bd;
 }
+
+int wb2_cache_bd_get_stats(BD_t * bd, struct wb2_cache_stats * stats)
+{
+	struct cache_info * info = (struct cache_info *) bd;
+	
+	if(OBJMAGIC(bd) != WB2_CACHE_MAGIC)
+		return -EINVAL;
+	
+	*stats = info->stats;
+	stats->policy = info->policy;
+	stats->blocks = info->blocks;
+	stats->in_blocks = info->in_blocks;
+	stats->soft_blocks = info->soft_blocks;
+	stats->dblocks = info->dblocks;
+	stats->soft_dblocks = info->soft_dblocks;
+#if WB2_ADAPT
+	stats->ghost_hits += info->period.ghost_hits;
+#endif
+	stats->oldest_dirty_age = info->dirty.last ? jiffy_time() - info->dirty.last->dirty_time : 0;
+	return 0;
+}
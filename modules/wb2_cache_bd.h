@@ -7,6 +7,48 @@
 
 #include <fscore/bd.h>
 
+enum wb2_policy {
+	WB2_POLICY_LRU, /* evict clean blocks in LRU order */
+	WB2_POLICY_2Q   /* scan resistant: blocks used once are evicted first */
+};
+
+/* soft_dblocks and soft_blocks are the initial limits; they adapt at runtime */
 BD_t * wb2_cache_bd(BD_t * disk, uint32_t soft_dblocks, uint32_t soft_blocks);
+BD_t * wb2_cache_bd_policy(BD_t * disk, uint32_t soft_dblocks, uint32_t soft_blocks, enum wb2_policy policy);
+
+#define WB2_DIRTY_AGE_BUCKETS 8
+
+enum wb2_adapt_decision {
+	WB2_ADAPT_NONE,
+	WB2_ADAPT_GROW,          /* evicted blocks were being read again */
+	WB2_ADAPT_SHRINK_MEMORY, /* free memory was low */
+	WB2_ADAPT_SHRINK_IDLE    /* no benefit seen from the extra blocks */
+};
+
+struct wb2_cache_stats {
+	enum wb2_policy policy;
+	uint32_t blocks, soft_blocks;
+	/* blocks on the 2Q first-use queue */
+	uint32_t in_blocks;
+	uint32_t dblocks, soft_dblocks;
+	/* the range soft_blocks adapts within */
+	uint32_t min_blocks, max_blocks;
+	/* reads since construction */
+	uint32_t hits, misses, ghost_hits;
+	/* sequential read streams detected, and blocks read ahead for them */
+	uint32_t streams, read_ahead;
+	/* number of adaptive limit changes of each kind */
+	uint32_t grows, shrinks_memory, shrinks_idle;
+	enum wb2_adapt_decision last_decision;
+	/* free and total memory at the last decision, in KiB (0 if unknown) */
+	uint32_t free_kb, total_kb;
+	/* age of the oldest dirty block, in jiffies */
+	uint32_t oldest_dirty_age;
+	/* blocks written back by how long they were dirty:
+	 * [0, 1s), [1s, 2s), [2s, 4s), ..., [64s, inf) */
+	uint32_t dirty_age[WB2_DIRTY_AGE_BUCKETS];
+};
+
+int wb2_cache_bd_get_stats(BD_t * bd, struct wb2_cache_stats * stats);
 
 #endif /* __FSTITCH_MODULES_WB2_CACHE_BD_H */
@@ -180,7 +180,7 @@ static int wb_evict_block(BD_t * object, bool only_dirty)
 {
 	struct cache_info * info = (struct cache_info *) object;
 	
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 	revision_tail_process_landing_requests();
 #endif
 	for(;;)
@@ -197,7 +197,7 @@ static int wb_evict_block(BD_t * object, bool only_dirty)
 			}
 			r |= code;
 		}
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 		/* For both FLUSH_NONE and FLUSH_SOME we must wait to make
 		 * progress if there are any flights in progress. For FLUSH_NONE
 		 * this is obvious; for FLUSH_SOME you must consider that the
@@ -298,6 +298,12 @@ static bdesc_t * wb_cache_bd_synthetic_read_block(BD_t * object, uint32_t number
 	return block;
 }
 
+static int wb_cache_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	return CALL(info->bd, read_ahead, number, count, nbdescs);
+}
+
 static int wb_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct cache_info * info = (struct cache_info *) object;
@@ -331,6 +337,11 @@ static int wb_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t numb
 	}
 }
 
+static int wb_cache_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int wb_cache_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	int dirty, start_dirty = wb_cache_dirty_count(object);
@@ -373,7 +384,7 @@ static void wb_cache_bd_callback(void * arg)
 	/* FIXME: try to come up with a good flush ordering, instead of waiting for the next callback? */
 	for(slot = info->blocks[0].lru; slot != &info->blocks[0]; slot = slot->prev)
 	{
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 		revision_tail_process_landing_requests();
 #endif
 		wb_flush_block(object, slot);
@@ -258,7 +258,7 @@ static void wbr_shrink_dblocks(BD_t * object, enum dshrink_strategy strategy)
 		return;
 #endif
 	
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 	revision_tail_process_landing_requests();
 #endif
 	FSTITCH_DEBUG_SEND(FDB_MODULE_CACHE, FDB_CACHE_FINDBLOCK, object);
@@ -408,6 +408,12 @@ static bdesc_t * wbr_cache_bd_synthetic_read_block(BD_t * object, uint32_t numbe
 	return block;
 }
 
+static int wbr_cache_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	return CALL(info->bd, read_ahead, number, count, nbdescs);
+}
+
 static int wbr_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct cache_info * info = (struct cache_info *) object;
@@ -431,7 +437,7 @@ static int wbr_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 	{
 		if(info->dblocks > info->soft_dblocks)
 			wbr_shrink_dblocks(object, CLIP);
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 		else
 			/* shrink_dblocks() calls revision_tail_process_landing_requests(),
 			 * so only call it if we aren't calling shrink_dblocks() above */
@@ -451,6 +457,11 @@ static int wbr_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t num
 	return 0;
 }
 
+static int wbr_cache_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int wbr_cache_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	struct cache_info * info = (struct cache_info *) object;
@@ -467,7 +478,7 @@ static int wbr_cache_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 			return FLUSH_DONE;
 		if(info->dblocks == old_dirty)
 		{
-#ifdef __KERNEL__
+#if REVISION_TAIL_FLIGHTS
 			if(revision_tail_flights_exist())
 			{
 				KERNEL_INTERVAL(wait);
@@ -91,6 +91,19 @@ static uint32_t wholedisk_get_file_block(LFS_t * object, fdesc_t * file, uint32_
 	return offset / object->blocksize;
 }
 
+static uint32_t wholedisk_get_file_extent(LFS_t * object, fdesc_t * file, uint32_t offset, uint32_t * nblocks)
+{
+	uint32_t number = wholedisk_get_file_block(object, file, offset);
+	/* the rest of the disk is one extent */
+	if(number == INVALID_BLOCK || number >= object->blockdev->numblocks)
+	{
+		*nblocks = 0;
+		return INVALID_BLOCK;
+	}
+	*nblocks = object->blockdev->numblocks - number;
+	return number;
+}
+
 static int wholedisk_get_dirent(LFS_t * object, fdesc_t * file, struct dirent * entry, uint16_t size, uint32_t * basep)
 {
 	const char * name;
@@ -178,6 +191,11 @@ static int wholedisk_free_block(LFS_t * object, fdesc_t * file, uint32_t block,
 	return -EINVAL;
 }
 
+static int wholedisk_free_blocks(LFS_t * object, fdesc_t * file, const uint32_t * blocks, uint32_t count, patch_t ** head)
+{
+	return -EINVAL;
+}
+
 static int wholedisk_remove_name(LFS_t * object, inode_t parent, const char * name, patch_t ** head)
 {
 	/* always fail - no filenames */
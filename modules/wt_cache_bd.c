@@ -165,6 +165,12 @@ static bdesc_t * wt_cache_bd_synthetic_read_block(BD_t * object, uint32_t number
 	return block;
 }
 
+static int wt_cache_bd_read_ahead(BD_t * object, uint32_t number, uint16_t count, uint16_t nbdescs)
+{
+	struct cache_info * info = (struct cache_info *) object;
+	return CALL(info->bd, read_ahead, number, count, nbdescs);
+}
+
 static int wt_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t number)
 {
 	struct cache_info * info = (struct cache_info *) object;
@@ -199,6 +205,11 @@ static int wt_cache_bd_write_block(BD_t * object, bdesc_t * block, uint32_t numb
 	return CALL(info->bd, write_block, block, number);
 }
 
+static int wt_cache_bd_write_blocks(BD_t * object, bdesc_t ** blocks, uint16_t count, uint32_t number)
+{
+	return bdesc_write_blocks_each(object, blocks, count, number);
+}
+
 static int wt_cache_bd_flush(BD_t * object, uint32_t block, patch_t * ch)
 {
 	return FLUSH_EMPTY;